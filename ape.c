@@ -27,6 +27,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <string.h>
 #include <strings.h>
 
 /* http://www.personal.uni-jena.de/~pfk/mpp/sv8/apetag.html */
@@ -37,41 +38,61 @@ static const char preamble[PREAMBLE_SIZE] = { 'A', 'P', 'E', 'T', 'A', 'G', 'E',
 /* NOTE: not sizeof(struct ape_header)! */
 #define HEADER_SIZE (32)
 
-/* returns position of APE header or -1 if not found */
-static int find_ape_tag_slow(int fd)
-{
-	char buf[4096];
-	int match = 0;
-	int pos = 0;
+/* bytes read at once when searching for the tag */
+#define SCAN_SIZE (64 * 1024)
 
-	/* seek to start of file */
-	if (lseek(fd, pos, SEEK_SET) == -1)
-		return -1;
+/* returns the last preamble in @buf or NULL */
+static const char *find_last_preamble(const char *buf, size_t len)
+{
+	const char *found = NULL;
+	const char *p = buf;
 
-	while (1) {
-		int i, got = read(fd, buf, sizeof(buf));
+	while (len >= PREAMBLE_SIZE) {
+		const char *end = buf + len - PREAMBLE_SIZE + 1;
 
-		if (got == -1) {
-			if (errno == EAGAIN || errno == EINTR)
-				continue;
+		p = memchr(p, preamble[0], end - p);
+		if (!p)
 			break;
-		}
-		if (got == 0)
+		if (!memcmp(p, preamble, PREAMBLE_SIZE))
+			found = p;
+		if (++p == end)
 			break;
+	}
+	return found;
+}
+
+/*
+ * returns position of APE header or footer or -1 if not found.  the tag is
+ * usually near the end, behind other tags or garbage, so the file is
+ * searched backwards
+ */
+static off_t find_ape_tag_slow(int fd)
+{
+	char *buf = xnew(char, SCAN_SIZE + PREAMBLE_SIZE - 1);
+	off_t pos, end, found = -1;
+
+	end = lseek(fd, 0, SEEK_END);
+	while (end > 0) {
+		const char *p;
+		ssize_t got;
 
-		for (i = 0; i < got; i++) {
-			if (buf[i] != preamble[match]) {
-				match = 0;
-				continue;
-			}
+		/* overlap the next chunk by PREAMBLE_SIZE - 1 bytes */
+		pos = end > SCAN_SIZE ? end - SCAN_SIZE : 0;
+		if (lseek(fd, pos, SEEK_SET) == -1)
+			break;
+		got = read_all(fd, buf, SCAN_SIZE + PREAMBLE_SIZE - 1);
+		if (got == -1)
+			break;
 
-			match++;
-			if (match == PREAMBLE_SIZE)
-				return pos + i + 1 - PREAMBLE_SIZE;
+		p = find_last_preamble(buf, got);
+		if (p) {
+			found = pos + (p - buf);
+			break;
 		}
-		pos += got;
+		end = pos;
 	}
-	return -1;
+	free(buf);
+	return found;
 }
 
 static int ape_parse_header(const char *buf, struct ape_header *h)
@@ -101,7 +122,7 @@ static int read_header(int fd, struct ape_header *h)
  */
 static int find_ape_tag(int fd, struct ape_header *h, int slow)
 {
-	int pos;
+	off_t pos;
 
 	if (lseek(fd, -HEADER_SIZE, SEEK_END) == -1)
 		return 0;
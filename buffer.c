@@ -21,9 +21,19 @@
 #include "locking.h"
 #include "debug.h"
 
+#include <stdatomic.h>
+#include <time.h>
+
 /*
- * chunk can be accessed by either consumer OR producer, not both at same time
- * -> no need to lock
+ * Single-producer/single-consumer ring of chunks.
+ *
+ * Chunks between the read and write index are filled and owned by the
+ * consumer, the rest are owned by the producer.  Each side only advances its
+ * own index, so chunk contents are handed over by the release store of the
+ * index and no locking is needed.
+ *
+ * The indices run from 0 to 2 * buffer_nr_chunks - 1 so that a full ring
+ * (w - r == nr_chunks) can be told apart from an empty one (w == r).
  */
 struct chunk {
 	char data[CHUNK_SIZE];
@@ -35,20 +45,90 @@ struct chunk {
 	 *
 	 * there are h - l bytes available (filled)
 	 */
-	unsigned int h : 31;
-
-	/* if chunk is marked filled it can only be accessed by consumer
-	 * otherwise only producer is allowed to access the chunk
-	 */
-	unsigned int filled : 1;
+	unsigned int h;
 };
 
 unsigned int buffer_nr_chunks;
 
-static pthread_mutex_t buffer_mutex = CMUS_MUTEX_INITIALIZER;
 static struct chunk *buffer_chunks = NULL;
-static unsigned int buffer_ridx;
-static unsigned int buffer_widx;
+static atomic_uint buffer_ridx;
+static atomic_uint buffer_widx;
+
+/*
+ * Used only to sleep in buffer_wait_*().  The indices are published before
+ * buffer_waiters is checked and buffer_waiters is published before the
+ * indices are checked, so either the waker sees the waiter or the waiter
+ * sees the new index.
+ */
+static pthread_mutex_t buffer_wait_mutex = CMUS_MUTEX_INITIALIZER;
+static pthread_cond_t buffer_wait_cond = CMUS_COND_INITIALIZER;
+static atomic_int buffer_waiters;
+
+static inline unsigned int buffer_next_idx(unsigned int idx)
+{
+	return (idx + 1) % (2 * buffer_nr_chunks);
+}
+
+static inline unsigned int buffer_distance(unsigned int r, unsigned int w)
+{
+	return (w + 2 * buffer_nr_chunks - r) % (2 * buffer_nr_chunks);
+}
+
+static inline struct chunk *buffer_chunk(unsigned int idx)
+{
+	return &buffer_chunks[idx % buffer_nr_chunks];
+}
+
+static void buffer_wake(void)
+{
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&buffer_waiters, memory_order_relaxed)) {
+		cmus_mutex_lock(&buffer_wait_mutex);
+		pthread_cond_broadcast(&buffer_wait_cond);
+		cmus_mutex_unlock(&buffer_wait_mutex);
+	}
+}
+
+static int buffer_has_data(void)
+{
+	return buffer_get_filled_chunks() > 0;
+}
+
+static int buffer_has_space(void)
+{
+	return buffer_get_filled_chunks() < buffer_nr_chunks;
+}
+
+static void buffer_wait(int (*ready)(void), int ms)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += ms / 1000;
+	ts.tv_nsec += (ms % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+
+	cmus_mutex_lock(&buffer_wait_mutex);
+	atomic_fetch_add(&buffer_waiters, 1);
+	atomic_thread_fence(memory_order_seq_cst);
+	if (!ready())
+		pthread_cond_timedwait(&buffer_wait_cond, &buffer_wait_mutex, &ts);
+	atomic_fetch_sub(&buffer_waiters, 1);
+	cmus_mutex_unlock(&buffer_wait_mutex);
+}
+
+void buffer_wait_data(int ms)
+{
+	buffer_wait(buffer_has_data, ms);
+}
+
+void buffer_wait_space(int ms)
+{
+	buffer_wait(buffer_has_space, ms);
+}
 
 void buffer_init(void)
 {
@@ -68,21 +148,21 @@ void buffer_free(void)
  * Returns number of bytes available at @pos
  *
  * After reading bytes mark them consumed calling buffer_consume().
+ *
+ * Consumer only.
  */
 int buffer_get_rpos(char **pos)
 {
+	unsigned int r = atomic_load_explicit(&buffer_ridx, memory_order_relaxed);
+	unsigned int w = atomic_load_explicit(&buffer_widx, memory_order_acquire);
 	struct chunk *c;
-	int size = 0;
 
-	cmus_mutex_lock(&buffer_mutex);
-	c = &buffer_chunks[buffer_ridx];
-	if (c->filled) {
-		size = c->h - c->l;
-		*pos = c->data + c->l;
-	}
-	cmus_mutex_unlock(&buffer_mutex);
+	if (r == w)
+		return 0;
 
-	return size;
+	c = buffer_chunk(r);
+	*pos = c->data + c->l;
+	return c->h - c->l;
 }
 
 /*
@@ -92,118 +172,90 @@ int buffer_get_rpos(char **pos)
  * non-zero it is guaranteed to be >= 1024.
  *
  * After writing bytes mark them filled calling buffer_fill().
+ *
+ * Producer only.
  */
 int buffer_get_wpos(char **pos)
 {
+	unsigned int w = atomic_load_explicit(&buffer_widx, memory_order_relaxed);
+	unsigned int r = atomic_load_explicit(&buffer_ridx, memory_order_acquire);
 	struct chunk *c;
-	int size = 0;
 
-	cmus_mutex_lock(&buffer_mutex);
-	c = &buffer_chunks[buffer_widx];
-	if (!c->filled) {
-		size = CHUNK_SIZE - c->h;
-		*pos = c->data + c->h;
-	}
-	cmus_mutex_unlock(&buffer_mutex);
+	if (buffer_distance(r, w) == buffer_nr_chunks)
+		return 0;
 
-	return size;
+	c = buffer_chunk(w);
+	*pos = c->data + c->h;
+	return CHUNK_SIZE - c->h;
 }
 
+/* consumer only */
 void buffer_consume(int count)
 {
+	unsigned int r = atomic_load_explicit(&buffer_ridx, memory_order_relaxed);
 	struct chunk *c;
 
 	BUG_ON(count < 0);
-	cmus_mutex_lock(&buffer_mutex);
-	c = &buffer_chunks[buffer_ridx];
-	BUG_ON(!c->filled);
+	BUG_ON(r == atomic_load_explicit(&buffer_widx, memory_order_acquire));
+	c = buffer_chunk(r);
 	c->l += count;
 	if (c->l == c->h) {
 		c->l = 0;
 		c->h = 0;
-		c->filled = 0;
-		buffer_ridx++;
-		buffer_ridx %= buffer_nr_chunks;
+		/* hand the chunk back to the producer */
+		atomic_store_explicit(&buffer_ridx, buffer_next_idx(r),
+				memory_order_release);
+		buffer_wake();
 	}
-	cmus_mutex_unlock(&buffer_mutex);
 }
 
-/* chunk is marked filled if free bytes < 1024 or count == 0 */
+/*
+ * chunk is marked filled if free bytes < 1024 or count == 0
+ *
+ * producer only
+ */
 int buffer_fill(int count)
 {
-	struct chunk *c;
-	int filled = 0;
+	unsigned int w = atomic_load_explicit(&buffer_widx, memory_order_relaxed);
+	struct chunk *c = buffer_chunk(w);
 
-	cmus_mutex_lock(&buffer_mutex);
-	c = &buffer_chunks[buffer_widx];
-	BUG_ON(c->filled);
+	BUG_ON(buffer_distance(atomic_load_explicit(&buffer_ridx,
+				memory_order_acquire), w) == buffer_nr_chunks);
 	c->h += count;
 
 	if (CHUNK_SIZE - c->h < 1024 || (count == 0 && c->h > 0)) {
-		c->filled = 1;
-		buffer_widx++;
-		buffer_widx %= buffer_nr_chunks;
-		filled = 1;
+		/* hand the chunk over to the consumer */
+		atomic_store_explicit(&buffer_widx, buffer_next_idx(w),
+				memory_order_release);
+		buffer_wake();
+		return 1;
 	}
-
-	cmus_mutex_unlock(&buffer_mutex);
-	return filled;
+	return 0;
 }
 
+/* both producer and consumer must be stopped */
 void buffer_reset(void)
 {
 	int i;
 
-	cmus_mutex_lock(&buffer_mutex);
-	buffer_ridx = 0;
-	buffer_widx = 0;
 	for (i = 0; i < buffer_nr_chunks; i++) {
 		buffer_chunks[i].l = 0;
 		buffer_chunks[i].h = 0;
-		buffer_chunks[i].filled = 0;
 	}
-	cmus_mutex_unlock(&buffer_mutex);
+	atomic_store(&buffer_ridx, 0);
+	atomic_store(&buffer_widx, 0);
+	buffer_wake();
 }
 
+/* can be called from any thread, the result may be slightly out of date */
 int buffer_get_filled_chunks(void)
 {
-	int c;
-
-	cmus_mutex_lock(&buffer_mutex);
-	if (buffer_ridx < buffer_widx) {
-		/*
-		 * |__##########____|
-		 *    r         w
-		 *
-		 * |############____|
-		 *  r           w
-		 */
-		c = buffer_widx - buffer_ridx;
-	} else if (buffer_ridx > buffer_widx) {
-		/*
-		 * |#######______###|
-		 *         w     r
-		 *
-		 * |_____________###|
-		 *  w            r
-		 */
-		c = buffer_nr_chunks - buffer_ridx + buffer_widx;
-	} else {
-		/*
-		 * |################|
-		 *     r
-		 *     w
-		 *
-		 * |________________|
-		 *     r
-		 *     w
-		 */
-		if (buffer_chunks[buffer_ridx].filled) {
-			c = buffer_nr_chunks;
-		} else {
-			c = 0;
-		}
-	}
-	cmus_mutex_unlock(&buffer_mutex);
+	unsigned int w = atomic_load_explicit(&buffer_widx, memory_order_acquire);
+	unsigned int r = atomic_load_explicit(&buffer_ridx, memory_order_acquire);
+	unsigned int c = buffer_distance(r, w);
+
+	/* r may have passed the w we loaded */
+	if (c > buffer_nr_chunks)
+		c = 0;
 	return c;
 }
@@ -44,4 +44,11 @@ int buffer_fill(int count);
 void buffer_reset(void);
 int buffer_get_filled_chunks(void);
 
+/*
+ * Sleep until a chunk has been filled (consumer) or freed (producer), the
+ * buffer is reset or @ms milliseconds have passed.
+ */
+void buffer_wait_data(int ms);
+void buffer_wait_space(int ms);
+
 #endif
@@ -26,6 +26,10 @@
 #include "xstrjoin.h"
 #include "gbuf.h"
 #include "options.h"
+#include "pool.h"
+#include "ti_hash.h"
+#include "job.h"
+#include "debug.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -36,6 +40,8 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <string.h>
+#include <signal.h>
 #include <sys/mman.h>
 
 #define CACHE_VERSION   0x0d
@@ -75,25 +81,234 @@ struct cache_entry {
 STATIC_ASSERT(CACHE_ENTRY_TOTAL_SIZE == sizeof(struct cache_entry));
 STATIC_ASSERT(CACHE_ENTRY_TOTAL_SIZE == offsetof(struct cache_entry, strings));
 
+// Cmus Track Journal, same version and flags as the cache
+static char journal_header[8] = "CTJ\0\0\0\0\0";
+
+/*
+ * The journal records changes made to the cache since the cache file was
+ * last written.  Records only set state, never modify it relative to the
+ * previous value, so replaying a record twice is harmless.
+ */
+enum journal_type {
+	JOURNAL_ADD = 1,
+	JOURNAL_REMOVE,
+	JOURNAL_PLAY_COUNT,
+};
+
+// host byte order, aligned like cache entries
+struct journal_record {
+	// size of the record including this header, without padding
+	uint32_t size;
+	uint32_t type;
+
+	// ADD: struct cache_entry
+	// REMOVE: filename
+	// PLAY_COUNT: uint32_t play_count, filename
+	char data[];
+};
+
+// compact when the journal is larger than this and half of the cache file
+#define JOURNAL_COMPACT_MIN_SIZE (1024 * 1024)
+
+// Cmus Track Directories, same version and flags as the cache
+static char dirs_header[8] = "CTD\0\0\0\0\0";
+
+#define DIR_HAS_CUE	0x01
+
+#define DIR_ENTRY_DIR	'd'
+#define DIR_ENTRY_FILE	'f'
+#define DIR_ENTRY_OTHER	'o'
+
+/*
+ * Listing of a directory as seen by add_dir(), valid as long as the
+ * directory has the same inode and mtime.  Host byte order, aligned like
+ * cache entries.
+ */
+struct dir_record {
+	// size of the record including this header, without padding
+	uint32_t size;
+	uint32_t nr;
+	uint32_t flags;
+	uint32_t _reserved;
+	uint64_t dev;
+	uint64_t ino;
+	int64_t mtime;
+	int64_t mtime_nsec;
+
+	// path, then nr * (DIR_ENTRY_* type, name)
+	char strings[];
+};
+
+struct dir_node {
+	struct dir_node *next;
+	uint32_t hash;
+	// the record is in the mmap'd file and not freed
+	bool mapped;
+	struct dir_record *r;
+};
+
 
 #define ALIGN(size) (((size) + sizeof(long) - 1) & ~(sizeof(long) - 1))
-#define HASH_SIZE 1023
 
-static struct track_info *hash_table[HASH_SIZE];
+static struct ti_hash hash_table = TI_HASH_INIT;
 static char *cache_filename;
-static int total;
+
+static char *journal_filename;
+// -1 while replaying or if the journal could not be written
+static int journal_fd = -1;
+static unsigned int journal_size;
+static unsigned int cache_size;
+static int compact_scheduled;
+// cache_init() wants a compaction, see cache_schedule_startup_compact()
+static int compact_at_startup;
 
 struct fifo_mutex cache_mutex = FIFO_MUTEX_INITIALIZER;
 
+static char *dirs_filename;
+static struct dir_node **dir_buckets;
+static unsigned int dir_mask;
+static unsigned int dir_count;
+// dir records have changed since the file was read
+static int dirs_dirty;
 
-static void add_ti(struct track_info *ti, unsigned int hash)
+/* the cache and dirs files, they stay mapped */
+enum { MAP_CACHE, MAP_DIRS, NR_MAPPINGS };
+static struct {
+	char *start;
+	size_t size;
+} mappings[NR_MAPPINGS];
+static size_t page_size;
+/* a mapped file was truncated, see mapping_fault() */
+static volatile sig_atomic_t mapping_truncated;
+
+
+static void add_cache_entry(struct gbuf *buf, struct track_info *ti);
+static void read_dirs(void);
+
+/*
+ * Reading pages of a mapped file that has been truncated behind cmus' back
+ * raises SIGBUS.  The lost pages are replaced by zero pages so that the
+ * strings in them read as empty, and the cache is not written again
+ * because it would save them
+ */
+static void mapping_fault(int sig, siginfo_t *info, void *context)
+{
+	char *addr = info->si_addr;
+	int i;
+
+	for (i = 0; i < NR_MAPPINGS; i++) {
+		char *start = mappings[i].start;
+		char *end = start + mappings[i].size;
+		char *page;
+
+		if (!start || addr < start || addr >= end)
+			continue;
+		page = addr - (uintptr_t)addr % page_size;
+		if (mmap(page, end - page, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+					-1, 0) == MAP_FAILED)
+			break;
+		mapping_truncated = 1;
+		return;
+	}
+	/* not ours, fault again and die */
+	signal(SIGBUS, SIG_DFL);
+}
+
+static void guard_mappings(void)
+{
+	struct sigaction act;
+
+	page_size = sysconf(_SC_PAGESIZE);
+	sigemptyset(&act.sa_mask);
+	act.sa_flags = SA_SIGINFO;
+	act.sa_sigaction = mapping_fault;
+	sigaction(SIGBUS, &act, NULL);
+}
+
+static int cache_writable(void)
+{
+	if (mapping_truncated)
+		d_print("%s or %s was truncated, not writing the cache\n",
+				cache_filename, dirs_filename);
+	return !mapping_truncated;
+}
+
+static void schedule_compact(void)
+{
+	if (!compact_scheduled) {
+		compact_scheduled = 1;
+		job_schedule_cache_compact();
+	}
+}
+
+static void journal_begin(struct gbuf *buf, enum journal_type type)
+{
+	struct journal_record r = { .size = 0, .type = type };
+
+	gbuf_add_bytes(buf, &r, sizeof(r));
+}
+
+static void journal_commit(struct gbuf *buf)
+{
+	struct journal_record *r = (void *)buf->buffer;
+	unsigned int size = buf->len;
+
+	r->size = size;
+	gbuf_set(buf, 0, ALIGN(size) - size);
+	if (write_all(journal_fd, buf->buffer, buf->len) < 0) {
+		/* a torn record ends the journal, cache_close() writes everything */
+		d_print("writing %s: %s\n", journal_filename, strerror(errno));
+		close(journal_fd);
+		journal_fd = -1;
+		return;
+	}
+	journal_size += buf->len;
+	if (journal_size > JOURNAL_COMPACT_MIN_SIZE && journal_size > cache_size / 2)
+		schedule_compact();
+}
+
+static void journal_add(struct track_info *ti)
+{
+	GBUF(buf);
+
+	if (journal_fd < 0)
+		return;
+	journal_begin(&buf, JOURNAL_ADD);
+	add_cache_entry(&buf, ti);
+	journal_commit(&buf);
+	gbuf_free(&buf);
+}
+
+static void journal_remove(struct track_info *ti)
+{
+	GBUF(buf);
+
+	if (journal_fd < 0)
+		return;
+	journal_begin(&buf, JOURNAL_REMOVE);
+	gbuf_add_bytes(&buf, ti->filename, strlen(ti->filename) + 1);
+	journal_commit(&buf);
+	gbuf_free(&buf);
+}
+
+static void journal_play_count(struct track_info *ti)
 {
-	unsigned int pos = hash % HASH_SIZE;
-	struct track_info *next = hash_table[pos];
+	uint32_t play_count = ti->play_count;
+	GBUF(buf);
 
-	ti->next = next;
-	hash_table[pos] = ti;
-	total++;
+	if (journal_fd < 0)
+		return;
+	journal_begin(&buf, JOURNAL_PLAY_COUNT);
+	gbuf_add_bytes(&buf, &play_count, sizeof(play_count));
+	gbuf_add_bytes(&buf, ti->filename, strlen(ti->filename) + 1);
+	journal_commit(&buf);
+	gbuf_free(&buf);
+}
+
+static void add_ti(struct track_info *ti, unsigned int hash)
+{
+	ti_hash_insert(&hash_table, ti, hash);
+	journal_add(ti);
 }
 
 static int valid_cache_entry(const struct cache_entry *e, unsigned int avail)
@@ -121,20 +336,18 @@ static int valid_cache_entry(const struct cache_entry *e, unsigned int avail)
 	return 1;
 }
 
-static struct track_info *cache_entry_to_ti(struct cache_entry *e)
+/*
+ * With @mapped the strings of the track_info point into @e, which must stay
+ * mapped for as long as the track_info exists.
+ */
+static struct track_info *cache_entry_to_ti(struct cache_entry *e, bool mapped)
 {
-	const char *strings = e->strings;
-	struct track_info *ti = track_info_new(strings);
+	char *strings = e->strings;
+	struct track_info *ti;
 	struct keyval *kv;
 	int str_size = e->size - sizeof(*e);
 	int pos, i, count;
 
-	ti->duration = e->duration;
-	ti->bitrate = e->bitrate;
-	ti->mtime = e->mtime;
-	ti->play_count = e->play_count;
-	ti->bpm = e->bpm;
-
 	// count strings (filename + codec + codec_profile + key/val pairs)
 	count = 0;
 	for (i = 0; i < str_size; i++) {
@@ -143,62 +356,60 @@ static struct track_info *cache_entry_to_ti(struct cache_entry *e)
 	}
 	count = (count - 3) / 2;
 
-	// NOTE: filename already copied by track_info_new()
-	pos = strlen(strings) + 1;
-	ti->codec = strings[pos] ? xstrdup(strings + pos) : NULL;
-	pos += strlen(strings + pos) + 1;
-	ti->codec_profile = strings[pos] ? xstrdup(strings + pos) : NULL;
-	pos += strlen(strings + pos) + 1;
+	if (mapped) {
+		ti = track_info_new_mapped(strings);
+		pos = strlen(strings) + 1;
+		ti->codec = strings[pos] ? strings + pos : NULL;
+		pos += strlen(strings + pos) + 1;
+		ti->codec_profile = strings[pos] ? strings + pos : NULL;
+		pos += strlen(strings + pos) + 1;
+	} else {
+		// NOTE: filename copied by track_info_new()
+		ti = track_info_new(strings);
+		pos = strlen(strings) + 1;
+		ti->codec = strings[pos] ? xstrdup(strings + pos) : NULL;
+		pos += strlen(strings + pos) + 1;
+		ti->codec_profile = strings[pos] ? xstrdup(strings + pos) : NULL;
+		pos += strlen(strings + pos) + 1;
+	}
+
+	ti->duration = e->duration;
+	ti->bitrate = e->bitrate;
+	ti->mtime = e->mtime;
+	ti->play_count = e->play_count;
+	ti->bpm = e->bpm;
+
 	kv = xnew(struct keyval, count + 1);
 	for (i = 0; i < count; i++) {
 		int size;
 
 		size = strlen(strings + pos) + 1;
-		kv[i].key = xstrdup(strings + pos);
+		kv[i].key = mapped ? strings + pos : xstrdup(strings + pos);
 		pos += size;
 
 		size = strlen(strings + pos) + 1;
-		kv[i].val = xstrdup(strings + pos);
+		kv[i].val = mapped ? strings + pos : xstrdup(strings + pos);
 		pos += size;
 	}
 	kv[i].key = NULL;
 	kv[i].val = NULL;
-	track_info_set_comments(ti, kv);
+	if (mapped)
+		track_info_set_comments_mapped(ti, kv);
+	else
+		track_info_set_comments(ti, kv);
 	return ti;
 }
 
 struct track_info *lookup_cache_entry(const char *filename, unsigned int hash)
 {
-	struct track_info *ti = hash_table[hash % HASH_SIZE];
-
-	while (ti) {
-		if (!strcmp(filename, ti->filename))
-			return ti;
-		ti = ti->next;
-	}
-	return NULL;
+	return ti_hash_lookup(&hash_table, filename, hash);
 }
 
 static void do_cache_remove_ti(struct track_info *ti, unsigned int hash)
 {
-	unsigned int pos = hash % HASH_SIZE;
-	struct track_info *t = hash_table[pos];
-	struct track_info *next, *prev = NULL;
-
-	while (t) {
-		next = t->next;
-		if (t == ti) {
-			if (prev) {
-				prev->next = next;
-			} else {
-				hash_table[pos] = next;
-			}
-			total--;
-			track_info_unref(ti);
-			return;
-		}
-		prev = t;
-		t = next;
+	if (ti_hash_remove(&hash_table, ti, hash)) {
+		journal_remove(ti);
+		track_info_unref(ti);
 	}
 }
 
@@ -230,6 +441,8 @@ static int read_cache(void)
 		close(fd);
 		return -1;
 	}
+	mappings[MAP_CACHE].start = buf;
+	mappings[MAP_CACHE].size = size;
 
 	if (memcmp(buf, cache_header, sizeof(cache_header)))
 		goto corrupt;
@@ -242,24 +455,144 @@ static int read_cache(void)
 		if (!valid_cache_entry(e, size - offset))
 			goto corrupt;
 
-		ti = cache_entry_to_ti(e);
+		ti = cache_entry_to_ti(e, true);
 		add_ti(ti, hash_str(ti->filename));
 		offset += ALIGN(e->size);
 	}
-	munmap(buf, size);
+	/* track_infos point into buf, it is never unmapped */
 	close(fd);
+	cache_size = size;
 	return 0;
 corrupt:
-	munmap(buf, size);
+	/* keep entries read before the corrupt one */
+	if (offset <= sizeof(cache_header)) {
+		mappings[MAP_CACHE].start = NULL;
+		munmap(buf, size);
+	}
 close:
 	close(fd);
 	// corrupt
 	return -2;
 }
 
+static int valid_journal_record(const struct journal_record *r, unsigned int avail)
+{
+	unsigned int size;
+
+	if (avail < sizeof(*r))
+		return 0;
+	if (r->size < sizeof(*r) || r->size > avail)
+		return 0;
+
+	size = r->size - sizeof(*r);
+	switch (r->type) {
+	case JOURNAL_ADD:
+		return valid_cache_entry((const void *)r->data, size) &&
+			((const struct cache_entry *)r->data)->size == size;
+	case JOURNAL_REMOVE:
+		return size > 0 && !r->data[size - 1];
+	case JOURNAL_PLAY_COUNT:
+		return size > sizeof(uint32_t) && !r->data[size - 1];
+	}
+	return 0;
+}
+
+static void replay_journal_record(struct journal_record *r)
+{
+	struct track_info *ti, *old;
+	const char *filename;
+	unsigned int hash;
+	uint32_t play_count;
+
+	switch (r->type) {
+	case JOURNAL_ADD:
+		ti = cache_entry_to_ti((void *)r->data, false);
+		hash = hash_str(ti->filename);
+		old = lookup_cache_entry(ti->filename, hash);
+		if (old)
+			do_cache_remove_ti(old, hash);
+		add_ti(ti, hash);
+		break;
+	case JOURNAL_REMOVE:
+		filename = r->data;
+		hash = hash_str(filename);
+		old = lookup_cache_entry(filename, hash);
+		if (old)
+			do_cache_remove_ti(old, hash);
+		break;
+	case JOURNAL_PLAY_COUNT:
+		memcpy(&play_count, r->data, sizeof(play_count));
+		filename = r->data + sizeof(play_count);
+		old = lookup_cache_entry(filename, hash_str(filename));
+		if (old)
+			old->play_count = play_count;
+		break;
+	}
+}
+
+/*
+ * Applies the journal to the cache read from the cache file and opens it
+ * for appending.  Replay stops at the first invalid record, which is
+ * usually one torn by a crash, and the journal is truncated there.
+ */
+static int open_journal(void)
+{
+	unsigned int size, offset = 0;
+	struct stat st = {};
+	char *buf;
+	int fd;
+
+	fd = open(journal_filename, O_RDWR | O_CREAT | O_APPEND, 0666);
+	if (fd < 0)
+		return -1;
+	fstat(fd, &st);
+	size = st.st_size;
+
+	if (size >= sizeof(journal_header)) {
+		buf = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (buf == MAP_FAILED) {
+			close(fd);
+			return -1;
+		}
+		if (!memcmp(buf, journal_header, sizeof(journal_header))) {
+			offset = sizeof(journal_header);
+			while (offset < size) {
+				struct journal_record *r = (void *)(buf + offset);
+
+				if (!valid_journal_record(r, size - offset))
+					break;
+				replay_journal_record(r);
+				offset += ALIGN(r->size);
+			}
+		}
+		munmap(buf, size);
+	}
+
+	if (offset != size) {
+		if (offset)
+			d_print("truncating %s at %u/%u\n", journal_filename, offset, size);
+		if (ftruncate(fd, offset)) {
+			close(fd);
+			return -1;
+		}
+	}
+	if (!offset) {
+		/* new, or written by an incompatible cmus */
+		if (write_all(fd, journal_header, sizeof(journal_header)) < 0) {
+			close(fd);
+			return -1;
+		}
+		offset = sizeof(journal_header);
+	}
+	journal_fd = fd;
+	journal_size = offset;
+	return 0;
+}
+
 int cache_init(void)
 {
 	unsigned int flags = 0;
+	int rc;
 
 #ifdef WORDS_BIGENDIAN
 	flags |= CACHE_BE;
@@ -274,9 +607,20 @@ int cache_init(void)
 
 	/* assumed version */
 	cache_header[3] = CACHE_VERSION;
+	memcpy(journal_header + 3, cache_header + 3, sizeof(journal_header) - 3);
+	memcpy(dirs_header + 3, cache_header + 3, sizeof(dirs_header) - 3);
 
 	cache_filename = xstrjoin(cmus_config_dir, "/cache");
-	return read_cache();
+	journal_filename = xstrjoin(cmus_config_dir, "/cache.journal");
+	dirs_filename = xstrjoin(cmus_config_dir, "/cache.dirs");
+	guard_mappings();
+	rc = read_cache();
+	read_dirs();
+	if (open_journal())
+		d_print("error: opening %s: %s\n", journal_filename, strerror(errno));
+	if (rc == -2 || journal_size > JOURNAL_COMPACT_MIN_SIZE)
+		compact_at_startup = 1;
+	return rc;
 }
 
 static int ti_filename_cmp(const void *a, const void *b)
@@ -289,22 +633,17 @@ static int ti_filename_cmp(const void *a, const void *b)
 
 static struct track_info **get_track_infos(bool reference)
 {
-	struct track_info **tis;
-	int i, c;
-
-	tis = xnew(struct track_info *, total);
-	c = 0;
-	for (i = 0; i < HASH_SIZE; i++) {
-		struct track_info *ti = hash_table[i];
-
-		while (ti) {
-			if (reference)
-				track_info_ref(ti);
-			tis[c++] = ti;
-			ti = ti->next;
-		}
+	struct track_info **tis, *ti;
+	unsigned int pos = 0;
+	int c = 0;
+
+	tis = xnew(struct track_info *, hash_table.count);
+	while ((ti = ti_hash_next(&hash_table, &pos))) {
+		if (reference)
+			track_info_ref(ti);
+		tis[c++] = ti;
 	}
-	qsort(tis, total, sizeof(struct track_info *), ti_filename_cmp);
+	qsort(tis, c, sizeof(struct track_info *), ti_filename_cmp);
 	return tis;
 }
 
@@ -316,11 +655,284 @@ static void flush_buffer(int fd, struct gbuf *buf)
 	}
 }
 
-static void write_ti(int fd, struct gbuf *buf, struct track_info *ti, unsigned int *offsetp)
+/* length of the directory part of @filename including the slash */
+static int dir_len(const char *filename)
+{
+	const char *slash = strrchr(filename, '/');
+
+	return slash ? slash - filename + 1 : 0;
+}
+
+static struct dir_node **dir_find(const char *path, uint32_t hash)
+{
+	struct dir_node **np;
+
+	if (!dir_buckets)
+		return NULL;
+	for (np = &dir_buckets[hash & dir_mask]; *np; np = &(*np)->next) {
+		if ((*np)->hash == hash && !strcmp((*np)->r->strings, path))
+			return np;
+	}
+	return NULL;
+}
+
+static void dir_free(struct dir_node *n)
+{
+	if (!n->mapped)
+		free(n->r);
+	free(n);
+}
+
+static void dir_remove(const char *path)
+{
+	struct dir_node **np = dir_find(path, hash_str(path));
+	struct dir_node *n;
+
+	if (!np)
+		return;
+	n = *np;
+	*np = n->next;
+	dir_free(n);
+	dir_count--;
+	dirs_dirty = 1;
+}
+
+static void dir_insert(struct dir_record *r, bool mapped)
+{
+	uint32_t hash = hash_str(r->strings);
+	struct dir_node **np = dir_find(r->strings, hash);
+	struct dir_node *n;
+
+	if (np) {
+		n = *np;
+		if (!n->mapped)
+			free(n->r);
+	} else {
+		if (dir_count >= dir_mask) {
+			unsigned int i, size = dir_buckets ? (dir_mask + 1) * 2 : 256;
+			struct dir_node **buckets = xnew0(struct dir_node *, size);
+
+			for (i = 0; dir_buckets && i <= dir_mask; i++) {
+				while (dir_buckets[i]) {
+					n = dir_buckets[i];
+					dir_buckets[i] = n->next;
+					n->next = buckets[n->hash & (size - 1)];
+					buckets[n->hash & (size - 1)] = n;
+				}
+			}
+			free(dir_buckets);
+			dir_buckets = buckets;
+			dir_mask = size - 1;
+		}
+		n = xnew(struct dir_node, 1);
+		n->hash = hash;
+		n->next = dir_buckets[hash & dir_mask];
+		dir_buckets[hash & dir_mask] = n;
+		dir_count++;
+	}
+	n->r = r;
+	n->mapped = mapped;
+}
+
+static int valid_dir_record(const struct dir_record *r, unsigned int avail)
+{
+	unsigned int min_size = sizeof(*r);
+	unsigned int i, str_size, count = 0;
+
+	if (avail < min_size || r->size < min_size + 1 || r->size > avail)
+		return 0;
+
+	str_size = r->size - min_size;
+	for (i = 0; i < str_size; i++) {
+		if (!r->strings[i])
+			count++;
+	}
+	return count == r->nr + 1 && !r->strings[str_size - 1];
+}
+
+static void read_dirs(void)
+{
+	unsigned int size, offset;
+	struct stat st = {};
+	char *buf;
+	int fd;
+
+	fd = open(dirs_filename, O_RDONLY);
+	if (fd < 0)
+		return;
+	fstat(fd, &st);
+	size = st.st_size;
+	if (size <= sizeof(dirs_header))
+		goto out;
+
+	buf = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (buf == MAP_FAILED)
+		goto out;
+	if (memcmp(buf, dirs_header, sizeof(dirs_header))) {
+		munmap(buf, size);
+		goto out;
+	}
+	mappings[MAP_DIRS].start = buf;
+	mappings[MAP_DIRS].size = size;
+
+	/* records point into buf, it is never unmapped */
+	offset = sizeof(dirs_header);
+	while (offset < size) {
+		struct dir_record *r = (void *)(buf + offset);
+
+		if (!valid_dir_record(r, size - offset)) {
+			/* rewritten without the rest */
+			dirs_dirty = 1;
+			break;
+		}
+		dir_insert(r, true);
+		offset += ALIGN(r->size);
+	}
+out:
+	close(fd);
+}
+
+static int dir_unchanged(const struct dir_record *r, const struct stat *st)
+{
+	return r->dev == st->st_dev && r->ino == st->st_ino &&
+		r->mtime == st->st_mtim.tv_sec && r->mtime_nsec == st->st_mtim.tv_nsec;
+}
+
+int cache_get_dir(const char *path, const struct stat *st, struct ptr_array *ents,
+		int *has_cue)
+{
+	struct dir_node **np = dir_find(path, hash_str(path));
+	const struct dir_record *r;
+	const char *s;
+	unsigned int i;
+
+	if (!np || !dir_unchanged((*np)->r, st))
+		return 0;
+
+	r = (*np)->r;
+	s = r->strings + strlen(r->strings) + 1;
+	for (i = 0; i < r->nr; i++) {
+		int size = strlen(s + 1) + 1;
+		struct dir_entry *ent = xmalloc(sizeof(struct dir_entry) + size);
+
+		switch (s[0]) {
+		case DIR_ENTRY_DIR:
+			ent->mode = S_IFDIR;
+			break;
+		case DIR_ENTRY_FILE:
+			ent->mode = S_IFREG;
+			break;
+		default:
+			ent->mode = 0;
+		}
+		memcpy(ent->name, s + 1, size);
+		ptr_array_add(ents, ent);
+		s += size + 1;
+	}
+	*has_cue = !!(r->flags & DIR_HAS_CUE);
+	return 1;
+}
+
+void cache_set_dir(const char *path, const struct stat *st, const struct ptr_array *ents,
+		int has_cue)
+{
+	struct dir_entry **e = ents->ptrs;
+	struct dir_record r = {
+		.size = sizeof(r),
+		.nr = ents->count,
+		.flags = has_cue ? DIR_HAS_CUE : 0,
+		.dev = st->st_dev,
+		.ino = st->st_ino,
+		.mtime = st->st_mtim.tv_sec,
+		.mtime_nsec = st->st_mtim.tv_nsec,
+	};
+	GBUF(buf);
+	int i;
+
+	/*
+	 * a change made right after the directory was read could leave the
+	 * mtime as it is on file systems with coarse timestamps
+	 */
+	if (st->st_mtime >= time(NULL) - 1) {
+		dir_remove(path);
+		return;
+	}
+
+	gbuf_add_bytes(&buf, &r, sizeof(r));
+	gbuf_add_bytes(&buf, path, strlen(path) + 1);
+	for (i = 0; i < ents->count; i++) {
+		char type = DIR_ENTRY_OTHER;
+
+		if (S_ISDIR(e[i]->mode))
+			type = DIR_ENTRY_DIR;
+		else if (S_ISREG(e[i]->mode))
+			type = DIR_ENTRY_FILE;
+		gbuf_add_ch(&buf, type);
+		gbuf_add_bytes(&buf, e[i]->name, strlen(e[i]->name) + 1);
+	}
+	((struct dir_record *)buf.buffer)->size = buf.len;
+	dir_insert((struct dir_record *)gbuf_steal(&buf), false);
+	dirs_dirty = 1;
+}
+
+/* forgets the listing of the directory containing @filename */
+static void remove_dir_of(const char *filename)
+{
+	int len = dir_len(filename);
+	char *dir;
+
+	if (len <= 1)
+		return;
+	dir = xstrndup(filename, len - 1);
+	dir_remove(dir);
+	free(dir);
+}
+
+/* writes the dir records through cache.dirs.tmp */
+static int write_dirs(void)
+{
+	GBUF(buf);
+	unsigned int i;
+	char *tmp;
+	int fd, rc;
+
+	tmp = xstrjoin(dirs_filename, ".tmp");
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0) {
+		free(tmp);
+		return -1;
+	}
+
+	gbuf_grow(&buf, 64 * 1024 - 1);
+	gbuf_add_bytes(&buf, dirs_header, sizeof(dirs_header));
+	for (i = 0; dir_buckets && i <= dir_mask; i++) {
+		struct dir_node *n;
+
+		for (n = dir_buckets[i]; n; n = n->next) {
+			gbuf_add_bytes(&buf, n->r, n->r->size);
+			gbuf_set(&buf, 0, ALIGN(n->r->size) - n->r->size);
+			if (buf.len >= 64 * 1024)
+				flush_buffer(fd, &buf);
+		}
+	}
+	flush_buffer(fd, &buf);
+	gbuf_free(&buf);
+
+	rc = fsync(fd);
+	close(fd);
+	if (!rc)
+		rc = rename(tmp, dirs_filename);
+	if (rc)
+		unlink(tmp);
+	else
+		dirs_dirty = 0;
+	free(tmp);
+	return rc;
+}
+
+static void add_cache_entry(struct gbuf *buf, struct track_info *ti)
 {
 	const struct keyval *kv = ti->comments;
-	unsigned int offset = *offsetp;
-	unsigned int pad;
 	struct cache_entry e;
 	int *len, alloc = 64, count, i;
 
@@ -351,13 +963,7 @@ static void write_ti(int fd, struct gbuf *buf, struct track_info *ti, unsigned i
 		e.size += len[count++];
 	}
 
-	pad = ALIGN(offset) - offset;
-	if (gbuf_avail(buf) < pad + e.size)
-		flush_buffer(fd, buf);
-
 	count = 0;
-	if (pad)
-		gbuf_set(buf, 0, pad);
 	gbuf_add_bytes(buf, &e, sizeof(e));
 	gbuf_add_bytes(buf, ti->filename, len[count++]);
 	gbuf_add_bytes(buf, ti->codec ? ti->codec : "", len[count++]);
@@ -368,13 +974,30 @@ static void write_ti(int fd, struct gbuf *buf, struct track_info *ti, unsigned i
 	}
 
 	free(len);
-	*offsetp = offset + pad + e.size;
 }
 
-int cache_close(void)
+static void write_ti(int fd, struct gbuf *buf, struct track_info *ti, unsigned int *offsetp)
+{
+	unsigned int offset = *offsetp;
+	unsigned int pad = ALIGN(offset) - offset;
+	size_t len = buf->len;
+
+	if (pad)
+		gbuf_set(buf, 0, pad);
+	add_cache_entry(buf, ti);
+	*offsetp = offset + buf->len - len;
+
+	if (gbuf_avail(buf) < CACHE_ENTRY_TOTAL_SIZE)
+		flush_buffer(fd, buf);
+}
+
+/*
+ * Writes @tis to the cache file through cache.tmp. Returns the size of
+ * the file or -1.
+ */
+static int write_cache(struct track_info **tis, int nr, int (*cancelling)(void))
 {
 	GBUF(buf);
-	struct track_info **tis;
 	unsigned int offset;
 	int i, fd, rc;
 	char *tmp;
@@ -386,23 +1009,149 @@ int cache_close(void)
 		return -1;
 	}
 
-	tis = get_track_infos(false);
-
 	gbuf_grow(&buf, 64 * 1024 - 1);
 	gbuf_add_bytes(&buf, cache_header, sizeof(cache_header));
 	offset = sizeof(cache_header);
-	for (i = 0; i < total; i++)
+	for (i = 0; i < nr; i++) {
+		if (cancelling && cancelling())
+			break;
 		write_ti(fd, &buf, tis[i], &offset);
+	}
 	flush_buffer(fd, &buf);
 	gbuf_free(&buf);
-	free(tis);
 
+	/* the journal is truncated after the rename */
+	rc = fsync(fd);
 	close(fd);
+	if (i < nr || rc) {
+		unlink(tmp);
+		free(tmp);
+		return -1;
+	}
 	rc = rename(tmp, cache_filename);
 	free(tmp);
+	return rc ? -1 : offset;
+}
+
+/*
+ * Replaces the journal with the records appended after @start, those
+ * before are in the cache file now.
+ */
+static int truncate_journal(unsigned int start)
+{
+	unsigned int tail = journal_size - start;
+	char *tmp, *buf;
+	int fd, rc = -1;
+
+	tmp = xstrjoin(cmus_config_dir, "/cache.journal.tmp");
+	fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0666);
+	if (fd < 0) {
+		free(tmp);
+		return -1;
+	}
+
+	buf = xnew(char, tail + 1);
+	if (pread(journal_fd, buf, tail, start) != (ssize_t)tail)
+		goto out;
+	if (write_all(fd, journal_header, sizeof(journal_header)) < 0 ||
+			write_all(fd, buf, tail) < 0 || fsync(fd))
+		goto out;
+	if (rename(tmp, journal_filename))
+		goto out;
+
+	close(journal_fd);
+	journal_fd = fd;
+	journal_size = sizeof(journal_header) + tail;
+	rc = 0;
+out:
+	if (rc) {
+		close(fd);
+		unlink(tmp);
+	}
+	free(buf);
+	free(tmp);
 	return rc;
 }
 
+void cache_schedule_startup_compact(void)
+{
+	if (compact_at_startup) {
+		compact_at_startup = 0;
+		schedule_compact();
+	}
+}
+
+void cache_compact(int (*cancelling)(void))
+{
+	struct track_info **tis;
+	unsigned int start;
+	int i, nr, size;
+
+	cache_lock();
+	if (!cache_writable()) {
+		compact_scheduled = 0;
+		cache_unlock();
+		return;
+	}
+	tis = get_track_infos(true);
+	nr = hash_table.count;
+	start = journal_size;
+	cache_unlock();
+
+	size = write_cache(tis, nr, cancelling);
+	for (i = 0; i < nr; i++)
+		track_info_unref(tis[i]);
+	free(tis);
+
+	cache_lock();
+	if (size >= 0) {
+		cache_size = size;
+		if (journal_fd >= 0 && truncate_journal(start))
+			d_print("error: truncating %s: %s\n", journal_filename, strerror(errno));
+	}
+	if (dirs_dirty && write_dirs())
+		d_print("error: writing %s: %s\n", dirs_filename, strerror(errno));
+	compact_scheduled = 0;
+	cache_unlock();
+}
+
+int cache_close(void)
+{
+	struct track_info **tis;
+	int rc;
+
+	if (!cache_writable())
+		return -1;
+	if (dirs_dirty && write_dirs())
+		d_print("error: writing %s: %s\n", dirs_filename, strerror(errno));
+
+	if (journal_fd >= 0) {
+		/* everything is in the cache file or in the journal */
+		rc = close(journal_fd);
+		journal_fd = -1;
+		return rc;
+	}
+
+	tis = get_track_infos(false);
+	rc = write_cache(tis, hash_table.count, NULL);
+	free(tis);
+	if (rc < 0)
+		return -1;
+	/* records in the journal, if any, are all in the cache now */
+	unlink(journal_filename);
+	return 0;
+}
+
+void cache_played(struct track_info *ti)
+{
+	struct track_info *cur = lookup_cache_entry(ti->filename, hash_str(ti->filename));
+
+	if (!cur)
+		return;
+	cur->play_count = ti->play_count;
+	journal_play_count(cur);
+}
+
 static struct track_info *ip_get_ti(const char *filename)
 {
 	struct track_info *ti = NULL;
@@ -411,7 +1160,7 @@ static struct track_info *ip_get_ti(const char *filename)
 	int rc;
 
 	ip = ip_new(filename);
-	rc = ip_open(ip);
+	rc = ip_probe(ip);
 	if (rc) {
 		ip_delete(ip);
 		return NULL;
@@ -431,33 +1180,55 @@ static struct track_info *ip_get_ti(const char *filename)
 	return ti;
 }
 
-struct track_info *cache_get_ti(const char *filename, int force)
+/*
+ * Returns a usable cache entry or NULL. Stale entries are removed and
+ * *reload is set.
+ */
+static struct track_info *cache_lookup_ti(const char *filename,
+		unsigned int hash, int force, int *reload)
 {
-	unsigned int hash = hash_str(filename);
 	struct track_info *ti;
-	int reload = 0;
 
+	*reload = 0;
 	ti = lookup_cache_entry(filename, hash);
 	if (ti) {
 		if ((!skip_track_info && ti->duration == 0 && !is_http_url(filename)) || force){
 			do_cache_remove_ti(ti, hash);
 			ti = NULL;
-			reload = 1;
+			*reload = 1;
 		}
 	}
-	if (!ti) {
-		if (skip_track_info && !reload && !force) {
-			struct growing_keyvals c = {NULL, 0, 0};
+	return ti;
+}
 
-			ti = track_info_new(filename);
+static struct track_info *cache_new_ti(const char *filename, int probe)
+{
+	struct track_info *ti;
 
-			keyvals_terminate(&c);
-			track_info_set_comments(ti, c.keyvals);
+	if (!probe) {
+		struct growing_keyvals c = {NULL, 0, 0};
 
-			ti->duration = 0;
-		} else {
-		       	ti = ip_get_ti(filename);
-		}
+		ti = track_info_new(filename);
+
+		keyvals_terminate(&c);
+		track_info_set_comments(ti, c.keyvals);
+
+		ti->duration = 0;
+	} else {
+		ti = ip_get_ti(filename);
+	}
+	return ti;
+}
+
+struct track_info *cache_get_ti(const char *filename, int force)
+{
+	unsigned int hash = hash_str(filename);
+	struct track_info *ti;
+	int reload;
+
+	ti = cache_lookup_ti(filename, hash, force, &reload);
+	if (!ti) {
+		ti = cache_new_ti(filename, !skip_track_info || reload || force);
 		if (!ti)
 			return NULL;
 		add_ti(ti, hash);
@@ -466,18 +1237,245 @@ struct track_info *cache_get_ti(const char *filename, int force)
 	return ti;
 }
 
+/* bytes of a file the input plugins need to read its tags, usually */
+#define PREFETCH_SIZE (128 * 1024)
+
+static void prefetch_file(const char *filename)
+{
+#ifdef POSIX_FADV_WILLNEED
+	int fd;
+
+	if (is_url(filename))
+		return;
+	fd = open(filename, O_RDONLY | O_NONBLOCK);
+	if (fd == -1)
+		return;
+	posix_fadvise(fd, 0, PREFETCH_SIZE, POSIX_FADV_WILLNEED);
+	close(fd);
+#endif
+}
+
+struct get_tis_data {
+	struct cache_req *reqs;
+	int *pending;
+	int nr_pending;
+	/* files are probed in order, by this many threads */
+	int ahead;
+	int (*cancelling)(void);
+};
+
+static void get_tis_probe(int i, void *opaque)
+{
+	struct get_tis_data *d = opaque;
+	struct cache_req *req = &d->reqs[d->pending[i]];
+
+	if (d->cancelling && d->cancelling())
+		return;
+
+	/*
+	 * start reading the header of the file another pool thread probes
+	 * after this one, so the pool does not wait for the disk one file
+	 * at a time.  the extra open() is done here rather than while walking
+	 * the directories so it does not slow down the walk on network file
+	 * systems
+	 */
+	if (req->probe && i + d->ahead < d->nr_pending) {
+		struct cache_req *next = &d->reqs[d->pending[i + d->ahead]];
+
+		if (next->probe)
+			prefetch_file(next->filename);
+	}
+
+	req->ti = cache_new_ti(req->filename, req->probe);
+}
+
+void cache_get_tis(struct cache_req *reqs, int nr, int (*cancelling)(void))
+{
+	struct get_tis_data d = { reqs, xnew(int, nr), 0, pool_nr_threads(), cancelling };
+	int i, nr_pending = 0;
+
+	cache_lock();
+	for (i = 0; i < nr; i++) {
+		struct cache_req *req = &reqs[i];
+		int reload;
+
+		req->hash = hash_str(req->filename);
+		req->ti = cache_lookup_ti(req->filename, req->hash, req->force,
+				&reload);
+		if (req->ti) {
+			track_info_ref(req->ti);
+			continue;
+		}
+		req->probe = !skip_track_info || reload || req->force;
+		d.pending[nr_pending++] = i;
+	}
+	cache_unlock();
+
+	d.nr_pending = nr_pending;
+	pool_run(nr_pending, get_tis_probe, &d);
+
+	cache_lock();
+	for (i = 0; i < nr_pending; i++) {
+		struct cache_req *req = &reqs[d.pending[i]];
+		struct track_info *ti;
+
+		if (!req->ti)
+			continue;
+
+		/* added by someone else while we were probing */
+		ti = lookup_cache_entry(req->filename, req->hash);
+		if (ti) {
+			track_info_unref(req->ti);
+			req->ti = ti;
+		} else {
+			add_ti(req->ti, req->hash);
+		}
+		track_info_ref(req->ti);
+	}
+	cache_unlock();
+
+	free(d.pending);
+}
+
+enum refresh_state {
+	REFRESH_UNCHANGED,
+	REFRESH_CHANGED,
+	REFRESH_DELETED,
+};
+
+struct refresh_data {
+	struct track_info **tis;
+	struct track_info **new_tis;
+	enum refresh_state *state;
+	/* the batch split into runs of files in the same directory */
+	int *runs;
+	/* the directory of the run does not exist */
+	bool *gone;
+	int force;
+};
+
+static int split_runs(struct track_info **tis, int nr, int *runs)
+{
+	int i, n = 0, len = dir_len(tis[0]->filename);
+
+	runs[n++] = 0;
+	for (i = 1; i < nr; i++) {
+		const char *a = tis[i - 1]->filename;
+		const char *b = tis[i]->filename;
+		int blen = dir_len(b);
+
+		if (blen != len || memcmp(a, b, len))
+			runs[n++] = i;
+		len = blen;
+	}
+	runs[n] = nr;
+	return n;
+}
+
+/*
+ * runs without the cache lock, only touches immutable fields of tis[i].
+ * @name is the file name relative to @dir_fd, if it is not -1
+ */
+static void refresh_probe(struct refresh_data *d, int i, int dir_fd, const char *name)
+{
+	struct track_info *ti = d->tis[i];
+	struct stat st;
+
+	d->new_tis[i] = NULL;
+	if (!is_url(ti->filename)) {
+		int rc;
+
+		if (dir_fd >= 0)
+			rc = fstatat(dir_fd, name, &st, 0);
+		else
+			rc = stat(ti->filename, &st);
+		if (rc) {
+			d->state[i] = REFRESH_DELETED;
+			return;
+		}
+		if (!d->force && ti->mtime == st.st_mtime) {
+			d->state[i] = REFRESH_UNCHANGED;
+			return;
+		}
+	}
+	d->state[i] = REFRESH_CHANGED;
+
+	// cache-only entries are cleared, no need to read them
+	if (d->force && track_info_unique_ref(ti))
+		return;
+
+	d->new_tis[i] = ip_get_ti(ti->filename);
+	if (!d->new_tis[i])
+		d->state[i] = REFRESH_DELETED;
+}
+
+/* looks up the directory once for all files of run @r */
+static void refresh_probe_run(int r, void *opaque)
+{
+	struct refresh_data *d = opaque;
+	const char *first = d->tis[d->runs[r]]->filename;
+	int i, fd = -1, len = dir_len(first);
+
+	d->gone[r] = false;
+	if (len && !is_url(first)) {
+		char *dir = xstrndup(first, len);
+
+		fd = open(dir, O_RDONLY | O_DIRECTORY);
+		if (fd < 0 && errno == ENOENT)
+			d->gone[r] = true;
+		free(dir);
+	}
+
+	for (i = d->runs[r]; i < d->runs[r + 1]; i++) {
+		if (d->gone[r]) {
+			d->new_tis[i] = NULL;
+			d->state[i] = REFRESH_DELETED;
+			continue;
+		}
+		refresh_probe(d, i, fd, d->tis[i]->filename + len);
+	}
+	if (fd >= 0)
+		close(fd);
+}
+
+/* tracks refreshed in parallel between two cache_lock() yields */
+#define REFRESH_BATCH_PER_THREAD 64
+
 struct track_info **cache_refresh(int *count, int force)
 {
 	struct track_info **tis = get_track_infos(true);
-	int i, n = total;
+	int i, n = hash_table.count;
+	int batch = REFRESH_BATCH_PER_THREAD * pool_nr_threads();
+	struct refresh_data d = {
+		.tis = tis,
+		.new_tis = xnew(struct track_info *, batch),
+		.state = xnew(enum refresh_state, batch),
+		.runs = xnew(int, batch + 1),
+		.gone = xnew(bool, batch),
+		.force = force,
+	};
 
 	for (i = 0; i < n; i++) {
 		unsigned int hash;
 		struct track_info *ti = tis[i];
-		struct stat st;
-		int rc = 0;
-
-		cache_yield();
+		struct track_info *new_ti;
+		int j = i % batch;
+
+		if (j == 0) {
+			int r, nr_runs;
+
+			/* stat and read tags of the next batch, unlocked */
+			d.tis = tis + i;
+			nr_runs = split_runs(d.tis, min_i(batch, n - i), d.runs);
+			cache_unlock();
+			pool_run(nr_runs, refresh_probe_run, &d);
+			cache_lock();
+
+			for (r = 0; r < nr_runs; r++) {
+				if (d.gone[r])
+					remove_dir_of(d.tis[d.runs[r]]->filename);
+			}
+		}
 
 		/*
 		 * If no-one else has reference to tis[i] then it is set to NULL
@@ -488,33 +1486,39 @@ struct track_info **cache_refresh(int *count, int force)
 		 * changed:   tis[i]->next = new
 		 */
 
-		if (!is_url(ti->filename)) {
-			rc = stat(ti->filename, &st);
-			if (!rc && !force && ti->mtime == st.st_mtime) {
-				// unchanged
-				track_info_unref(ti);
-				tis[i] = NULL;
-				continue;
-			}
+		if (d.state[j] == REFRESH_UNCHANGED) {
+			track_info_unref(ti);
+			tis[i] = NULL;
+			continue;
 		}
 
 		hash = hash_str(ti->filename);
 		do_cache_remove_ti(ti, hash);
 
-		if (!rc) {
-			// changed
-			struct track_info *new_ti;
-
+		if (d.state[j] == REFRESH_CHANGED) {
 			// clear cache-only entries
 			if (force && track_info_unique_ref(ti)) {
+				if (d.new_tis[j])
+					track_info_unref(d.new_tis[j]);
 				track_info_unref(ti);
 				tis[i] = NULL;
 				continue;
 			}
 
-			new_ti = ip_get_ti(ti->filename);
+			new_ti = d.new_tis[j];
+			if (!new_ti)
+				new_ti = ip_get_ti(ti->filename);
 			if (new_ti) {
-				add_ti(new_ti, hash);
+				struct track_info *cur;
+
+				/* replaced by someone else while we were unlocked */
+				cur = lookup_cache_entry(ti->filename, hash);
+				if (cur) {
+					track_info_unref(new_ti);
+					new_ti = cur;
+				} else {
+					add_ti(new_ti, hash);
+				}
 
 				if (track_info_unique_ref(ti)) {
 					track_info_unref(ti);
@@ -536,6 +1540,10 @@ struct track_info **cache_refresh(int *count, int force)
 			ti->next = NULL;
 		}
 	}
+	free(d.new_tis);
+	free(d.state);
+	free(d.runs);
+	free(d.gone);
 	*count = n;
 	return tis;
 }
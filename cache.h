@@ -21,6 +21,9 @@
 
 #include "track_info.h"
 #include "locking.h"
+#include "load_dir.h"
+
+#include <sys/stat.h>
 
 extern struct fifo_mutex cache_mutex;
 
@@ -28,11 +31,64 @@ extern struct fifo_mutex cache_mutex;
 #define cache_yield() fifo_mutex_yield(&cache_mutex)
 #define cache_unlock() fifo_mutex_unlock(&cache_mutex)
 
+/*
+ * The cache is read from the cache file and the journal of changes made
+ * since the file was written.  Changes are appended to the journal as they
+ * happen, cache_compact() folds them into the cache file.
+ */
 int cache_init(void);
 int cache_close(void);
+
+/*
+ * Rewrites the cache file and truncates the journal. Must be called
+ * without holding the cache lock, stops early once cancelling() returns
+ * true.
+ */
+void cache_compact(int (*cancelling)(void));
+
+/*
+ * Schedules the compaction cache_init() found necessary.  Called after the
+ * jobs that load the library at startup have been scheduled, so that the
+ * library appears before the cache is rewritten.
+ */
+void cache_schedule_startup_compact(void);
+
+struct cache_req {
+	const char *filename;
+	int force;
+
+	/* result, referenced. NULL if the file could not be read */
+	struct track_info *ti;
+
+	/* private */
+	unsigned int hash;
+	int probe;
+};
+
 struct track_info *cache_get_ti(const char *filename, int force);
+
+/*
+ * Like cache_get_ti() for many files. Files not in the cache are read in
+ * parallel on the scan pool. Must be called without holding the cache lock.
+ * Files are skipped once cancelling() returns true.
+ */
+void cache_get_tis(struct cache_req *reqs, int nr, int (*cancelling)(void));
 void cache_remove_ti(struct track_info *ti);
+/* records the play_count of @ti */
+void cache_played(struct track_info *ti);
 struct track_info **cache_refresh(int *count, int force);
 struct track_info *lookup_cache_entry(const char *filename, unsigned int hash);
 
+/*
+ * The entries (struct dir_entry) of directory @path as recorded by
+ * cache_set_dir(), if @st shows the directory has not changed since.
+ * Returns 0 if nothing usable is recorded.  Must be called with the
+ * cache lock held, as cache_set_dir().
+ */
+int cache_get_dir(const char *path, const struct stat *st, struct ptr_array *ents,
+		int *has_cue);
+/* @st must be taken before the directory was read */
+void cache_set_dir(const char *path, const struct stat *st, const struct ptr_array *ents,
+		int has_cue);
+
 #endif
@@ -17,6 +17,7 @@
  */
 
 #include "cmus.h"
+#include "server.h"
 #include "job.h"
 #include "lib.h"
 #include "pl.h"
@@ -61,6 +62,8 @@ static pthread_mutex_t cmus_next_file_mutex = CMUS_MUTEX_INITIALIZER;
 static pthread_cond_t cmus_next_file_cond = CMUS_COND_INITIALIZER;
 static int cmus_next_file_provided;
 static struct track_info *cmus_next_file;
+/* set by the requesting thread, only peek at the next track */
+static int cmus_next_file_peek;
 
 static int x11_init_done = 0;
 static void *(*x11_open)(void *) = NULL;
@@ -177,61 +180,87 @@ void cmus_add(add_ti_cb add, const char *name, enum file_type ft, int jt, int fo
 	job_schedule_add(jt, data);
 }
 
+struct save_data {
+	struct gbuf *buf;
+	/* -1 when saving to a remote client */
+	int fd;
+};
+
+#define SAVE_FLUSH_SIZE (64 * 1024)
+
+static int save_flush(struct save_data *d, size_t min)
+{
+	int rc;
+
+	if (d->fd == -1) {
+		/* stop, the client is dropped */
+		if (server_output_full(d->buf)) {
+			errno = EMSGSIZE;
+			return -1;
+		}
+		return 0;
+	}
+	if (d->buf->len < min)
+		return 0;
+	rc = write_all(d->fd, d->buf->buffer, d->buf->len);
+	gbuf_clear(d->buf);
+	return rc == -1 ? -1 : 0;
+}
+
 static int save_ext_playlist_cb(void *data, struct track_info *ti)
 {
-	GBUF(buf);
-	int fd = *(int *)data;
-	int i, rc;
+	struct save_data *d = data;
+	struct gbuf *buf = d->buf;
+	int i;
 
-	gbuf_addf(&buf, "file %s\n", escape(ti->filename));
-	gbuf_addf(&buf, "duration %d\n", ti->duration);
-	gbuf_addf(&buf, "codec %s\n", ti->codec);
-	gbuf_addf(&buf, "bitrate %ld\n", ti->bitrate);
+	gbuf_addf(buf, "file %s\n", escape(ti->filename));
+	gbuf_addf(buf, "duration %d\n", ti->duration);
+	gbuf_addf(buf, "codec %s\n", ti->codec);
+	gbuf_addf(buf, "bitrate %ld\n", ti->bitrate);
 	for (i = 0; ti->comments[i].key; i++)
-		gbuf_addf(&buf, "tag %s %s\n",
+		gbuf_addf(buf, "tag %s %s\n",
 				ti->comments[i].key,
 				escape(ti->comments[i].val));
 
-	rc = write_all(fd, buf.buffer, buf.len);
-	gbuf_free(&buf);
-
-	if (rc == -1)
-		return -1;
-	return 0;
+	return save_flush(d, SAVE_FLUSH_SIZE);
 }
 
 static int save_playlist_cb(void *data, struct track_info *ti)
 {
-	int fd = *(int *)data;
-	const char nl = '\n';
-	int rc;
+	struct save_data *d = data;
 
-	rc = write_all(fd, ti->filename, strlen(ti->filename));
-	if (rc == -1)
-		return -1;
-	rc = write_all(fd, &nl, 1);
-	if (rc == -1)
-		return -1;
-	return 0;
+	gbuf_add_str(d->buf, ti->filename);
+	gbuf_add_ch(d->buf, '\n');
+	return save_flush(d, SAVE_FLUSH_SIZE);
 }
 
 static int do_cmus_save(for_each_ti_cb for_each_ti, const char *filename,
 		save_tracks_cb save_tracks, void *opaque)
 {
-	int fd, rc;
+	struct save_data d;
+	GBUF(buf);
+	int rc;
 
 	if (strcmp(filename, "-") == 0) {
-		if (get_client_fd() == -1) {
+		/* answer is sent when the client is writable */
+		d.buf = get_client_output();
+		if (!d.buf) {
 			error_msg("saving to stdout works only remotely");
 			return 0;
 		}
-		fd = dup(get_client_fd());
-	} else
-		fd = open(filename, O_CREAT | O_WRONLY | O_TRUNC, 0666);
-	if (fd == -1)
+		d.fd = -1;
+		return for_each_ti(save_tracks, &d, opaque);
+	}
+
+	d.buf = &buf;
+	d.fd = open(filename, O_CREAT | O_WRONLY | O_TRUNC, 0666);
+	if (d.fd == -1)
 		return -1;
-	rc = for_each_ti(save_tracks, &fd, opaque);
-	close(fd);
+	rc = for_each_ti(save_tracks, &d, opaque);
+	if (rc == 0)
+		rc = save_flush(&d, 0);
+	close(d.fd);
+	gbuf_free(&buf);
 	return rc;
 }
 
@@ -408,13 +437,25 @@ static struct track_info *cmus_get_next_from_main_thread(void)
 	return ti;
 }
 
-static struct track_info *cmus_get_next_from_other_thread(void)
+static struct track_info *cmus_peek_next_from_main_thread(void)
+{
+	struct track_info *ti = play_queue_peek();
+
+	if (!ti && (!play_queue_active || !stop_after_queue))
+		ti = play_library ? lib_peek_next() : pl_peek_next();
+	return ti;
+}
+
+static struct track_info *cmus_get_next_from_other_thread(int peek)
 {
 	static pthread_mutex_t mutex = CMUS_MUTEX_INITIALIZER;
 	cmus_mutex_lock(&mutex);
 
 	/* only one thread may request a track at a time */
 
+	cmus_next_file_lock();
+	cmus_next_file_peek = peek;
+	cmus_next_file_unlock();
 	notify_via_pipe(cmus_next_track_request_fd_priv);
 
 	cmus_next_file_lock();
@@ -434,7 +475,15 @@ struct track_info *cmus_get_next_track(void)
 	pthread_t this_thread = pthread_self();
 	if (pthread_equal(this_thread, main_thread))
 		return cmus_get_next_from_main_thread();
-	return cmus_get_next_from_other_thread();
+	return cmus_get_next_from_other_thread(0);
+}
+
+struct track_info *cmus_peek_next_track(void)
+{
+	pthread_t this_thread = pthread_self();
+	if (pthread_equal(this_thread, main_thread))
+		return cmus_peek_next_from_main_thread();
+	return cmus_get_next_from_other_thread(1);
 }
 
 void cmus_provide_next_track(void)
@@ -442,7 +491,10 @@ void cmus_provide_next_track(void)
 	clear_pipe(cmus_next_track_request_fd, 1);
 
 	cmus_next_file_lock();
-	cmus_next_file = cmus_get_next_from_main_thread();
+	if (cmus_next_file_peek)
+		cmus_next_file = cmus_peek_next_from_main_thread();
+	else
+		cmus_next_file = cmus_get_next_from_main_thread();
 	cmus_next_file_provided = 1;
 	cmus_next_file_unlock();
 
@@ -87,6 +87,11 @@ void cmus_prev(void);
 
 extern int cmus_next_track_request_fd;
 struct track_info *cmus_get_next_track(void);
+/*
+ * track cmus_get_next_track() would return, without taking it from the queue
+ * or moving the library/playlist cursor.  NULL if it can't be known yet
+ */
+struct track_info *cmus_peek_next_track(void);
 void cmus_provide_next_track(void);
 void cmus_track_request_init(void);
 
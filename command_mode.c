@@ -47,7 +47,9 @@
 #include "help.h"
 #include "op.h"
 #include "mpris.h"
+#include "server.h"
 #include "job.h"
+#include "watch.h"
 
 #include <stdlib.h>
 #include <ctype.h>
@@ -73,6 +75,7 @@ void view_clear(int view)
 
 		/* FIXME: make this optional? */
 		lib_clear_store();
+		watch_clear_roots();
 		break;
 	case PLAYLIST_VIEW:
 		pl_clear();
@@ -103,6 +106,8 @@ void view_add(int view, char *arg, int prepend)
 	switch (view) {
 	case TREE_VIEW:
 	case SORTED_VIEW:
+		if (ft == FILE_TYPE_DIR)
+			watch_add_root(name);
 		cmus_add(lib_add_track, name, ft, JOB_TYPE_LIB, 0, NULL);
 		break;
 	case PLAYLIST_VIEW:
@@ -466,6 +471,7 @@ static void cmd_toggle(char *arg)
 		return;
 	}
 	opt->toggle(opt->data);
+	server_option_changed(opt->name);
 	help_win->changed = 1;
 	if (cur_view == TREE_VIEW) {
 		lib_track_win->changed = 1;
@@ -743,7 +749,7 @@ static void cmd_quit(char *arg)
 {
 	int flag = parse_flags((const char **)&arg, "i");
 	enum ui_query_answer answer;
-	if (!worker_has_job_by_type(JOB_TYPE_ANY)) {
+	if (!worker_has_job_by_type(JOB_TYPE_LIB | JOB_TYPE_PL | JOB_TYPE_QUEUE)) {
 		if (flag != 'i' || yes_no_query("Quit cmus? [y/N]") != UI_QUERY_ANSWER_NO)
 			cmus_running = 0;
 	} else {
@@ -1217,6 +1223,7 @@ static void cmd_mute(char *arg)
 		free(msg);
 	} else {
 		mpris_volume_changed();
+		server_volume_changed();
 	}
 	update_statusline();
 }
@@ -1253,6 +1260,7 @@ static void cmd_vol(char *arg)
 		free(msg);
 	} else {
 		mpris_volume_changed();
+		server_volume_changed();
 	}
 	update_statusline();
 	return;
@@ -1495,6 +1503,8 @@ static void add_from_browser(add_ti_cb add, int job_type, int advance)
 
 		ft = cmus_detect_ft(sel, &ret);
 		if (ft != FILE_TYPE_INVALID) {
+			if (ft == FILE_TYPE_DIR && add == lib_add_track)
+				watch_add_root(ret);
 			cmus_add(add, ret, ft, job_type, 0, NULL);
 			if (advance)
 				window_down(browser_win, 1);
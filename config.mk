@@ -0,0 +1,57 @@
+SOFLAGS = -fPIC
+LDSOFLAGS = -shared
+LDDLFLAGS = -shared
+CC = gcc
+LD = gcc
+CFLAGS = -g -O2 -Wall  -DHAVE_CONFIG  -std=gnu11 -pipe -Wall -Wshadow -Wcast-align -Wpointer-arith -Wwrite-strings -Wundef -Wmissing-prototypes -Wredundant-decls -Wextra -Wno-sign-compare -Wformat-security -Wold-style-definition -Wno-pointer-sign -Werror-implicit-function-declaration -Wno-unused-parameter -Wno-missing-field-initializers -MMD -MP -MF .dep-$(subst /,-,$@) -DREALTIME_SCHEDULING
+LDFLAGS =  
+HOSTCC = gcc
+HOSTLD = gcc
+HOST_CFLAGS = -g -O2 -Wall
+HOST_LDFLAGS = 
+COMPAT_LIBS = 
+DL_CFLAGS = 
+DL_LIBS = -ldl -Wl,--export-dynamic
+PTHREAD_CFLAGS = -D_REENTRANT
+PTHREAD_LIBS = -lpthread
+PKG_CONFIG = /usr/bin/pkg-config
+NCURSES_CFLAGS = -D_DEFAULT_SOURCE -D_XOPEN_SOURCE=600  
+NCURSES_LIBS = -lncursesw -ltinfo 
+ICONV_CFLAGS = 
+ICONV_LIBS = 
+bindir = /usr/local/bin
+datadir = /usr/local/share
+libdir = /usr/local/lib
+mandir = /usr/local/share/man
+exampledir = /usr/local/share/doc/cmus/examples
+CONFIG_AAC = n
+CONFIG_ALSA = n
+CONFIG_AO = n
+CONFIG_ARTS = n
+CONFIG_CDIO = n
+CONFIG_COREAUDIO = n
+CONFIG_CUE = y
+CONFIG_FFMPEG = n
+CONFIG_FLAC = n
+CONFIG_JACK = n
+CONFIG_MAD = n
+CONFIG_MIKMOD = n
+CONFIG_MODPLUG = n
+CONFIG_MP4 = n
+CONFIG_MPC = n
+CONFIG_MPRIS = n
+CONFIG_OPUS = n
+CONFIG_OSS = n
+CONFIG_PULSE = n
+CONFIG_ROAR = n
+CONFIG_SAMPLERATE = n
+CONFIG_SNDIO = n
+CONFIG_SUN = n
+CONFIG_VORBIS = n
+CONFIG_VTX = n
+CONFIG_WAV = y
+CONFIG_WAVEOUT = n
+CONFIG_WAVPACK = n
+CONFIG_BASS = n
+GINSTALL = install
+topdir = /root/repo
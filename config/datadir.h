@@ -0,0 +1,6 @@
+#ifndef CONFIG_DATADIR_H
+#define CONFIG_DATADIR_H
+
+#define DATADIR "/usr/local/share"
+
+#endif
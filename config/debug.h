@@ -0,0 +1,6 @@
+#ifndef CONFIG_DEBUG_H
+#define CONFIG_DEBUG_H
+
+#define DEBUG 1
+
+#endif
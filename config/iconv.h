@@ -0,0 +1,6 @@
+#ifndef CONFIG_ICONV_H
+#define CONFIG_ICONV_H
+
+#define HAVE_ICONV 1
+
+#endif
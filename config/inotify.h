@@ -0,0 +1,6 @@
+#ifndef CONFIG_INOTIFY_H
+#define CONFIG_INOTIFY_H
+
+#define HAVE_SYS_INOTIFY_H 1
+
+#endif
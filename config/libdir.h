@@ -0,0 +1,6 @@
+#ifndef CONFIG_LIBDIR_H
+#define CONFIG_LIBDIR_H
+
+#define LIBDIR "/usr/local/lib"
+
+#endif
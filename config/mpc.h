@@ -0,0 +1,6 @@
+#ifndef CONFIG_MPC_H
+#define CONFIG_MPC_H
+
+#define MPC_SV8 0
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef CONFIG_MPRIS_H
+#define CONFIG_MPRIS_H
+
+/* #define CONFIG_MPRIS */
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef CONFIG_UTILS_H
+#define CONFIG_UTILS_H
+
+#define HAVE_BYTESWAP_H 1
+
+#endif
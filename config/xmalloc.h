@@ -0,0 +1,7 @@
+#ifndef CONFIG_XMALLOC_H
+#define CONFIG_XMALLOC_H
+
+#define HAVE_STRDUP 1
+#define HAVE_STRNDUP 1
+
+#endif
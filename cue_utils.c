@@ -21,8 +21,41 @@
 #include "cue_utils.h"
 #include "xmalloc.h"
 #include "cue.h"
+#include "input.h"
+#include "locking.h"
+#include "list.h"
+#include "debug.h"
 
 #include <stdio.h>
+#include <sys/stat.h>
+
+/*
+ * unused sheets kept until the next cue_cache_clear(), enough for the cue
+ * files of a scan batch
+ */
+#define CUE_CACHE_MAX 256
+
+struct cue_cache_entry {
+	struct list_head node;
+	char *filename;
+	time_t mtime;
+	off_t size;
+	struct cue_sheet *cd;
+	int ref;
+	/* the file changed or the cache was cleared, freed on last put */
+	unsigned int stale : 1;
+
+	/* protects the child fields, held while probing */
+	pthread_mutex_t child_mutex;
+	/* 1 if not probed yet, otherwise the result of ip_probe() */
+	int child_rc;
+	time_t child_mtime;
+	struct cue_child_info child;
+};
+
+static LIST_HEAD(cue_cache);
+static unsigned int cue_cache_count;
+static pthread_mutex_t cue_cache_mutex = CMUS_MUTEX_INITIALIZER;
 
 char *associated_cue(const char *filename)
 {
@@ -52,11 +85,11 @@ char *associated_cue(const char *filename)
 
 int cue_get_ntracks(const char *filename)
 {
-	struct cue_sheet *cd = cue_from_file(filename);
+	struct cue_sheet *cd = cue_cache_get(filename);
 	if (!cd)
 		return -1;
 	size_t n = cd->num_tracks;
-	cue_free(cd);
+	cue_cache_put(cd);
 	return n;
 }
 
@@ -69,3 +102,162 @@ char *construct_cue_url(const char *cue_filename, int track_n)
 
 	return xstrdup(buf);
 }
+
+static void cue_cache_free(struct cue_cache_entry *e)
+{
+	list_del(&e->node);
+	cue_cache_count--;
+	free(e->filename);
+	cue_free(e->cd);
+	pthread_mutex_destroy(&e->child_mutex);
+	free(e->child.codec);
+	free(e->child.codec_profile);
+	free(e);
+}
+
+static struct cue_cache_entry *cue_cache_find(const struct cue_sheet *cd)
+{
+	struct cue_cache_entry *e;
+
+	list_for_each_entry(e, &cue_cache, node) {
+		if (e->cd == cd)
+			return e;
+	}
+	BUG("cue sheet not in cache\n");
+	return NULL;
+}
+
+/* oldest entries are at the head of the list */
+static void cue_cache_shrink(void)
+{
+	struct cue_cache_entry *e, *tmp;
+
+	list_for_each_entry_safe(e, tmp, &cue_cache, node) {
+		if (cue_cache_count <= CUE_CACHE_MAX)
+			break;
+		if (!e->ref)
+			cue_cache_free(e);
+	}
+}
+
+struct cue_sheet *cue_cache_get(const char *filename)
+{
+	struct cue_cache_entry *e, *tmp;
+	struct cue_sheet *cd;
+	struct stat st;
+
+	if (stat(filename, &st))
+		return NULL;
+
+	cmus_mutex_lock(&cue_cache_mutex);
+	list_for_each_entry_safe(e, tmp, &cue_cache, node) {
+		if (e->stale || strcmp(e->filename, filename))
+			continue;
+		if (e->mtime == st.st_mtime && e->size == st.st_size) {
+			e->ref++;
+			cmus_mutex_unlock(&cue_cache_mutex);
+			return e->cd;
+		}
+		e->stale = 1;
+		if (!e->ref)
+			cue_cache_free(e);
+	}
+	cmus_mutex_unlock(&cue_cache_mutex);
+
+	/* parse without the lock, another thread may do the same */
+	cd = cue_from_file(filename);
+	if (!cd)
+		return NULL;
+
+	e = xnew0(struct cue_cache_entry, 1);
+	e->filename = xstrdup(filename);
+	e->mtime = st.st_mtime;
+	e->size = st.st_size;
+	e->cd = cd;
+	e->ref = 1;
+	e->child_rc = 1;
+	pthread_mutex_init(&e->child_mutex, NULL);
+
+	cmus_mutex_lock(&cue_cache_mutex);
+	list_add_tail(&e->node, &cue_cache);
+	cue_cache_count++;
+	cue_cache_shrink();
+	cmus_mutex_unlock(&cue_cache_mutex);
+	return cd;
+}
+
+void cue_cache_put(struct cue_sheet *cd)
+{
+	struct cue_cache_entry *e;
+
+	cmus_mutex_lock(&cue_cache_mutex);
+	e = cue_cache_find(cd);
+	if (--e->ref == 0) {
+		if (e->stale)
+			cue_cache_free(e);
+		else
+			cue_cache_shrink();
+	}
+	cmus_mutex_unlock(&cue_cache_mutex);
+}
+
+static int probe_child(struct cue_cache_entry *e, const char *child_filename)
+{
+	struct input_plugin *ip = ip_new(child_filename);
+	int rc;
+
+	rc = ip_probe(ip);
+	if (!rc) {
+		e->child.duration = ip_duration(ip);
+		e->child.bitrate = ip_bitrate(ip);
+		/* owned by the caller of ip_codec() */
+		e->child.codec = ip_codec(ip);
+		e->child.codec_profile = ip_codec_profile(ip);
+	}
+	ip_delete(ip);
+	return rc;
+}
+
+int cue_cache_child_info(struct cue_sheet *cd, const char *child_filename,
+		struct cue_child_info *info)
+{
+	struct cue_cache_entry *e;
+	time_t mtime = file_get_mtime(child_filename);
+	int rc;
+
+	/* @cd is referenced, the entry can't go away */
+	cmus_mutex_lock(&cue_cache_mutex);
+	e = cue_cache_find(cd);
+	cmus_mutex_unlock(&cue_cache_mutex);
+
+	cmus_mutex_lock(&e->child_mutex);
+	if (e->child_rc == 1 || e->child_mtime != mtime) {
+		free(e->child.codec);
+		free(e->child.codec_profile);
+		memset(&e->child, 0, sizeof(e->child));
+		e->child_rc = probe_child(e, child_filename);
+		e->child_mtime = mtime;
+	}
+	rc = e->child_rc;
+	if (!rc) {
+		*info = e->child;
+		info->codec = e->child.codec ? xstrdup(e->child.codec) : NULL;
+		info->codec_profile = e->child.codec_profile ?
+			xstrdup(e->child.codec_profile) : NULL;
+	}
+	cmus_mutex_unlock(&e->child_mutex);
+	return rc;
+}
+
+void cue_cache_clear(void)
+{
+	struct cue_cache_entry *e, *tmp;
+
+	cmus_mutex_lock(&cue_cache_mutex);
+	list_for_each_entry_safe(e, tmp, &cue_cache, node) {
+		e->stale = 1;
+		if (!e->ref)
+			cue_cache_free(e);
+	}
+	cmus_mutex_unlock(&cue_cache_mutex);
+}
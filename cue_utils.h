@@ -21,9 +21,40 @@
 
 #include <stdio.h>
 
+struct cue_sheet;
+
+/* stream info of the audio file a cue sheet refers to */
+struct cue_child_info {
+	int duration;
+	long bitrate;
+	char *codec;
+	char *codec_profile;
+};
+
 char *associated_cue(const char *filename);
 int cue_get_ntracks(const char *filename);
 char *construct_cue_url(const char *cue_filename, int track_n);
 
+/*
+ * Parsed cue sheets are cached so that scanning a cue-backed album parses
+ * the sheet and probes its audio file once instead of once per track.
+ * Entries are revalidated against the mtime and size of the files.
+ * Thread safe.
+ */
+
+/* returns a sheet to release with cue_cache_put() or NULL */
+struct cue_sheet *cue_cache_get(const char *filename);
+void cue_cache_put(struct cue_sheet *cd);
+
+/*
+ * probes @child_filename, the audio file of @cd, once and copies the
+ * result to @info.  the strings in @info must be freed by the caller.
+ * returns 0 or -IP_ERROR_*
+ */
+int cue_cache_child_info(struct cue_sheet *cd, const char *child_filename,
+		struct cue_child_info *info);
+
+/* drops the unused entries, called when a scan is done */
+void cue_cache_clear(void);
 
 #endif
@@ -42,10 +42,27 @@ static struct simple_track *get_selected(struct editable *e)
 	return NULL;
 }
 
+/* window get_at, @iter holds the head of an editable's list */
+static int editable_get_at(struct iter *iter, int pos)
+{
+	struct editable *e = container_of(iter->data0, struct editable, head);
+	struct rb_counted_node *node;
+
+	if (pos < 0)
+		return 0;
+	node = rb_counted_at(&e->pos_root, pos);
+	if (!node)
+		return 0;
+	editable_track_to_iter(e, container_of(node, struct simple_track, pos_node), iter);
+	return 1;
+}
+
 void editable_shared_init(struct editable_shared *shared,
 		editable_free_track free_track)
 {
 	shared->win = window_new(simple_track_get_prev, simple_track_get_next);
+	shared->win->get_pos = simple_track_get_pos;
+	shared->win->get_at = editable_get_at;
 	shared->sort_keys = xnew(sort_key_t, 1);
 	shared->sort_keys[0] = SORT_INVALID;
 	shared->sort_str[0] = 0;
@@ -62,9 +79,12 @@ void editable_init(struct editable *e, struct editable_shared *shared,
 {
 	list_init(&e->head);
 	e->tree_root = RB_ROOT;
+	e->pos_root = RB_ROOT;
 	e->nr_tracks = 0;
 	e->nr_marked = 0;
 	e->total_time = 0;
+	e->generation = 0;
+	e->order_generation = 0;
 	e->shared = shared;
 
 
@@ -89,11 +109,36 @@ void editable_take_ownership(struct editable *e)
 	}
 }
 
+/* @track has been linked into the list, add it to pos_root at the same place */
+static void pos_link(struct editable *e, struct simple_track *track)
+{
+	struct list_head *prev = track->node.prev;
+
+	rb_insert_counted_after(&track->pos_node,
+			prev == &e->head ? NULL : &to_simple_track(prev)->pos_node,
+			&e->pos_root);
+}
+
+/* after the whole list has been reordered */
+static void pos_rebuild(struct editable *e)
+{
+	struct simple_track *t, *prev = NULL;
+
+	e->pos_root = RB_ROOT;
+	list_for_each_entry(t, &e->head, node) {
+		rb_insert_counted_after(&t->pos_node, prev ? &prev->pos_node : NULL,
+				&e->pos_root);
+		prev = t;
+	}
+}
+
 static void do_editable_add(struct editable *e, struct simple_track *track, int tiebreak)
 {
 	sorted_list_add_track(&e->head, &e->tree_root, track,
 			e->shared->sort_keys, tiebreak);
+	pos_link(e, track);
 	e->nr_tracks++;
+	e->generation++;
 	if (track->info->duration != -1)
 		e->total_time += track->info->duration;
 	if (editable_owns_shared(e))
@@ -110,6 +155,26 @@ void editable_add_before(struct editable *e, struct simple_track *track)
 	do_editable_add(e, track, -1);
 }
 
+void editable_add_tracks(struct editable *e, struct simple_track **tracks, size_t nr)
+{
+	size_t i;
+
+	if (nr == 0)
+		return;
+
+	sorted_list_add_tracks(&e->head, &e->tree_root, tracks, nr,
+			e->shared->sort_keys);
+	pos_rebuild(e);
+	e->generation++;
+	for (i = 0; i < nr; i++) {
+		e->nr_tracks++;
+		if (tracks[i]->info->duration != -1)
+			e->total_time += tracks[i]->info->duration;
+	}
+	if (editable_owns_shared(e))
+		window_changed(e->shared->win);
+}
+
 void editable_remove_track(struct editable *e, struct simple_track *track)
 {
 	struct track_info *ti = track->info;
@@ -121,9 +186,11 @@ void editable_remove_track(struct editable *e, struct simple_track *track)
 
 	e->nr_tracks--;
 	e->nr_marked -= track->marked;
+	e->generation++;
 	if (ti->duration != -1)
 		e->total_time -= ti->duration;
 
+	rb_erase_counted(&track->pos_node, &e->pos_root);
 	sorted_list_remove_track(&e->head, &e->tree_root, track);
 	e->shared->free_track(e, &track->node);
 }
@@ -155,6 +222,9 @@ void editable_sort(struct editable *e)
 	if (e->nr_tracks <= 1)
 		return;
 	sorted_list_rebuild(&e->head, &e->tree_root, e->shared->sort_keys);
+	pos_rebuild(e);
+	e->generation++;
+	e->order_generation++;
 
 	if (editable_owns_shared(e)) {
 		window_changed(e->shared->win);
@@ -194,6 +264,7 @@ static void move_item(struct editable *e, struct list_head *head, struct list_he
 	if (editable_owns_shared(e))
 		window_row_vanishes(e->shared->win, &iter);
 
+	rb_erase_counted(&t->pos_node, &e->pos_root);
 	list_del(item);
 	list_add(item, head);
 }
@@ -239,9 +310,12 @@ static void move_sel(struct editable *e, struct list_head *after)
 	while (item != &tmp_head) {
 		next = item->next;
 		list_add(item, after);
+		pos_link(e, to_simple_track(item));
 		item = next;
 	}
 	reset_tree(e);
+	e->generation++;
+	e->order_generation++;
 
 	/* select top-most of the moved tracks */
 	editable_track_to_iter(e, to_simple_track(after->next), &iter);
@@ -453,6 +527,9 @@ void editable_rand(struct editable *e)
 	if (e->nr_tracks <=1)
 		return;
 	rand_list_rebuild(&e->head, &e->tree_root);
+	pos_rebuild(e);
+	e->generation++;
+	e->order_generation++;
 
 	if (editable_owns_shared(e)) {
 		window_changed(e->shared->win);
@@ -43,9 +43,15 @@ struct editable_shared {
 struct editable {
 	struct list_head head;
 	struct rb_root tree_root;
+	/* all tracks in list order, gives the row number of a track */
+	struct rb_root pos_root;
 	unsigned int nr_tracks;
 	unsigned int nr_marked;
 	unsigned int total_time;
+	/* incremented when tracks are added, removed or reordered */
+	unsigned int generation;
+	/* incremented when tracks are reordered */
+	unsigned int order_generation;
 	struct editable_shared *shared;
 };
 
@@ -59,6 +65,8 @@ void editable_init(struct editable *e, struct editable_shared *shared,
 void editable_take_ownership(struct editable *e);
 void editable_add(struct editable *e, struct simple_track *track);
 void editable_add_before(struct editable *e, struct simple_track *track);
+/* see sorted_list_add_tracks() */
+void editable_add_tracks(struct editable *e, struct simple_track **tracks, size_t nr);
 void editable_remove_track(struct editable *e, struct simple_track *track);
 void editable_remove_sel(struct editable *e);
 void editable_sort(struct editable *e);
@@ -427,31 +427,59 @@ static const struct {
 	{ '\0',	NULL		},
 };
 
+/* how expr_eval() gets the value of a key */
+enum expr_field {
+	/* not a builtin, looked up in the comments */
+	FIELD_OTHER,
+
+	FIELD_ALBUM,
+	FIELD_ALBUMARTIST,
+	FIELD_ARTIST,
+	FIELD_BITRATE,
+	FIELD_BPM,
+	FIELD_CODEC,
+	FIELD_CODEC_PROFILE,
+	FIELD_COMMENT,
+	FIELD_DATE,
+	FIELD_DISCNUMBER,
+	FIELD_DURATION,
+	FIELD_FILENAME,
+	FIELD_GENRE,
+	FIELD_MEDIA,
+	FIELD_ORIGINALDATE,
+	FIELD_PLAY_COUNT,
+	FIELD_STREAM,
+	FIELD_TAG,
+	FIELD_TITLE,
+	FIELD_TRACKNUMBER
+};
+
 static const struct {
 	const char *key;
 	enum expr_type type;
+	enum expr_field field;
 } builtin[] = {
-	{ "album",	EXPR_STR	},
-	{ "albumartist",EXPR_STR	},
-	{ "artist",	EXPR_STR	},
-	{ "bitrate",	EXPR_INT	},
-	{ "bpm",	EXPR_INT	},
-	{ "codec",	EXPR_STR	},
-	{ "codec_profile",EXPR_STR	},
-	{ "comment",	EXPR_STR	},
-	{ "date",	EXPR_INT	},
-	{ "discnumber", EXPR_INT	},
-	{ "duration",	EXPR_INT	},
-	{ "filename",	EXPR_STR	},
-	{ "genre",	EXPR_STR	},
-	{ "media",	EXPR_STR	},
-	{ "originaldate",EXPR_INT	},
-	{ "play_count", EXPR_INT	},
-	{ "stream",	EXPR_BOOL	},
-	{ "tag",	EXPR_BOOL	},
-	{ "title",	EXPR_STR	},
-	{ "tracknumber",EXPR_INT	},
-	{ NULL,		-1		},
+	{ "album",	EXPR_STR,	FIELD_ALBUM		},
+	{ "albumartist",EXPR_STR,	FIELD_ALBUMARTIST	},
+	{ "artist",	EXPR_STR,	FIELD_ARTIST		},
+	{ "bitrate",	EXPR_INT,	FIELD_BITRATE		},
+	{ "bpm",	EXPR_INT,	FIELD_BPM		},
+	{ "codec",	EXPR_STR,	FIELD_CODEC		},
+	{ "codec_profile",EXPR_STR,	FIELD_CODEC_PROFILE	},
+	{ "comment",	EXPR_STR,	FIELD_COMMENT		},
+	{ "date",	EXPR_INT,	FIELD_DATE		},
+	{ "discnumber", EXPR_INT,	FIELD_DISCNUMBER	},
+	{ "duration",	EXPR_INT,	FIELD_DURATION		},
+	{ "filename",	EXPR_STR,	FIELD_FILENAME		},
+	{ "genre",	EXPR_STR,	FIELD_GENRE		},
+	{ "media",	EXPR_STR,	FIELD_MEDIA		},
+	{ "originaldate",EXPR_INT,	FIELD_ORIGINALDATE	},
+	{ "play_count", EXPR_INT,	FIELD_PLAY_COUNT	},
+	{ "stream",	EXPR_BOOL,	FIELD_STREAM		},
+	{ "tag",	EXPR_BOOL,	FIELD_TAG		},
+	{ "title",	EXPR_STR,	FIELD_TITLE		},
+	{ "tracknumber",EXPR_INT,	FIELD_TRACKNUMBER	},
+	{ NULL,		-1,		FIELD_OTHER		},
 };
 
 static const char *lookup_long_key(char c)
@@ -477,6 +505,19 @@ static enum expr_type lookup_key_type(const char *key)
 	return -1;
 }
 
+static enum expr_field lookup_key_field(const char *key)
+{
+	int i;
+	for (i = 0; builtin[i].key; i++) {
+		int cmp = strcmp(key, builtin[i].key);
+		if (cmp == 0)
+			return builtin[i].field;
+		if (cmp < 0)
+			break;
+	}
+	return FIELD_OTHER;
+}
+
 static unsigned long stack4_new(void)
 {
 	return 0;
@@ -717,6 +758,47 @@ error_exit:
 	return NULL;
 }
 
+static void update_cost(struct expr *expr)
+{
+	switch (expr->type) {
+	case EXPR_AND:
+	case EXPR_OR:
+		expr->cost = expr->left->cost + expr->right->cost;
+		break;
+	case EXPR_NOT:
+		expr->cost = expr->left->cost;
+		break;
+	case EXPR_STR:
+		/* glob_match() */
+		expr->cost = expr->field == FIELD_OTHER ? 12 : 4;
+		break;
+	case EXPR_INT:
+		expr->cost = expr->field == FIELD_OTHER ? 8 : 1;
+		break;
+	case EXPR_ID:
+		expr->cost = 16;
+		break;
+	case EXPR_BOOL:
+		expr->cost = 1;
+		break;
+	}
+}
+
+/* resolve keys so that expr_eval() doesn't have to compare them */
+static void compile(struct expr *expr)
+{
+	if (expr->left) {
+		compile(expr->left);
+		if (expr->right)
+			compile(expr->right);
+	} else {
+		expr->field = lookup_key_field(expr->key);
+		if (expr->type == EXPR_ID)
+			expr->eid.field = lookup_key_field(expr->eid.key);
+	}
+	update_cost(expr);
+}
+
 int expr_is_short(const char *str)
 {
 	int i;
@@ -770,6 +852,8 @@ struct expr *expr_parse_i(const char *str, const char *err_msg, int check_short)
 	if (parse(&root, &head, &item, 0))
 		root = NULL;
 	free_tokens(&head);
+	if (root)
+		compile(root);
 
 out:
 	free(u_str);
@@ -787,8 +871,10 @@ int expr_check_leaves(struct expr **exprp, const char *(*get_filter)(const char
 	if (expr->left) {
 		if (expr_check_leaves(&expr->left, get_filter))
 			return -1;
-		if (expr->right)
-			return expr_check_leaves(&expr->right, get_filter);
+		if (expr->right && expr_check_leaves(&expr->right, get_filter))
+			return -1;
+		/* leaves may have been replaced by filters */
+		update_cost(expr);
 		return 0;
 	}
 
@@ -887,47 +973,64 @@ int expr_is_harmless(const struct expr *expr)
 	return 1;
 }
 
-static const char *str_val(const char *key, struct track_info *ti, char **need_free)
+static const char *str_val(const char *key, int field, struct track_info *ti, char **need_free)
 {
-	const char *val;
 	*need_free = NULL;
-	if (strcmp(key, "filename") == 0) {
-		val = ti->filename;
-		if (!using_utf8 && utf8_encode(val, charset, need_free) == 0) {
-			val = *need_free;
-		}
-	} else if (strcmp(key, "codec") == 0) {
-		val = ti->codec;
-	} else if (strcmp(key, "codec_profile") == 0) {
-		val = ti->codec_profile;
-	} else {
-		val = keyvals_get_val(ti->comments, key);
+	switch (field) {
+	case FIELD_FILENAME:
+		if (!using_utf8 && utf8_encode(ti->filename, charset, need_free) == 0)
+			return *need_free;
+		return ti->filename;
+	case FIELD_CODEC:
+		return ti->codec;
+	case FIELD_CODEC_PROFILE:
+		return ti->codec_profile;
+	/* the tag values, without the guesses of track_info_set_comments() */
+	case FIELD_ALBUM:
+		return ti->album;
+	case FIELD_ARTIST:
+		return ti->artist_guessed ? NULL : ti->artist;
+	case FIELD_ALBUMARTIST:
+		/* falls back to artist if not tagged or empty */
+		if (ti->artist_guessed || ti->albumartist != ti->artist)
+			return ti->albumartist;
+		break;
+	case FIELD_COMMENT:
+		return ti->comment;
+	case FIELD_GENRE:
+		return ti->genre;
+	case FIELD_MEDIA:
+		return ti->media;
+	case FIELD_TITLE:
+		return ti->title_guessed ? NULL : ti->title;
 	}
-	return val;
+	return keyvals_get_val(ti->comments, key);
 }
 
-static int int_val(const char *key, struct track_info *ti)
+static int int_val(const char *key, int field, struct track_info *ti)
 {
-	int val;
-	if (strcmp(key, "duration") == 0) {
-		val = ti->duration;
+	switch (field) {
+	case FIELD_DURATION:
 		/* duration of a stream is infinite (well, almost) */
 		if (is_http_url(ti->filename))
-			val = INT_MAX;
-	} else if (strcmp(key, "date") == 0) {
-		val = (ti->date >= 0) ? (ti->date / 10000) : -1;
-	} else if (strcmp(key, "originaldate") == 0) {
-		val = (ti->originaldate >= 0) ? (ti->originaldate / 10000) : -1;
-	} else if (strcmp(key, "bitrate") == 0) {
-		val = (ti->bitrate >= 0) ? (int) (ti->bitrate / 1000. + 0.5) : -1;
-	} else if (strcmp(key, "play_count") == 0) {
-		val = ti->play_count;
-	} else if (strcmp(key, "bpm") == 0) {
-		val = ti->bpm;
-	} else {
-		val = comments_get_int(ti->comments, key);
+			return INT_MAX;
+		return ti->duration;
+	case FIELD_DATE:
+		return (ti->date >= 0) ? (ti->date / 10000) : -1;
+	case FIELD_ORIGINALDATE:
+		return (ti->originaldate >= 0) ? (ti->originaldate / 10000) : -1;
+	case FIELD_BITRATE:
+		return (ti->bitrate >= 0) ? (int) (ti->bitrate / 1000. + 0.5) : -1;
+	case FIELD_PLAY_COUNT:
+		return ti->play_count;
+	case FIELD_BPM:
+		return ti->bpm;
+	case FIELD_TRACKNUMBER:
+		return ti->tracknumber;
+	case FIELD_DISCNUMBER:
+		return ti->discnumber;
 	}
-	return val;
+	return comments_get_int(ti->comments, key);
 }
 
 int expr_op_to_bool(int res, int op)
@@ -955,22 +1058,26 @@ int expr_eval(struct expr *expr, struct track_info *ti)
 	enum expr_type type = expr->type;
 	const char *key;
 
-	if (expr->left) {
-		int left = expr_eval(expr->left, ti);
+	if (type == EXPR_AND || type == EXPR_OR) {
+		struct expr *first = expr->left, *second = expr->right;
 
+		/* no side effects, evaluate the cheaper side first */
+		if (second->cost < first->cost) {
+			first = expr->right;
+			second = expr->left;
+		}
 		if (type == EXPR_AND)
-			return left && expr_eval(expr->right, ti);
-		if (type == EXPR_OR)
-			return left || expr_eval(expr->right, ti);
-		/* EXPR_NOT */
-		return !left;
+			return expr_eval(first, ti) && expr_eval(second, ti);
+		return expr_eval(first, ti) || expr_eval(second, ti);
 	}
+	if (type == EXPR_NOT)
+		return !expr_eval(expr->left, ti);
 
 	key = expr->key;
 	if (type == EXPR_STR) {
 		int res;
 		char *need_free;
-		const char *val = str_val(key, ti, &need_free);
+		const char *val = str_val(key, expr->field, ti, &need_free);
 		if (!val)
 			val = "";
 		res = glob_match(&expr->estr.glob_head, val);
@@ -979,7 +1086,7 @@ int expr_eval(struct expr *expr, struct track_info *ti)
 			return res;
 		return !res;
 	} else if (type == EXPR_INT) {
-		int val = int_val(key, ti);
+		int val = int_val(key, expr->field, ti);
 		int res;
 		if (expr->eint.val == -1) {
 			/* -1 is "not set"
@@ -1002,8 +1109,8 @@ int expr_eval(struct expr *expr, struct track_info *ti)
 		const char *sa, *sb;
 		char *fa, *fb;
 		int res = 0;
-		if ((sa = str_val(key, ti, &fa))) {
-			if ((sb = str_val(expr->eid.key, ti, &fb))) {
+		if ((sa = str_val(key, expr->field, ti, &fa))) {
+			if ((sb = str_val(expr->eid.key, expr->eid.field, ti, &fb))) {
 				res = strcmp(sa, sb);
 				free(fa);
 				free(fb);
@@ -1011,8 +1118,8 @@ int expr_eval(struct expr *expr, struct track_info *ti)
 			}
 			free(fa);
 		} else {
-			a = int_val(key, ti);
-			b = int_val(expr->eid.key, ti);
+			a = int_val(key, expr->field, ti);
+			b = int_val(expr->eid.key, expr->eid.field, ti);
 			res = a - b;
 			if (a == -1 || b == -1) {
 				switch (expr->eid.op) {
@@ -1028,7 +1135,7 @@ int expr_eval(struct expr *expr, struct track_info *ti)
 		}
 		return res;
 	}
-	if (strcmp(key, "stream") == 0)
+	if (expr->field == FIELD_STREAM)
 		return is_http_url(ti->filename);
 	return track_info_has_tag(ti);
 }
@@ -42,6 +42,10 @@ struct expr {
 	struct expr *left, *right, *parent;
 	enum expr_type type;
 	char *key;
+	/* key resolved by expr_parse() */
+	int field;
+	/* estimated cost of expr_eval(), the cheaper side of & and | goes first */
+	unsigned int cost;
 	union {
 		struct {
 			struct list_head glob_head;
@@ -63,6 +67,7 @@ struct expr {
 		} eint;
 		struct {
 			char* key;
+			int field;
 			enum {
 				KOP_LT = OP_LT,
 				KOP_LE = OP_LE,
@@ -39,6 +39,9 @@ void gbuf_grow(struct gbuf *buf, size_t more)
 	size_t alloc = (buf->len + more + 1 + align) & ~align;
 
 	if (alloc > buf->alloc) {
+		/* grow geometrically, long-lived buffers can get large */
+		if (alloc < buf->alloc * 2)
+			alloc = buf->alloc * 2;
 		if (!buf->alloc)
 			buf->buffer = NULL;
 		buf->alloc = alloc;
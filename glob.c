@@ -31,6 +31,9 @@ struct glob_item {
 		GLOB_QMARK,
 		GLOB_TEXT
 	} type;
+	/* GLOB_TEXT: length of text in bytes and characters */
+	int bytes;
+	int chars;
 	char text[];
 };
 
@@ -162,6 +165,8 @@ void glob_compile(struct list_head *head, const char *pattern)
 				}
 			}
 			str[j] = 0;
+			item->bytes = j;
+			item->chars = u_strlen(str);
 		}
 		list_add_tail(&item->node, head);
 	}
@@ -191,11 +196,9 @@ static int do_glob_match(struct list_head *head, struct list_head *first, const
 
 		gitem = container_of(item, struct glob_item, node);
 		if (gitem->type == GLOB_TEXT) {
-			int len = u_strlen(gitem->text);
-
-			if (!u_strncase_equal_base(gitem->text, text, len))
+			if (!u_strncase_equal_base(gitem->text, text, gitem->chars))
 				return 0;
-			text += strlen(gitem->text);
+			text += gitem->bytes;
 		} else if (gitem->type == GLOB_QMARK) {
 			uchar u;
 			int idx = 0;
@@ -222,7 +225,7 @@ static int do_glob_match(struct list_head *head, struct list_head *first, const
 			next_gi = container_of(next, struct glob_item, node);
 			BUG_ON(next_gi->type != GLOB_TEXT);
 			t = next_gi->text;
-			tlen = strlen(t);
+			tlen = next_gi->bytes;
 			while (1) {
 				const char *pos;
 
@@ -1040,28 +1040,29 @@ static void unsync(unsigned char *buf, int *lenp)
 	*lenp = d;
 }
 
-static int v2_read(struct id3tag *id3, int fd, const struct v2_header *header)
+static int v2_frame_header_parse(struct v2_frame_header *fh,
+		const struct v2_header *header, const char *buf)
+{
+	if (header->ver_major == 2)
+		return v2_2_0_frame_header_parse(fh, buf);
+	if (header->ver_major == 3)
+		return v2_3_0_frame_header_parse(fh, buf);
+	/* assume v2.4 */
+	return v2_4_0_frame_header_parse(fh, buf);
+}
+
+static int v2_read_frames(struct id3tag *id3, char *buf, int buf_size,
+		const struct v2_header *header)
 {
-	char *buf;
-	int rc, buf_size;
 	int frame_start, i;
 	int frame_header_size;
 
-	buf_size = header->size;
-	buf = xnew(char, buf_size);
-	rc = read_all(fd, buf, buf_size);
-	if (rc == -1) {
-		free(buf);
-		return rc;
-	}
-
 	frame_start = 0;
 	if (header->flags & V2_HEADER_EXTENDED) {
 		struct v2_extended_header ext;
 
 		if (!v2_extended_header_parse(&ext, buf) || ext.size > buf_size) {
 			id3_debug("extended header corrupted\n");
-			free(buf);
 			return -2;
 		}
 		frame_start = ext.size;
@@ -1077,17 +1078,8 @@ static int v2_read(struct id3tag *id3, int fd, const struct v2_header *header)
 		struct v2_frame_header fh;
 		int len_unsync;
 
-		if (header->ver_major == 2) {
-			if (!v2_2_0_frame_header_parse(&fh, buf + i))
-				break;
-		} else if (header->ver_major == 3) {
-			if (!v2_3_0_frame_header_parse(&fh, buf + i))
-				break;
-		} else {
-			/* assume v2.4 */
-			if (!v2_4_0_frame_header_parse(&fh, buf + i))
-				break;
-		}
+		if (!v2_frame_header_parse(&fh, header, buf + i))
+			break;
 
 		i += frame_header_size;
 
@@ -1113,9 +1105,109 @@ static int v2_read(struct id3tag *id3, int fd, const struct v2_header *header)
 
 		i += len_unsync;
 	}
+	return 0;
+}
+
+/* larger tags usually contain pictures, only the frames used are read */
+#define V2_SKIP_MIN (64 * 1024)
+
+/* frames that v2_add_frame() uses */
+static int v2_frame_used(const struct v2_frame_header *fh)
+{
+	return !strncmp(fh->id, "RVA2", 4) || !strncmp(fh->id, "UFID", 4) ||
+		!strncmp(fh->id, "TXXX", 4) || !strncmp(fh->id, "COM", 3) ||
+		frame_tab_index(fh->id) >= 0;
+}
+
+/*
+ * Reads the extended header and the used frames of the tag to @buf, which
+ * has room for the whole tag, and seeks over the others.  The frames are
+ * walked exactly like v2_read_frames() does.  Returns the number of bytes
+ * stored in @buf or -1.
+ */
+static int v2_read_used(int fd, const struct v2_header *header, char *buf)
+{
+	int frame_header_size = header->ver_major == 2 ? 6 : 10;
+	int size = header->size;
+	int i = 0, len = 0;
+	ssize_t rc;
+
+	if (header->flags & V2_HEADER_EXTENDED) {
+		struct v2_extended_header ext;
+
+		rc = read_all(fd, buf, 4);
+		if (rc != 4)
+			return rc == -1 ? -1 : rc;
+		/* v2_read_frames() reports a corrupted one */
+		if (!v2_extended_header_parse(&ext, buf) || ext.size > size)
+			return 4;
+		if (ext.size > 4) {
+			rc = read_all(fd, buf + 4, ext.size - 4);
+			if (rc != ext.size - 4)
+				return rc == -1 ? -1 : 4 + rc;
+		} else if (lseek(fd, (off_t)ext.size - 4, SEEK_CUR) == -1) {
+			return -1;
+		}
+		i = len = ext.size;
+	}
+
+	while (i < size - frame_header_size) {
+		struct v2_frame_header fh;
+		char *h = buf + len;
+		int frame_len;
+
+		rc = read_all(fd, h, frame_header_size);
+		if (rc == -1)
+			return -1;
+		if (rc != frame_header_size || !v2_frame_header_parse(&fh, header, h))
+			break;
+		i += frame_header_size;
+		if (fh.size > size - i)
+			break;
+
+		frame_len = fh.size;
+		if (v2_frame_used(&fh)) {
+			rc = read_all(fd, h + frame_header_size, frame_len);
+			if (rc == -1)
+				return -1;
+			if (rc != frame_len)
+				break;
+			len += frame_header_size + frame_len;
+		} else if (lseek(fd, frame_len, SEEK_CUR) == -1) {
+			return -1;
+		}
+		i += frame_len;
+	}
+	return len;
+}
+
+static int v2_read(struct id3tag *id3, int fd, const struct v2_header *header)
+{
+	char *buf;
+	int rc, buf_size;
+	off_t start = -1;
+
+	buf = xnew(char, header->size);
+	if (header->size >= V2_SKIP_MIN)
+		start = lseek(fd, 0, SEEK_CUR);
+	if (start != -1) {
+		buf_size = v2_read_used(fd, header, buf);
+		/* after the tag, like reading all of it */
+		if (buf_size != -1 && lseek(fd, start + header->size, SEEK_SET) == -1)
+			buf_size = -1;
+	} else {
+		buf_size = header->size;
+		if (read_all(fd, buf, buf_size) == -1)
+			buf_size = -1;
+	}
+	if (buf_size == -1) {
+		free(buf);
+		return -1;
+	}
 
+	rc = v2_read_frames(id3, buf, buf_size, header);
 	free(buf);
-	return 0;
+	return rc;
 }
 
 int id3_tag_size(const char *buf, int buf_size)
@@ -36,6 +36,7 @@
 #include "xstrjoin.h"
 
 #include <unistd.h>
+#include <stddef.h>
 #include <stdbool.h>
 #include <string.h>
 #include <errno.h>
@@ -55,6 +56,8 @@ struct input_plugin {
 	struct input_plugin_data data;
 	unsigned int open : 1;
 	unsigned int eof : 1;
+	/* opened with ip_probe() */
+	unsigned int probe : 1;
 	int http_code;
 	char *http_reason;
 
@@ -89,10 +92,14 @@ struct ip {
 	int priority;
 	const char * const *extensions;
 	const char * const *mime_types;
-	const struct input_plugin_ops *ops;
+	/* copy, zero filled beyond the ops known to the plugin's ABI */
+	struct input_plugin_ops ops;
 	const struct input_plugin_opt *options;
 };
 
+/* oldest plugin ABI still loaded */
+#define IP_ABI_VERSION_MIN 1
+
 static const char *plugin_dir;
 static LIST_HEAD(ip_head);
 
@@ -130,7 +137,7 @@ get_ops_by_extension_locked(const char *ext, struct list_head **headp)
 		for (i = 0; exts[i]; i++) {
 			if (strcasecmp(ext, exts[i]) == 0 || strcmp("*", exts[i]) == 0) {
 				*headp = node;
-				return ip->ops;
+				return &ip->ops;
 			}
 		}
 	}
@@ -162,7 +169,7 @@ get_ops_by_mime_type_locked(const char *mime_type)
 
 		for (i = 0; types[i]; i++) {
 			if (strcasecmp(mime_type, types[i]) == 0)
-				return ip->ops;
+				return &ip->ops;
 		}
 	}
 	return NULL;
@@ -427,8 +434,11 @@ static void ip_init(struct input_plugin *ip, char *filename)
 static void ip_reset(struct input_plugin *ip, int close_fd)
 {
 	int fd = ip->data.fd;
+	unsigned int probe = ip->probe;
+
 	free(ip->data.metadata);
 	ip_init(ip, ip->data.filename);
+	ip->probe = probe;
 	if (fd != -1) {
 		if (close_fd)
 			close(fd);
@@ -439,6 +449,13 @@ static void ip_reset(struct input_plugin *ip, int close_fd)
 	}
 }
 
+static int ops_open(struct input_plugin *ip)
+{
+	if (ip->probe && ip->ops->probe && !ip->data.remote)
+		return ip->ops->probe(&ip->data);
+	return ip->ops->open(&ip->data);
+}
+
 static int open_file_locked(struct input_plugin *ip)
 {
 	const struct input_plugin_ops *ops;
@@ -460,7 +477,7 @@ static int open_file_locked(struct input_plugin *ip)
 
 	while (1) {
 		ip->ops = ops;
-		rc = ip->ops->open(&ip->data);
+		rc = ops_open(ip);
 		if (rc != -IP_ERROR_UNSUPPORTED_FILE_TYPE)
 			break;
 
@@ -510,6 +527,7 @@ void ip_load_plugins(void)
 		char *ext;
 		const int *priority_ptr;
 		const unsigned *abi_version_ptr;
+		const struct input_plugin_ops *ops;
 		bool err = false;
 
 		if (d->d_name[0] == '.')
@@ -534,13 +552,14 @@ void ip_load_plugins(void)
 		priority_ptr = dlsym(so, "ip_priority");
 		ip->extensions = dlsym(so, "ip_extensions");
 		ip->mime_types = dlsym(so, "ip_mime_types");
-		ip->ops = dlsym(so, "ip_ops");
+		ops = dlsym(so, "ip_ops");
 		ip->options = dlsym(so, "ip_options");
-		if (!priority_ptr || !ip->extensions || !ip->mime_types || !ip->ops || !ip->options) {
+		if (!priority_ptr || !ip->extensions || !ip->mime_types || !ops || !ip->options) {
 			error_msg("%s: missing symbol", filename);
 			err = true;
 		}
-		if (!abi_version_ptr || *abi_version_ptr != IP_ABI_VERSION) {
+		if (!abi_version_ptr || *abi_version_ptr < IP_ABI_VERSION_MIN ||
+				*abi_version_ptr > IP_ABI_VERSION) {
 			error_msg("%s: incompatible plugin version", filename);
 			err = true;
 		}
@@ -551,6 +570,13 @@ void ip_load_plugins(void)
 		}
 		ip->priority = *priority_ptr;
 
+		/* version 1 ends before probe */
+		memset(&ip->ops, 0, sizeof(ip->ops));
+		if (*abi_version_ptr == 1)
+			memcpy(&ip->ops, ops, offsetof(struct input_plugin_ops, probe));
+		else
+			ip->ops = *ops;
+
 		ip->name = xstrndup(d->d_name, ext - d->d_name);
 		ip->handle = so;
 
@@ -587,14 +613,14 @@ int ip_open(struct input_plugin *ip)
 	if (ip->data.remote) {
 		rc = open_remote(ip);
 		if (rc == 0)
-			rc = ip->ops->open(&ip->data);
+			rc = ops_open(ip);
 	} else {
 		if (is_cdda_url(ip->data.filename)) {
 			ip->ops = get_ops_by_mime_type("x-content/audio-cdda");
-			rc = ip->ops ? ip->ops->open(&ip->data) : 1;
+			rc = ip->ops ? ops_open(ip) : 1;
 		} else if (is_cue_url(ip->data.filename)) {
 			ip->ops = get_ops_by_mime_type("application/x-cue");
-			rc = ip->ops ? ip->ops->open(&ip->data) : 1;
+			rc = ip->ops ? ops_open(ip) : 1;
 		} else
 			rc = open_file(ip);
 	}
@@ -609,6 +635,12 @@ int ip_open(struct input_plugin *ip)
 	return 0;
 }
 
+int ip_probe(struct input_plugin *ip)
+{
+	ip->probe = 1;
+	return ip_open(ip);
+}
+
 void ip_setup(struct input_plugin *ip)
 {
 	unsigned int bits, is_signed, channels;
@@ -666,6 +698,7 @@ int ip_read(struct input_plugin *ip, char *buffer, int count)
 	int rc;
 
 	BUG_ON(count <= 0);
+	BUG_ON(ip->probe);
 
 	FD_ZERO(&readfds);
 	FD_SET(ip->data.fd, &readfds);
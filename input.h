@@ -43,6 +43,12 @@ void ip_delete(struct input_plugin *ip);
  */
 int ip_open(struct input_plugin *ip);
 
+/*
+ * like ip_open() but for reading the tags, duration, bitrate and codec
+ * only.  ip_read() and ip_seek() must not be called.
+ */
+int ip_probe(struct input_plugin *ip);
+
 void ip_setup(struct input_plugin *ip);
 
 /*
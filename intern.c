@@ -0,0 +1,238 @@
+/*
+ * Copyright 2008-2013 Various Authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "intern.h"
+#include "u_collate.h"
+#include "locking.h"
+#include "xmalloc.h"
+#include "compiler.h"
+#include "utils.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define INTERN_HASH_MIN_SIZE	1024
+
+struct intern_entry;
+
+struct intern_key {
+	struct intern_entry *e;
+	char key[];
+};
+
+struct intern_entry {
+	/* references to str and key, the entry is freed when it drops to 0 */
+	unsigned int refs;
+	/* NULL until a collation key is asked for */
+	struct intern_key *collkey;
+	char str[];
+};
+
+struct intern_slot {
+	uint32_t hash;
+	struct intern_entry *e;
+};
+
+static struct intern_slot *slots;
+static unsigned int mask;
+static unsigned int count;
+
+static pthread_mutex_t intern_mutex = CMUS_MUTEX_INITIALIZER;
+
+static inline unsigned int home_slot(uint32_t hash)
+{
+	return (hash * 2654435761u) & mask;
+}
+
+static void place(struct intern_entry *e, uint32_t hash)
+{
+	unsigned int i = home_slot(hash);
+
+	while (slots[i].e)
+		i = (i + 1) & mask;
+	slots[i].hash = hash;
+	slots[i].e = e;
+}
+
+static void resize(unsigned int size)
+{
+	struct intern_slot *old = slots;
+	unsigned int i, old_size = old ? mask + 1 : 0;
+
+	slots = xnew0(struct intern_slot, size);
+	mask = size - 1;
+	for (i = 0; i < old_size; i++) {
+		if (old[i].e)
+			place(old[i].e, old[i].hash);
+	}
+	free(old);
+}
+
+/* returns a new reference, intern_mutex must be held */
+static struct intern_entry *lookup(const char *str)
+{
+	uint32_t hash = hash_str(str);
+	struct intern_entry *e;
+	size_t len;
+
+	if (slots) {
+		unsigned int i = home_slot(hash);
+
+		while (slots[i].e) {
+			if (slots[i].hash == hash && !strcmp(slots[i].e->str, str)) {
+				slots[i].e->refs++;
+				return slots[i].e;
+			}
+			i = (i + 1) & mask;
+		}
+	}
+
+	if (!slots)
+		resize(INTERN_HASH_MIN_SIZE);
+	else if ((count + 1) * 4 > (mask + 1) * 3)
+		resize((mask + 1) * 2);
+
+	len = strlen(str) + 1;
+	e = xmalloc(sizeof(*e) + len);
+	e->refs = 1;
+	e->collkey = NULL;
+	memcpy(e->str, str, len);
+	place(e, hash);
+	count++;
+	return e;
+}
+
+/* intern_mutex must be held */
+static void remove_entry(struct intern_entry *e)
+{
+	unsigned int i = home_slot(hash_str(e->str));
+	unsigned int j;
+
+	while (slots[i].e != e)
+		i = (i + 1) & mask;
+
+	/* move back the entries that probed past the freed slot */
+	for (j = (i + 1) & mask; slots[j].e; j = (j + 1) & mask) {
+		unsigned int home = home_slot(slots[j].hash);
+
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			slots[i] = slots[j];
+			i = j;
+		}
+	}
+	slots[i].e = NULL;
+	count--;
+}
+
+static void put_entry(struct intern_entry *e)
+{
+	cmus_mutex_lock(&intern_mutex);
+	if (--e->refs) {
+		e = NULL;
+	} else {
+		remove_entry(e);
+	}
+	cmus_mutex_unlock(&intern_mutex);
+
+	if (e) {
+		free(e->collkey);
+		free(e);
+	}
+}
+
+static struct intern_entry *str_to_entry(const char *str)
+{
+	return container_of(str, struct intern_entry, str[0]);
+}
+
+const char *intern_str(const char *str)
+{
+	struct intern_entry *e;
+
+	cmus_mutex_lock(&intern_mutex);
+	e = lookup(str);
+	cmus_mutex_unlock(&intern_mutex);
+	return e->str;
+}
+
+const char *intern_ref(const char *str)
+{
+	if (str) {
+		cmus_mutex_lock(&intern_mutex);
+		str_to_entry(str)->refs++;
+		cmus_mutex_unlock(&intern_mutex);
+	}
+	return str;
+}
+
+void intern_put(const char *str)
+{
+	if (str)
+		put_entry(str_to_entry(str));
+}
+
+/* @e is referenced by the caller */
+static const char *entry_collkey(struct intern_entry *e)
+{
+	struct intern_key *ikey;
+	char *key;
+	size_t len;
+
+	cmus_mutex_lock(&intern_mutex);
+	ikey = e->collkey;
+	cmus_mutex_unlock(&intern_mutex);
+	if (ikey)
+		return ikey->key;
+
+	/* entries never move, compute the key without holding the lock */
+	key = u_strcasecoll_key(e->str);
+	len = strlen(key) + 1;
+	ikey = xmalloc(sizeof(*ikey) + len);
+	ikey->e = e;
+	memcpy(ikey->key, key, len);
+	free(key);
+
+	cmus_mutex_lock(&intern_mutex);
+	if (!e->collkey) {
+		e->collkey = ikey;
+		ikey = NULL;
+	}
+	cmus_mutex_unlock(&intern_mutex);
+	free(ikey);
+	return e->collkey->key;
+}
+
+const char *intern_str_collkey(const char *str)
+{
+	return str ? entry_collkey(str_to_entry(str)) : NULL;
+}
+
+const char *intern_collkey(const char *str)
+{
+	struct intern_entry *e;
+
+	cmus_mutex_lock(&intern_mutex);
+	e = lookup(str);
+	cmus_mutex_unlock(&intern_mutex);
+	return entry_collkey(e);
+}
+
+void intern_collkey_put(const char *key)
+{
+	if (key)
+		put_entry(container_of(key, struct intern_key, key[0])->e);
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2008-2013 Various Authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CMUS_INTERN_H
+#define CMUS_INTERN_H
+
+/*
+ * Shared copies of strings that repeat across many tracks (artist, album,
+ * genre, ...) together with their collation keys.  Each distinct string is
+ * stored once and its key is computed at most once.  Entries are reference
+ * counted and freed when the last reference is dropped.
+ *
+ * Safe to call from any thread.
+ */
+
+/* returns a new reference to the shared copy of @str */
+const char *intern_str(const char *str);
+
+/* another reference to @str, which was returned by intern_str().  NULL is ignored */
+const char *intern_ref(const char *str);
+
+/* drops a reference returned by intern_str() or intern_ref().  NULL is ignored */
+void intern_put(const char *str);
+
+/* collation key of @str, which was returned by intern_str().  not referenced,
+ * valid as long as @str is */
+const char *intern_str_collkey(const char *str);
+
+/* like u_strcasecoll_key() but the key is shared and must be dropped with
+ * intern_collkey_put() instead of freed */
+const char *intern_collkey(const char *str);
+
+void intern_collkey_put(const char *key);
+
+#endif
@@ -28,7 +28,7 @@
 #include <unistd.h>
 #endif
 
-#define IP_ABI_VERSION 1
+#define IP_ABI_VERSION 2
 
 enum {
 	/* no error */
@@ -97,6 +97,14 @@ struct input_plugin_ops {
 	long (*bitrate_current)(struct input_plugin_data *ip_data);
 	char *(*codec)(struct input_plugin_data *ip_data);
 	char *(*codec_profile)(struct input_plugin_data *ip_data);
+
+	/*
+	 * Optional, since ABI version 2.  Opens the file like open but only
+	 * read_comments, duration, bitrate, codec, codec_profile and close
+	 * are called afterwards, so decoder setup can be skipped.  sf and
+	 * channel_map need not be set.
+	 */
+	int (*probe)(struct input_plugin_data *ip_data);
 };
 
 struct input_plugin_opt {
@@ -30,10 +30,14 @@
 #include <math.h>
 
 struct cue_private {
+	/* NULL if probed, see child_info */
 	struct input_plugin *child;
+	struct cue_child_info child_info;
 
 	char *cue_filename;
 	int track_n;
+	/* from cue_cache_get() */
+	struct cue_sheet *cd;
 
 	double start_offset;
 	double current_offset;
@@ -82,7 +86,7 @@ static char *_make_absolute_path(const char *abs_filename, const char *rel_filen
 }
 
 
-static int cue_open(struct input_plugin_data *ip_data)
+static int do_cue_open(struct input_plugin_data *ip_data, int probe)
 {
 	int rc;
 	char *child_filename;
@@ -90,7 +94,7 @@ static int cue_open(struct input_plugin_data *ip_data)
 	struct cue_track *t;
 	struct cue_private *priv;
 
-	priv = xnew(struct cue_private, 1);
+	priv = xnew0(struct cue_private, 1);
 
 	rc = _parse_cue_url(ip_data->filename, &priv->cue_filename, &priv->track_n);
 	if (rc) {
@@ -98,7 +102,7 @@ static int cue_open(struct input_plugin_data *ip_data)
 		goto url_parse_failed;
 	}
 
-	cd = cue_from_file(priv->cue_filename);
+	cd = cue_cache_get(priv->cue_filename);
 	if (cd == NULL) {
 		rc = -IP_ERROR_FILE_FORMAT;
 		goto cue_parse_failed;
@@ -111,6 +115,26 @@ static int cue_open(struct input_plugin_data *ip_data)
 	}
 
 	child_filename = _make_absolute_path(priv->cue_filename, cd->file);
+
+	priv->start_offset = t->offset;
+	priv->current_offset = t->offset;
+
+	if (probe) {
+		/* all tracks of the sheet share one probe of the child */
+		rc = cue_cache_child_info(cd, child_filename, &priv->child_info);
+		free(child_filename);
+		if (rc)
+			goto cue_read_failed;
+		if (t->length >= 0)
+			priv->end_offset = priv->start_offset + t->length;
+		else
+			priv->end_offset = priv->child_info.duration;
+
+		priv->cd = cd;
+		ip_data->private = priv;
+		return 0;
+	}
+
 	priv->child = ip_new(child_filename);
 	free(child_filename);
 
@@ -120,9 +144,6 @@ static int cue_open(struct input_plugin_data *ip_data)
 
 	ip_setup(priv->child);
 
-	priv->start_offset = t->offset;
-	priv->current_offset = t->offset;
-
 	rc = ip_seek(priv->child, priv->start_offset);
 	if (rc)
 		goto ip_open_failed;
@@ -136,18 +157,18 @@ static int cue_open(struct input_plugin_data *ip_data)
 	if (ip_data->fd == -1)
 		goto ip_open_failed;
 
+	priv->cd = cd;
 	ip_data->private = priv;
 	ip_data->sf = ip_get_sf(priv->child);
 	ip_get_channel_map(priv->child, ip_data->channel_map);
 
-	cue_free(cd);
 	return 0;
 
 ip_open_failed:
 	ip_delete(priv->child);
 
 cue_read_failed:
-	cue_free(cd);
+	cue_cache_put(cd);
 
 cue_parse_failed:
 	free(priv->cue_filename);
@@ -159,14 +180,31 @@ url_parse_failed:
 }
 
 
+static int cue_open(struct input_plugin_data *ip_data)
+{
+	return do_cue_open(ip_data, 0);
+}
+
+
+static int cue_probe(struct input_plugin_data *ip_data)
+{
+	return do_cue_open(ip_data, 1);
+}
+
+
 static int cue_close(struct input_plugin_data *ip_data)
 {
 	struct cue_private *priv = ip_data->private;
 
-	close(ip_data->fd);
+	if (ip_data->fd != -1)
+		close(ip_data->fd);
 	ip_data->fd = -1;
 
-	ip_delete(priv->child);
+	if (priv->child)
+		ip_delete(priv->child);
+	free(priv->child_info.codec);
+	free(priv->child_info.codec_profile);
+	cue_cache_put(priv->cd);
 	free(priv->cue_filename);
 
 	free(priv);
@@ -221,22 +259,14 @@ static int cue_seek(struct input_plugin_data *ip_data, double offset)
 static int cue_read_comments(struct input_plugin_data *ip_data, struct keyval **comments)
 {
 	struct cue_private *priv = ip_data->private;
-	struct cue_sheet *cd = cue_from_file(priv->cue_filename);
+	struct cue_sheet *cd = priv->cd;
 	struct cue_track *t;
-	int rc;
 	char buf[32] = { 0 };
 	GROWING_KEYVALS(c);
 
-	if (cd == NULL) {
-		rc = -IP_ERROR_FILE_FORMAT;
-		goto cue_parse_failed;
-	}
-
 	t = cue_get_track(cd, priv->track_n);
-	if (!t) {
-		rc = -IP_ERROR_FILE_FORMAT;
-		goto get_track_failed;
-	}
+	if (!t)
+		return -IP_ERROR_FILE_FORMAT;
 
 	snprintf(buf, sizeof buf, "%d", priv->track_n);
 	comments_add_const(&c, "tracknumber", buf);
@@ -267,14 +297,7 @@ static int cue_read_comments(struct input_plugin_data *ip_data, struct keyval **
 	keyvals_terminate(&c);
 	*comments = c.keyvals;
 
-	cue_free(cd);
 	return 0;
-
-get_track_failed:
-	cue_free(cd);
-
-cue_parse_failed:
-	return rc;
 }
 
 
@@ -290,6 +313,8 @@ static long cue_bitrate(struct input_plugin_data *ip_data)
 {
 	struct cue_private *priv = ip_data->private;
 
+	if (!priv->child)
+		return priv->child_info.bitrate;
 	return ip_bitrate(priv->child);
 }
 
@@ -306,6 +331,8 @@ static char *cue_codec(struct input_plugin_data *ip_data)
 {
 	struct cue_private *priv = ip_data->private;
 
+	if (!priv->child)
+		return priv->child_info.codec ? xstrdup(priv->child_info.codec) : NULL;
 	return ip_codec(priv->child);
 }
 
@@ -314,6 +341,8 @@ static char *cue_codec_profile(struct input_plugin_data *ip_data)
 {
 	struct cue_private *priv = ip_data->private;
 
+	if (!priv->child)
+		return priv->child_info.codec_profile ? xstrdup(priv->child_info.codec_profile) : NULL;
 	return ip_codec_profile(priv->child);
 }
 
@@ -329,6 +358,7 @@ const struct input_plugin_ops ip_ops = {
 	.bitrate_current = cue_current_bitrate,
 	.codec           = cue_codec,
 	.codec_profile   = cue_codec_profile,
+	.probe           = cue_probe,
 };
 
 const int ip_priority = 50;
@@ -135,7 +135,7 @@ static void ffmpeg_init(void)
 #endif
 }
 
-static int ffmpeg_open(struct input_plugin_data *ip_data)
+static int do_ffmpeg_open(struct input_plugin_data *ip_data, int probe)
 {
 	struct ffmpeg_private *priv;
 	int err = 0;
@@ -202,6 +202,10 @@ static int ffmpeg_open(struct input_plugin_data *ip_data)
 			break;
 		}
 
+		/* the format and codec parameters are all that is needed */
+		if (probe)
+			break;
+
 		if (codec->capabilities & AV_CODEC_CAP_TRUNCATED)
 			cc->flags |= AV_CODEC_FLAG_TRUNCATED;
 
@@ -223,10 +227,16 @@ static int ffmpeg_open(struct input_plugin_data *ip_data)
 		return err;
 	}
 
-	priv = xnew(struct ffmpeg_private, 1);
+	priv = xnew0(struct ffmpeg_private, 1);
 	priv->codec_context = cc;
 	priv->input_context = ic;
 	priv->codec = codec;
+	if (probe) {
+		/* no decoder, resampler or buffers */
+		ip_data->private = priv;
+		return 0;
+	}
+
 	priv->input = ffmpeg_input_create();
 	if (priv->input == NULL) {
 		avcodec_close(cc);
@@ -273,6 +283,16 @@ static int ffmpeg_open(struct input_plugin_data *ip_data)
 	return 0;
 }
 
+static int ffmpeg_open(struct input_plugin_data *ip_data)
+{
+	return do_ffmpeg_open(ip_data, 0);
+}
+
+static int ffmpeg_probe(struct input_plugin_data *ip_data)
+{
+	return do_ffmpeg_open(ip_data, 1);
+}
+
 static int ffmpeg_close(struct input_plugin_data *ip_data)
 {
 	struct ffmpeg_private *priv = ip_data->private;
@@ -283,8 +303,10 @@ static int ffmpeg_close(struct input_plugin_data *ip_data)
 #endif
 	avformat_close_input(&priv->input_context);
 	swr_free(&priv->swr);
-	ffmpeg_input_free(priv->input);
-	ffmpeg_output_free(priv->output);
+	if (priv->input)
+		ffmpeg_input_free(priv->input);
+	if (priv->output)
+		ffmpeg_output_free(priv->output);
 	free(priv);
 	ip_data->private = NULL;
 	return 0;
@@ -512,7 +534,8 @@ const struct input_plugin_ops ip_ops = {
 	.bitrate = ffmpeg_bitrate,
 	.bitrate_current = ffmpeg_current_bitrate,
 	.codec = ffmpeg_codec,
-	.codec_profile = ffmpeg_codec_profile
+	.codec_profile = ffmpeg_codec_profile,
+	.probe = ffmpeg_probe
 };
 
 const int ip_priority = 30;
@@ -286,7 +286,7 @@ static void channel_map_init_flac(int channels, channel_position_t *map)
 	channel_map_init_waveex(channels, mask, map);
 }
 
-static int flac_open(struct input_plugin_data *ip_data)
+static int do_flac_open(struct input_plugin_data *ip_data, int probe)
 {
 	struct flac_private *priv;
 
@@ -321,7 +321,12 @@ static int flac_open(struct input_plugin_data *ip_data)
 	}
 	ip_data->private = priv;
 
-	FLAC__stream_decoder_set_metadata_respond_all(dec);
+	if (probe) {
+		/* STREAMINFO is always passed, skip pictures etc. */
+		F(set_metadata_respond)(dec, FLAC__METADATA_TYPE_VORBIS_COMMENT);
+	} else {
+		FLAC__stream_decoder_set_metadata_respond_all(dec);
+	}
 	if (FLAC__stream_decoder_init_stream(dec, read_cb, seek_cb, tell_cb,
 				length_cb, eof_cb, write_cb, metadata_cb,
 				error_cb, ip_data) != E(INIT_STATUS_OK)) {
@@ -350,6 +355,9 @@ static int flac_open(struct input_plugin_data *ip_data)
 		return -IP_ERROR_SAMPLE_FORMAT;
 	}
 
+	if (probe)
+		return 0;
+
 	channel_map_init_flac(sf_get_channels(ip_data->sf), ip_data->channel_map);
 	d_print("sr: %d, ch: %d, bits: %d\n",
 			sf_get_rate(ip_data->sf),
@@ -358,6 +366,16 @@ static int flac_open(struct input_plugin_data *ip_data)
 	return 0;
 }
 
+static int flac_open(struct input_plugin_data *ip_data)
+{
+	return do_flac_open(ip_data, 0);
+}
+
+static int flac_probe(struct input_plugin_data *ip_data)
+{
+	return do_flac_open(ip_data, 1);
+}
+
 static int flac_close(struct input_plugin_data *ip_data)
 {
 	free_priv(ip_data);
@@ -462,7 +480,8 @@ const struct input_plugin_ops ip_ops = {
 	.bitrate = flac_bitrate,
 	.bitrate_current = flac_bitrate,
 	.codec = flac_codec,
-	.codec_profile = flac_codec_profile
+	.codec_profile = flac_codec_profile,
+	.probe = flac_probe
 };
 
 const int ip_priority = 50;
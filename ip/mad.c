@@ -66,7 +66,7 @@ static struct nomad_callbacks callbacks = {
 
 /* ------------------------------------------------------------------------- */
 
-static int mad_open(struct input_plugin_data *ip_data)
+static int do_mad_open(struct input_plugin_data *ip_data, int probe)
 {
 	struct nomad *nomad;
 	const struct nomad_info *info;
@@ -81,6 +81,10 @@ static int mad_open(struct input_plugin_data *ip_data)
 	}
 	ip_data->private = nomad;
 
+	/* opened for playback, seeking is likely */
+	if (!probe && !ip_data->remote)
+		nomad_load_seek_index(nomad, ip_data->filename);
+
 	info = nomad_info(nomad);
 
 	/* always 16-bit signed little-endian */
@@ -90,6 +94,16 @@ static int mad_open(struct input_plugin_data *ip_data)
 	return 0;
 }
 
+static int mad_open(struct input_plugin_data *ip_data)
+{
+	return do_mad_open(ip_data, 0);
+}
+
+static int mad_probe(struct input_plugin_data *ip_data)
+{
+	return do_mad_open(ip_data, 1);
+}
+
 static int mad_close(struct input_plugin_data *ip_data)
 {
 	struct nomad *nomad;
@@ -272,7 +286,8 @@ const struct input_plugin_ops ip_ops = {
 	.bitrate = mad_bitrate,
 	.bitrate_current = mad_current_bitrate,
 	.codec = mad_codec,
-	.codec_profile = mad_codec_profile
+	.codec_profile = mad_codec_profile,
+	.probe = mad_probe,
 };
 
 const int ip_priority = 55;
@@ -30,17 +30,33 @@
 #include "../xmalloc.h"
 #include "../debug.h"
 #include "../misc.h"
+#include "../file.h"
+#include "../utils.h"
+#include "../xstrjoin.h"
+#include "../locking.h"
 
 #include <mad.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
 #include <math.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/mman.h>
 
 #define INPUT_BUFFER_SIZE	(5 * 8192)
 #define SEEK_IDX_INTERVAL	15
+/* shorter files are sought fast enough without a complete seek index */
+#define SEEK_IDX_BUILD_MIN	(10 * 60)
+/* least recently used index files are removed above this */
+#define SEEK_IDX_MAX_FILES	200
 
 /* the number of samples of silence the decoder inserts at start */
 #define DECODERDELAY		529
@@ -53,6 +69,8 @@ struct seek_idx_entry {
 	mad_timer_t timer;
 };
 
+struct seek_idx_builder;
+
 struct nomad {
 	struct mad_stream stream;
 	struct mad_frame frame;
@@ -79,6 +97,10 @@ struct nomad {
 	struct {
 		int size;
 		struct seek_idx_entry *table;
+		/* covers the whole file, nothing to add while decoding */
+		unsigned int complete : 1;
+		/* building the complete table in the background */
+		struct seek_idx_builder *builder;
 	} seek_idx;
 
 	struct {
@@ -379,7 +401,7 @@ static void build_seek_index(struct nomad *nomad)
 
 	mad_timer_add(&nomad->timer, nomad->frame.header.duration);
 
-	if (nomad->has_xing)
+	if (nomad->has_xing || nomad->seek_idx.complete)
 		return;
 
 	if (nomad->timer.seconds < (nomad->seek_idx.size + 1) * SEEK_IDX_INTERVAL)
@@ -596,6 +618,387 @@ eof:
 	return -NOMAD_ERROR_FILE_FORMAT;
 }
 
+/*
+ * Complete seek index
+ *
+ * Without a Xing header the seek index only reaches as far as the file has
+ * been decoded, so seeking forward in a long VBR file has to scan all frame
+ * headers up to the target.  For long files a thread scans the whole file
+ * once with its own fd and the table is saved to
+ * $CMUS_HOME/seek_index/, keyed by filename, mtime and size.  Loading an
+ * index touches its file so that saving can drop the least recently used
+ * ones once there are more than SEEK_IDX_MAX_FILES.
+ */
+
+struct seek_idx_builder {
+	pthread_t thread;
+	atomic_int cancel;
+
+	char *filename;
+	time_t mtime;
+	off_t filesize;
+
+	pthread_mutex_t mutex;
+	/* set by the thread, table is NULL if it failed */
+	int done;
+	int size;
+	struct seek_idx_entry *table;
+};
+
+static const char seek_idx_magic[8] = "CSI\0\0\0\0\2";
+
+struct seek_idx_file_header {
+	char magic[8];
+	int64_t mtime;
+	int64_t filesize;
+	uint32_t size;
+	uint32_t filename_len;
+	/* of the records, a damaged file is rebuilt instead of misleading seeks */
+	uint64_t checksum;
+};
+
+struct seek_idx_record {
+	int64_t offset;
+	int64_t seconds;
+	uint64_t fraction;
+};
+
+#define FNV1A_INIT 0xcbf29ce484222325ULL
+
+/* 64-bit FNV-1a */
+static uint64_t fnv1a(uint64_t h, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+
+	while (len--) {
+		h ^= *p++;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+/* the stored filename is still checked on load */
+static char *seek_idx_path(const char *filename)
+{
+	uint64_t h = fnv1a(FNV1A_INIT, filename, strlen(filename));
+	char name[24];
+
+	snprintf(name, sizeof(name), "/%016llx", (unsigned long long)h);
+	return xstrjoin(cmus_config_dir, "/seek_index", name);
+}
+
+static int seek_idx_load(struct nomad *nomad, const char *filename,
+		time_t mtime, off_t filesize)
+{
+	struct seek_idx_file_header h;
+	struct seek_idx_record *records;
+	char *path = seek_idx_path(filename);
+	ssize_t len;
+	size_t rest;
+	uint32_t i;
+	char *buf;
+
+	buf = mmap_file(path, &len);
+	if (len == -1) {
+		free(path);
+		return -1;
+	}
+	if ((size_t)len < sizeof(h))
+		goto fail;
+
+	memcpy(&h, buf, sizeof(h));
+	rest = len - sizeof(h);
+	if (memcmp(h.magic, seek_idx_magic, sizeof(h.magic)) ||
+			h.mtime != mtime || h.filesize != filesize || !h.size ||
+			h.filename_len != strlen(filename) || h.filename_len > rest ||
+			memcmp(buf + sizeof(h), filename, h.filename_len))
+		goto fail;
+	/* truncated or written by another version */
+	rest -= h.filename_len;
+	if (rest % sizeof(*records) || rest / sizeof(*records) != h.size)
+		goto fail;
+
+	records = (struct seek_idx_record *)(buf + sizeof(h) + h.filename_len);
+	if (fnv1a(FNV1A_INIT, records, rest) != h.checksum)
+		goto fail;
+	free(nomad->seek_idx.table);
+	nomad->seek_idx.table = xnew(struct seek_idx_entry, h.size);
+	for (i = 0; i < h.size; i++) {
+		struct seek_idx_record r;
+
+		/* not aligned after the filename */
+		memcpy(&r, &records[i], sizeof(r));
+		nomad->seek_idx.table[i].offset = r.offset;
+		nomad->seek_idx.table[i].timer.seconds = r.seconds;
+		nomad->seek_idx.table[i].timer.fraction = r.fraction;
+	}
+	nomad->seek_idx.size = h.size;
+	nomad->seek_idx.complete = 1;
+	munmap(buf, len);
+	/* recently used, see seek_idx_prune() */
+	utimes(path, NULL);
+	free(path);
+	return 0;
+fail:
+	if (buf)
+		munmap(buf, len);
+	free(path);
+	return -1;
+}
+
+struct seek_idx_file {
+	time_t mtime;
+	char *name;
+};
+
+static int seek_idx_file_cmp(const void *a, const void *b)
+{
+	const struct seek_idx_file *fa = a;
+	const struct seek_idx_file *fb = b;
+
+	if (fa->mtime != fb->mtime)
+		return fa->mtime < fb->mtime ? 1 : -1;
+	return strcmp(fa->name, fb->name);
+}
+
+/* keeps the SEEK_IDX_MAX_FILES most recently used files in @dir */
+static void seek_idx_prune(const char *dir)
+{
+	struct seek_idx_file *files = NULL;
+	int nr = 0, alloc = 0, i;
+	struct dirent *d;
+	DIR *dh;
+
+	dh = opendir(dir);
+	if (!dh)
+		return;
+	while ((d = readdir(dh))) {
+		struct stat st;
+		char *path;
+
+		if (d->d_name[0] == '.')
+			continue;
+		path = xstrjoin(dir, "/", d->d_name);
+		if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+			if (nr == alloc) {
+				alloc = alloc ? alloc * 2 : 64;
+				files = xrenew(struct seek_idx_file, files, alloc);
+			}
+			files[nr].mtime = st.st_mtime;
+			files[nr].name = path;
+			nr++;
+		} else {
+			free(path);
+		}
+	}
+	closedir(dh);
+
+	if (nr > SEEK_IDX_MAX_FILES) {
+		qsort(files, nr, sizeof(*files), seek_idx_file_cmp);
+		for (i = SEEK_IDX_MAX_FILES; i < nr; i++)
+			unlink(files[i].name);
+	}
+	for (i = 0; i < nr; i++)
+		free(files[i].name);
+	free(files);
+}
+
+static void seek_idx_save(struct seek_idx_builder *b)
+{
+	struct seek_idx_file_header h;
+	struct seek_idx_record *records = NULL;
+	char *dir = xstrjoin(cmus_config_dir, "/seek_index");
+	char *path = seek_idx_path(b->filename);
+	/* unique, another instance may be saving the same file */
+	char *tmp = xstrjoin(path, ".XXXXXX");
+	int fd, i, rc = 0;
+
+	if (mkdir(dir, 0700) == -1 && errno != EEXIST)
+		goto out;
+	fd = mkstemp(tmp);
+	if (fd == -1)
+		goto out;
+
+	records = xnew0(struct seek_idx_record, b->size);
+	for (i = 0; i < b->size; i++) {
+		records[i].offset = b->table[i].offset;
+		records[i].seconds = b->table[i].timer.seconds;
+		records[i].fraction = b->table[i].timer.fraction;
+	}
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, seek_idx_magic, sizeof(h.magic));
+	h.mtime = b->mtime;
+	h.filesize = b->filesize;
+	h.size = b->size;
+	h.filename_len = strlen(b->filename);
+	h.checksum = fnv1a(FNV1A_INIT, records, b->size * sizeof(*records));
+	if (write_all(fd, &h, sizeof(h)) < 0 ||
+			write_all(fd, b->filename, h.filename_len) < 0 ||
+			write_all(fd, records, b->size * sizeof(*records)) < 0)
+		rc = -1;
+	close(fd);
+
+	if (rc || rename(tmp, path) == -1) {
+		d_print("error saving seek index %s: %s\n", path, strerror(errno));
+		unlink(tmp);
+	} else {
+		seek_idx_prune(dir);
+	}
+out:
+	free(records);
+	free(dir);
+	free(path);
+	free(tmp);
+}
+
+static ssize_t fd_read(void *datasource, void *buffer, size_t count)
+{
+	return read(*(int *)datasource, buffer, count);
+}
+
+static off_t fd_lseek(void *datasource, off_t offset, int whence)
+{
+	return lseek(*(int *)datasource, offset, whence);
+}
+
+static int fd_close(void *datasource)
+{
+	return close(*(int *)datasource);
+}
+
+/* scans all frame headers like nomad_time_seek() does */
+static void *seek_idx_build(void *arg)
+{
+	struct seek_idx_builder *b = arg;
+	struct nomad *scan;
+	int fd, rc = 0;
+
+	fd = open(b->filename, O_RDONLY);
+	if (fd == -1)
+		goto done;
+
+	scan = xnew0(struct nomad, 1);
+	scan->datasource = &fd;
+	scan->cbs.read = fd_read;
+	scan->cbs.lseek = fd_lseek;
+	scan->cbs.close = fd_close;
+	scan->info.filesize = b->filesize;
+	init_mad(scan);
+
+	while (!atomic_load(&b->cancel)) {
+		rc = fill_buffer(scan);
+		if (rc <= 0)
+			break;
+
+		if (mad_header_decode(&scan->frame.header, &scan->stream)) {
+			if (scan->stream.error == MAD_ERROR_BUFLEN)
+				continue;
+			if (!MAD_RECOVERABLE(scan->stream.error)) {
+				rc = -1;
+				break;
+			}
+			if (scan->stream.error == MAD_ERROR_LOSTSYNC)
+				handle_lost_sync(scan);
+			continue;
+		}
+		build_seek_index(scan);
+	}
+
+	if (rc == 0 && !atomic_load(&b->cancel)) {
+		d_print("built seek index for %s, %d entries\n", b->filename,
+				scan->seek_idx.size);
+		b->table = scan->seek_idx.table;
+		b->size = scan->seek_idx.size;
+		seek_idx_save(b);
+	} else {
+		free(scan->seek_idx.table);
+	}
+	free_mad(scan);
+	scan->cbs.close(scan->datasource);
+	free(scan);
+done:
+	cmus_mutex_lock(&b->mutex);
+	b->done = 1;
+	cmus_mutex_unlock(&b->mutex);
+	return NULL;
+}
+
+static void seek_idx_builder_free(struct seek_idx_builder *b)
+{
+	pthread_join(b->thread, NULL);
+	pthread_mutex_destroy(&b->mutex);
+	free(b->table);
+	free(b->filename);
+	free(b);
+}
+
+/* takes the complete table if the builder is done */
+static void seek_idx_poll(struct nomad *nomad)
+{
+	struct seek_idx_builder *b = nomad->seek_idx.builder;
+	int done;
+
+	if (!b)
+		return;
+	cmus_mutex_lock(&b->mutex);
+	done = b->done;
+	cmus_mutex_unlock(&b->mutex);
+	if (!done)
+		return;
+
+	if (b->table) {
+		free(nomad->seek_idx.table);
+		nomad->seek_idx.table = b->table;
+		nomad->seek_idx.size = b->size;
+		nomad->seek_idx.complete = 1;
+		b->table = NULL;
+	}
+	seek_idx_builder_free(b);
+	nomad->seek_idx.builder = NULL;
+}
+
+static void seek_idx_stop(struct nomad *nomad)
+{
+	struct seek_idx_builder *b = nomad->seek_idx.builder;
+
+	if (!b)
+		return;
+	atomic_store(&b->cancel, 1);
+	seek_idx_builder_free(b);
+	nomad->seek_idx.builder = NULL;
+}
+
+void nomad_load_seek_index(struct nomad *nomad, const char *filename)
+{
+	struct seek_idx_builder *b;
+	struct stat st;
+
+	if (nomad->has_xing || nomad->info.filesize == -1 ||
+			nomad->info.duration < SEEK_IDX_BUILD_MIN ||
+			nomad->seek_idx.complete || nomad->seek_idx.builder)
+		return;
+	if (stat(filename, &st) == -1 || st.st_size != nomad->info.filesize)
+		return;
+	if (seek_idx_load(nomad, filename, st.st_mtime, st.st_size) == 0)
+		return;
+
+	b = xnew0(struct seek_idx_builder, 1);
+	b->filename = xstrdup(filename);
+	b->mtime = st.st_mtime;
+	b->filesize = st.st_size;
+	atomic_init(&b->cancel, 0);
+	pthread_mutex_init(&b->mutex, NULL);
+	if (pthread_create(&b->thread, NULL, seek_idx_build, b)) {
+		d_print("error creating seek index thread: %s\n", strerror(errno));
+		pthread_mutex_destroy(&b->mutex);
+		free(b->filename);
+		free(b);
+		return;
+	}
+	nomad->seek_idx.builder = b;
+}
+
 int nomad_open_callbacks(struct nomad **nomadp, void *datasource, struct nomad_callbacks *cbs)
 {
 	struct nomad *nomad;
@@ -619,6 +1022,7 @@ int nomad_open_callbacks(struct nomad **nomadp, void *datasource, struct nomad_c
 
 void nomad_close(struct nomad *nomad)
 {
+	seek_idx_stop(nomad);
 	free_mad(nomad);
 	nomad->cbs.close(nomad->datasource);
 	free(nomad->seek_idx.table);
@@ -778,6 +1182,7 @@ int nomad_time_seek(struct nomad *nomad, double pos)
 		errno = ESPIPE;
 		return -1;
 	}
+	seek_idx_poll(nomad);
 	free_mad(nomad);
 	init_mad(nomad);
 
@@ -89,6 +89,12 @@ int nomad_open_callbacks(struct nomad **nomadp, void *datasource,
 
 void nomad_close(struct nomad *nomad);
 
+/*
+ * loads the complete seek index of @filename or starts building it in the
+ * background.  does nothing for short files and files with a Xing header
+ */
+void nomad_load_seek_index(struct nomad *nomad, const char *filename);
+
 /* -NOMAD_ERROR_ERRNO */
 int nomad_read(struct nomad *nomad, char *buffer, int count);
 
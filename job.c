@@ -36,6 +36,8 @@
 #include "xstrjoin.h"
 #include "ui_curses.h"
 #include "cue_utils.h"
+#include "pool.h"
+#include "watch.h"
 
 #include <string.h>
 #include <unistd.h>
@@ -47,6 +49,8 @@ enum job_result_var {
 	JOB_RES_UPDATE,
 	JOB_RES_UPDATE_CACHE,
 	JOB_RES_PL_DELETE,
+	JOB_RES_FILTER,
+	JOB_RES_RESCAN,
 };
 
 enum update_kind {
@@ -79,6 +83,8 @@ struct job_result {
 			void (*pl_delete_cb)(struct playlist *);
 			struct playlist *pl_delete_pl;
 		};
+		struct filter_data *filter_data;
+		char *rescan_dir;
 	};
 };
 
@@ -93,20 +99,55 @@ static struct track_info **ti_buffer;
 static size_t ti_buffer_fill;
 static struct add_data *jd;
 
+/* files of the current add job waiting to be read on the scan pool */
+#define SCAN_BATCH_PER_THREAD 16
+static struct cache_req *scan_buffer;
+static size_t scan_buffer_fill;
+static size_t scan_buffer_cap;
+
 #define job_lock() cmus_mutex_lock(&job_mutex)
 #define job_unlock() cmus_mutex_unlock(&job_mutex)
 
+/*
+ * Filter jobs have their own thread so they don't queue behind the adds and
+ * updates of the worker.  Only the latest job is kept, scheduling another
+ * one replaces it.
+ */
+static pthread_t filter_thread;
+static pthread_mutex_t filter_mutex = CMUS_MUTEX_INITIALIZER;
+static pthread_cond_t filter_cond = CMUS_COND_INITIALIZER;
+static struct filter_data *filter_pending;
+static struct filter_data *filter_running;
+static volatile int filter_cancel;
+static int filter_stop;
+
+#define filter_lock() cmus_mutex_lock(&filter_mutex)
+#define filter_unlock() cmus_mutex_unlock(&filter_mutex)
+
+static void *filter_loop(void *arg);
+
 void job_init(void)
 {
+	int rc;
+
 	init_pipes(&job_fd, &job_fd_priv);
 
 	worker_init();
+	rc = pthread_create(&filter_thread, NULL, filter_loop, NULL);
+	BUG_ON(rc);
 }
 
 void job_exit(void)
 {
 	worker_remove_jobs_by_type(JOB_TYPE_ANY);
 	worker_exit();
+	job_cancel_filter();
+	filter_lock();
+	filter_stop = 1;
+	pthread_cond_broadcast(&filter_cond);
+	filter_unlock();
+	pthread_join(filter_thread, NULL);
+	pool_exit();
 
 	close(job_fd);
 	close(job_fd_priv);
@@ -161,26 +202,54 @@ static void add_ti(struct track_info *ti)
 	ti_buffer[ti_buffer_fill++] = ti;
 }
 
+static void flush_scan_buffer(void)
+{
+	size_t i;
+
+	cache_get_tis(scan_buffer, scan_buffer_fill, worker_cancelling);
+
+	/* results are delivered in the order the files were added */
+	for (i = 0; i < scan_buffer_fill; i++) {
+		if (scan_buffer[i].ti)
+			add_ti(scan_buffer[i].ti);
+		free((char *)scan_buffer[i].filename);
+	}
+	scan_buffer_fill = 0;
+}
+
 static int add_file_cue(const char *filename);
 
-static void add_file(const char *filename, int force)
+static int is_cached(const char *filename)
 {
 	struct track_info *ti;
 
+	cache_lock();
+	ti = lookup_cache_entry(filename, hash_str(filename));
+	cache_unlock();
+	return ti != NULL;
+}
+
+static void queue_file(const char *filename, int force)
+{
+	struct cache_req *req;
+
+	if (scan_buffer_fill == scan_buffer_cap)
+		flush_scan_buffer();
+	req = &scan_buffer[scan_buffer_fill++];
+	req->filename = xstrdup(filename);
+	req->force = force;
+}
+
+static void add_file(const char *filename, int force)
+{
 	if (!is_cue_url(filename)) {
-		if (force || lookup_cache_entry(filename, hash_str(filename)) == NULL) {
+		if (force || !is_cached(filename)) {
 			int done = add_file_cue(filename);
 			if (done)
 				return;
 		}
 	}
-
-	cache_lock();
-	ti = cache_get_ti(filename, force);
-	cache_unlock();
-
-	if (ti)
-		add_ti(ti);
+	queue_file(filename, force);
 }
 
 static int add_file_cue(const char *filename)
@@ -267,37 +336,62 @@ static int points_within_and_visible(const char *target, const char *root)
 	return 1;
 }
 
-static void add_dir(const char *dirname, const char *root)
+static int is_cue_name(const char *name)
 {
-	struct directory dir;
-	struct dir_entry **ents;
+	const char *ext = get_extension(name);
+
+	return ext && strcmp(ext, "cue") == 0;
+}
+
+/*
+ * Reads the entries of @dir, or takes them from the cache if the
+ * directory has not changed since the last time.  Directories containing
+ * symlinks are always read, their targets may have changed.
+ */
+static void read_dir(struct directory *dir, const char *root, struct ptr_array *array,
+		int *has_cue)
+{
+	char *path = xstrndup(dir->path, dir->len - 1);
 	const char *name;
-	PTR_ARRAY(array);
-	int i;
+	struct stat st;
+	int has_stat, has_link = 0;
 
-	if (dir_open(&dir, dirname)) {
-		d_print("error: opening %s: %s\n", dirname, strerror(errno));
-		return;
+	has_stat = !fstat(dir_fd(dir), &st);
+	if (has_stat) {
+		int found;
+
+		cache_lock();
+		found = cache_get_dir(path, &st, array, has_cue);
+		cache_unlock();
+		if (found) {
+			free(path);
+			return;
+		}
 	}
-	while ((name = dir_read(&dir))) {
+
+	while ((name = dir_read_mode(dir))) {
 		struct dir_entry *ent;
 		int size;
 
+		if (is_cue_name(name))
+			*has_cue = 1;
+
 		if (name[0] == '.')
 			continue;
 
-		if (dir.is_link) {
+		if (dir->is_link) {
 			char buf[1024];
 			char *target;
-			int rc = readlink(dir.path, buf, sizeof(buf));
+			int rc = readlinkat(dir_fd(dir), name, buf, sizeof(buf));
 
+			has_link = 1;
 			if (rc < 0 || rc == sizeof(buf))
 				continue;
 			buf[rc] = 0;
-			target = path_absolute_cwd(buf, dirname);
+			target = path_absolute_cwd(buf, path);
 			if (points_within_and_visible(target, root)) {
 				d_print("%s -> %s points within %s. ignoring\n",
-						dir.path, target, root);
+						dir->path, target, root);
 				free(target);
 				continue;
 			}
@@ -306,11 +400,31 @@ static void add_dir(const char *dirname, const char *root)
 
 		size = strlen(name) + 1;
 		ent = xmalloc(sizeof(struct dir_entry) + size);
-		ent->mode = dir.st.st_mode;
+		ent->mode = dir->st.st_mode;
 		memcpy(ent->name, name, size);
-		ptr_array_add(&array, ent);
+		ptr_array_add(array, ent);
 	}
-	dir_close(&dir);
+
+	if (has_stat && !has_link) {
+		cache_lock();
+		cache_set_dir(path, &st, array, *has_cue);
+		cache_unlock();
+	}
+	free(path);
+}
+
+/*
+ * @dir is kept open while walking its subdirectories so that they can be
+ * opened relative to it
+ */
+static void walk_dir(struct directory *dir, const char *root)
+{
+	struct dir_entry **ents;
+	PTR_ARRAY(array);
+	int has_cue = 0;
+	int i;
+
+	read_dir(dir, root, &array, &has_cue);
 
 	if (jd->add == play_queue_prepend) {
 		ptr_array_sort(&array, dir_entry_cmp_reverse);
@@ -320,17 +434,30 @@ static void add_dir(const char *dirname, const char *root)
 	ents = array.ptrs;
 	for (i = 0; i < array.count; i++) {
 		if (!worker_cancelling()) {
-			/* abuse dir.path because
+			/* abuse dir->path because
 			 *  - it already contains dirname + '/'
 			 *  - it is guaranteed to be large enough
 			 */
 			int len = strlen(ents[i]->name);
 
-			memcpy(dir.path + dir.len, ents[i]->name, len + 1);
+			memcpy(dir->path + dir->len, ents[i]->name, len + 1);
 			if (S_ISDIR(ents[i]->mode)) {
-				add_dir(dir.path, root);
+				struct directory sub;
+
+				if (dir_openat(&sub, dir, ents[i]->name)) {
+					d_print("error: opening %s: %s\n", dir->path, strerror(errno));
+				} else {
+					walk_dir(&sub, root);
+					dir_close(&sub);
+				}
+			} else if (is_cached(dir->path)) {
+				queue_file(dir->path, 0);
 			} else {
-				add_file(dir.path, 0);
+				/* associated_cue() would only find nothing */
+				if (has_cue)
+					add_file(dir->path, 0);
+				else
+					queue_file(dir->path, 0);
 			}
 		}
 		free(ents[i]);
@@ -338,6 +465,18 @@ static void add_dir(const char *dirname, const char *root)
 	free(ents);
 }
 
+static void add_dir(const char *dirname, const char *root)
+{
+	struct directory dir;
+
+	if (dir_open(&dir, dirname)) {
+		d_print("error: opening %s: %s\n", dirname, strerror(errno));
+		return;
+	}
+	walk_dir(&dir, root);
+	dir_close(&dir);
+}
+
 static int handle_line(void *data, const char *line)
 {
 	if (worker_cancelling())
@@ -375,9 +514,27 @@ static void add_pl(const char *filename)
 	}
 }
 
-static void do_add_job(void *data)
+static void add_job_begin(struct add_data *data)
 {
 	jd = data;
+	scan_buffer_cap = max_i(TI_CAP, SCAN_BATCH_PER_THREAD * pool_nr_threads());
+	scan_buffer = xnew(struct cache_req, scan_buffer_cap);
+}
+
+static void add_job_end(void)
+{
+	flush_scan_buffer();
+	free(scan_buffer);
+	scan_buffer = NULL;
+	if (ti_buffer)
+		flush_ti_buffer();
+	cue_cache_clear();
+	jd = NULL;
+}
+
+static void do_add_job(void *data)
+{
+	add_job_begin(data);
 	switch (jd->type) {
 	case FILE_TYPE_URL:
 		add_url(jd->name);
@@ -397,9 +554,7 @@ static void do_add_job(void *data)
 	case FILE_TYPE_INVALID:
 		break;
 	}
-	if (ti_buffer)
-		flush_ti_buffer();
-	jd = NULL;
+	add_job_end();
 }
 
 static void free_add_job(void *data)
@@ -424,30 +579,73 @@ void job_schedule_add(int type, struct add_data *data)
 	worker_add_job(type | JOB_TYPE_ADD, do_add_job, free_add_job, data);
 }
 
+static void do_add_files_job(void *data)
+{
+	struct add_files_data *d = data;
+	struct add_data ad = {
+		.type = FILE_TYPE_FILE,
+		.add = d->add,
+	};
+	size_t i;
+
+	add_job_begin(&ad);
+	for (i = 0; i < d->nr && !worker_cancelling(); i++)
+		add_file(d->names[i], 0);
+	add_job_end();
+}
+
+static void free_add_files_job(void *data)
+{
+	struct add_files_data *d = data;
+	size_t i;
+
+	for (i = 0; i < d->nr; i++)
+		free(d->names[i]);
+	free(d->names);
+	free(d);
+}
+
+void job_schedule_add_files(int type, struct add_files_data *data)
+{
+	worker_add_job(type | JOB_TYPE_ADD, do_add_files_job,
+			free_add_files_job, data);
+}
+
+struct update_stat_data {
+	struct update_data *d;
+	enum update_kind *kind;
+};
+
+static void update_stat(int i, void *opaque)
+{
+	struct update_stat_data *usd = opaque;
+	struct update_data *d = usd->d;
+	enum update_kind *kind = usd->kind;
+	struct track_info *ti = d->ti[i];
+	struct stat s;
+	int rc;
+
+	rc = stat(ti->filename, &s);
+	if (rc || d->force || ti->mtime != s.st_mtime || ti->duration == 0) {
+		kind[i] = UPDATE_NONE;
+		if (!is_cue_url(ti->filename) && !is_http_url(ti->filename) && rc)
+			kind[i] |= UPDATE_REMOVE;
+		else if (ti->mtime != s.st_mtime)
+			kind[i] |= UPDATE_MTIME_CHANGED;
+	} else {
+		track_info_unref(ti);
+		d->ti[i] = NULL;
+	}
+}
+
 static void do_update_job(void *data)
 {
 	struct update_data *d = data;
-	int i;
 	enum update_kind *kind = xnew(enum update_kind, d->used);
+	struct update_stat_data usd = { d, kind };
 	struct job_result *res;
 
-	for (i = 0; i < d->used; i++) {
-		struct track_info *ti = d->ti[i];
-		struct stat s;
-		int rc;
-
-		rc = stat(ti->filename, &s);
-		if (rc || d->force || ti->mtime != s.st_mtime || ti->duration == 0) {
-			kind[i] = UPDATE_NONE;
-			if (!is_cue_url(ti->filename) && !is_http_url(ti->filename) && rc)
-				kind[i] |= UPDATE_REMOVE;
-			else if (ti->mtime != s.st_mtime)
-				kind[i] |= UPDATE_MTIME_CHANGED;
-		} else {
-			track_info_unref(ti);
-			d->ti[i] = NULL;
-		}
-	}
+	pool_run(d->used, update_stat, &usd);
 
 	res = xnew(struct job_result, 1);
 
@@ -521,6 +719,7 @@ static void do_update_cache_job(void *data)
 	cache_lock();
 	tis = cache_refresh(&count, d->force);
 	cache_unlock();
+	cue_cache_clear();
 
 	res = xnew(struct job_result, 1);
 	res->var = JOB_RES_UPDATE_CACHE;
@@ -598,6 +797,233 @@ void job_schedule_pl_delete(struct pl_delete_data *data)
 			free_pl_delete_job, data);
 }
 
+/* tracks per pool_run() task */
+#define FILTER_CHUNK 1024
+
+static int filter_track_cmp(const void *a, const void *b)
+{
+	uintptr_t x = (uintptr_t)((const struct filter_track *)a)->ti;
+	uintptr_t y = (uintptr_t)((const struct filter_track *)b)->ti;
+
+	return (x > y) - (x < y);
+}
+
+static void filter_chunk(int i, void *opaque)
+{
+	struct filter_data *d = opaque;
+	size_t j = (size_t)i * FILTER_CHUNK;
+	size_t end = min_u(j + FILTER_CHUNK, d->nr);
+
+	if (filter_cancel)
+		return;
+	for (; j < end; j++) {
+		struct filter_track *e = &d->entries[j];
+
+		if (e->pass < 0)
+			e->pass = d->filter_cb(e->ti);
+	}
+}
+
+static void do_filter_job(struct filter_data *d)
+{
+	int i, n = (d->nr + FILTER_CHUNK - 1) / FILTER_CHUNK;
+
+	/* lets done_cb look up tracks with bsearch() */
+	qsort(d->entries, d->nr, sizeof(d->entries[0]), filter_track_cmp);
+
+	/*
+	 * the pool is busy while an add job reads files, evaluate a chunk at
+	 * a time here until it is free.  the pool skips evaluated entries
+	 */
+	for (i = 0; i < n; i++) {
+		if (pool_try_run(n, filter_chunk, d) == 0)
+			break;
+		filter_chunk(i, d);
+	}
+}
+
+struct filter_track *filter_data_find(struct filter_data *d, struct track_info *ti)
+{
+	struct filter_track key = { ti, 0 };
+
+	return bsearch(&key, d->entries, d->nr, sizeof(key), filter_track_cmp);
+}
+
+void filter_data_free(struct filter_data *d)
+{
+	size_t i;
+
+	for (i = 0; i < d->nr; i++)
+		track_info_unref(d->entries[i].ti);
+	free(d->entries);
+	free(d);
+}
+
+static void *filter_loop(void *arg)
+{
+	filter_lock();
+	while (!filter_stop) {
+		struct filter_data *d = filter_pending;
+		struct job_result *res;
+
+		if (!d) {
+			pthread_cond_wait(&filter_cond, &filter_mutex);
+			continue;
+		}
+		filter_pending = NULL;
+		filter_running = d;
+		filter_unlock();
+
+		do_filter_job(d);
+
+		filter_lock();
+		filter_running = NULL;
+		if (filter_cancel) {
+			filter_cancel = 0;
+			filter_data_free(d);
+		} else {
+			/* nothing touches @d after this, the main thread owns it now */
+			res = xnew(struct job_result, 1);
+			res->var = JOB_RES_FILTER;
+			res->filter_data = d;
+			job_push_result(res);
+		}
+		/* wake up job_cancel_filter() */
+		pthread_cond_broadcast(&filter_cond);
+	}
+	filter_unlock();
+	return NULL;
+}
+
+static void job_handle_filter_result(struct job_result *res)
+{
+	struct filter_data *d = res->filter_data;
+
+	d->done_cb(d);
+}
+
+void job_schedule_filter(struct filter_data *data)
+{
+	filter_lock();
+	if (filter_pending)
+		filter_data_free(filter_pending);
+	filter_pending = data;
+	pthread_cond_broadcast(&filter_cond);
+	filter_unlock();
+}
+
+void job_cancel_filter(void)
+{
+	filter_lock();
+	if (filter_pending) {
+		filter_data_free(filter_pending);
+		filter_pending = NULL;
+	}
+	if (filter_running) {
+		filter_cancel = 1;
+		while (filter_running)
+			pthread_cond_wait(&filter_cond, &filter_mutex);
+	}
+	filter_unlock();
+}
+
+/* returns -1 if watching should stop */
+static int watch_tree(struct directory *dir)
+{
+	const char *name;
+	int rc;
+
+	/* without the trailing slash */
+	dir->path[dir->len - 1] = 0;
+	rc = watch_add_dir(dir->path);
+	dir->path[dir->len - 1] = '/';
+	if (rc)
+		return rc;
+
+	while ((name = dir_read_mode(dir))) {
+		struct directory sub;
+
+		if (worker_cancelling())
+			return -1;
+		if (name[0] == '.' || dir->is_link || !S_ISDIR(dir->st.st_mode))
+			continue;
+		if (dir_openat(&sub, dir, name))
+			continue;
+		rc = watch_tree(&sub);
+		dir_close(&sub);
+		if (rc)
+			return rc;
+	}
+	return 0;
+}
+
+static void do_watch_job(void *data)
+{
+	struct watch_data *d = data;
+	struct directory dir;
+
+	if (dir_open(&dir, d->dir)) {
+		d_print("error: opening %s: %s\n", d->dir, strerror(errno));
+		return;
+	}
+	watch_tree(&dir);
+	dir_close(&dir);
+}
+
+static void free_watch_job(void *data)
+{
+	struct watch_data *d = data;
+
+	free(d->dir);
+	free(d);
+}
+
+void job_schedule_watch(struct watch_data *data)
+{
+	worker_add_job(JOB_TYPE_LIB | JOB_TYPE_WATCH, do_watch_job,
+			free_watch_job, data);
+}
+
+/* nothing to do but to wait for the jobs before it */
+static void do_rescan_job(void *data)
+{
+	struct watch_data *d = data;
+	struct job_result *res;
+
+	res = xnew(struct job_result, 1);
+	res->var = JOB_RES_RESCAN;
+	res->rescan_dir = d->dir;
+	d->dir = NULL;
+	job_push_result(res);
+}
+
+static void job_handle_rescan_result(struct job_result *res)
+{
+	watch_rescan(res->rescan_dir);
+	free(res->rescan_dir);
+}
+
+void job_schedule_rescan(struct watch_data *data)
+{
+	worker_add_job(JOB_TYPE_LIB | JOB_TYPE_WATCH, do_rescan_job,
+			free_watch_job, data);
+}
+
+static void do_cache_compact_job(void *data)
+{
+	cache_compact(worker_cancelling);
+}
+
+static void free_cache_compact_job(void *data)
+{
+}
+
+void job_schedule_cache_compact(void)
+{
+	worker_add_job(JOB_TYPE_COMPACT, do_cache_compact_job,
+			free_cache_compact_job, NULL);
+}
+
 static void job_handle_result(struct job_result *res)
 {
 	switch (res->var) {
@@ -613,15 +1039,56 @@ static void job_handle_result(struct job_result *res)
 	case JOB_RES_PL_DELETE:
 		job_handle_pl_delete_result(res);
 		break;
+	case JOB_RES_FILTER:
+		job_handle_filter_result(res);
+		break;
+	case JOB_RES_RESCAN:
+		job_handle_rescan_result(res);
+		break;
 	}
 	free(res);
 }
 
+/* tracks of queued library add results, added in one go */
+static struct track_info **lib_add_ti;
+static size_t lib_add_num;
+static size_t lib_add_alloc;
+
+static void collect_lib_add_result(struct job_result *res)
+{
+	if (lib_add_num + res->add_num > lib_add_alloc) {
+		lib_add_alloc = lib_add_alloc * 2 + res->add_num;
+		lib_add_ti = xrenew(struct track_info *, lib_add_ti, lib_add_alloc);
+	}
+	memcpy(lib_add_ti + lib_add_num, res->add_ti, res->add_num * sizeof(lib_add_ti[0]));
+	lib_add_num += res->add_num;
+	free(res->add_ti);
+	free(res);
+}
+
+static void flush_lib_add_results(void)
+{
+	size_t i;
+
+	lib_add_tracks(lib_add_ti, lib_add_num);
+	for (i = 0; i < lib_add_num; i++)
+		track_info_unref(lib_add_ti[i]);
+	lib_add_num = 0;
+}
+
 void job_handle(void)
 {
 	clear_pipe(job_fd, -1);
 
 	struct job_result *res;
-	while ((res = job_pop_result()))
+	while ((res = job_pop_result())) {
+		if (res->var == JOB_RES_ADD && res->add_cb == lib_add_track) {
+			collect_lib_add_result(res);
+			continue;
+		}
+		/* keep the order of results */
+		flush_lib_add_results();
 		job_handle_result(res);
+	}
+	flush_lib_add_results();
 }
@@ -29,6 +29,8 @@
 #define JOB_TYPE_UPDATE       1 << 17
 #define JOB_TYPE_UPDATE_CACHE 1 << 18
 #define JOB_TYPE_DELETE       1 << 19
+#define JOB_TYPE_COMPACT      1 << 20
+#define JOB_TYPE_WATCH        1 << 21
 
 struct add_data {
 	enum file_type type;
@@ -38,6 +40,12 @@ struct add_data {
 	unsigned int force : 1;
 };
 
+struct add_files_data {
+	add_ti_cb add;
+	size_t nr;
+	char **names;
+};
+
 struct update_data {
 	size_t size;
 	size_t used;
@@ -49,19 +57,57 @@ struct update_cache_data {
 	unsigned int force : 1;
 };
 
+struct watch_data {
+	char *dir;
+};
+
 struct pl_delete_data {
 	struct playlist *pl;
 	void (*cb)(struct playlist *);
 };
 
+struct filter_track {
+	struct track_info *ti;
+	/* result of filter_cb, -1 until evaluated */
+	int pass;
+	/* 0, for done_cb to use */
+	int shown;
+};
+
+struct filter_data {
+	/* referenced tracks, the job sorts them by address */
+	size_t nr;
+	struct filter_track *entries;
+	/* called in the filter and pool threads */
+	int (*filter_cb)(struct track_info *ti);
+	/*
+	 * called in the main thread once all entries have been evaluated,
+	 * frees @data with filter_data_free()
+	 */
+	void (*done_cb)(struct filter_data *data);
+};
+
 extern int job_fd;
 
 void job_init(void);
 void job_exit(void);
 void job_schedule_add(int type, struct add_data *data);
+void job_schedule_add_files(int type, struct add_files_data *data);
 void job_schedule_update(struct update_data *data);
 void job_schedule_update_cache(int type, struct update_cache_data *data);
 void job_schedule_pl_delete(struct pl_delete_data *data);
+/* evaluates @data->entries in the background, replaces a job not started yet */
+void job_schedule_filter(struct filter_data *data);
+/* drops the scheduled filter job and waits for a running one to stop */
+void job_cancel_filter(void);
+/* for done_cb, returns NULL if @ti is not in @data */
+struct filter_track *filter_data_find(struct filter_data *data, struct track_info *ti);
+void filter_data_free(struct filter_data *data);
+void job_schedule_cache_compact(void);
+/* adds inotify watches for @data->dir and its subdirectories */
+void job_schedule_watch(struct watch_data *data);
+/* calls watch_rescan() for @data->dir after the jobs queued before it */
+void job_schedule_rescan(struct watch_data *data);
 void job_handle(void);
 
 #endif
@@ -22,6 +22,9 @@
 #include "options.h"
 #include "xmalloc.h"
 #include "rbtree.h"
+#include "ti_hash.h"
+#include "ti_index.h"
+#include "job.h"
 #include "debug.h"
 #include "utils.h"
 #include "ui_curses.h" /* cur_view */
@@ -44,6 +47,15 @@ static struct expr *add_filter = NULL;
 static int remove_from_hash = 1;
 
 static struct expr *live_filter_expr = NULL;
+/* evaluating live_filter_expr or lib_live_filter in the background */
+static struct filter_data *live_filter_job = NULL;
+/* its result, applied a chunk at a time by lib_filter_step() */
+static struct filter_data *live_filter_result = NULL;
+static int live_filter_job_clear_before;
+/* next lib_editable track to check or &lib_editable.head, then next entry to add */
+static struct list_head *apply_pos;
+static size_t apply_idx;
+static unsigned int apply_order;
 static struct track_info *cur_track_ti = NULL;
 static struct track_info *sel_track_ti = NULL;
 
@@ -77,7 +89,7 @@ static void shuffle_add(struct tree_track *track)
 	shuffle_list_add(&track->shuffle_track, &lib_shuffle_root);
 }
 
-static void views_add_track(struct track_info *ti)
+static struct tree_track *views_new_track(struct track_info *ti)
 {
 	struct tree_track *track = xnew(struct tree_track, 1);
 
@@ -88,77 +100,97 @@ static void views_add_track(struct track_info *ti)
 	track_info_ref(ti);
 
 	tree_add_track(track);
+	return track;
+}
+
+static void views_add_track(struct track_info *ti)
+{
+	struct tree_track *track = views_new_track(ti);
+
 	shuffle_add(track);
 	editable_add(&lib_editable, (struct simple_track *)track);
 }
 
-struct fh_entry {
-	struct fh_entry *next;
+/*
+ * Merging rebuilds the sorted view and the shuffle tree, so it only pays off
+ * if the batch is not small compared to the library, e.g. while loading.
+ */
+#define BULK_ADD_MIN 64
 
-	/* ref count is increased when added to this hash */
-	struct track_info *ti;
-};
+static void views_add_tracks(struct track_info **tis, size_t nr)
+{
+	struct simple_track **tracks;
+	struct shuffle_track **shuffle_tracks;
+	size_t i;
+
+	if (nr < BULK_ADD_MIN || nr * 4 < lib_editable.nr_tracks) {
+		for (i = 0; i < nr; i++)
+			views_add_track(tis[i]);
+		return;
+	}
+
+	tracks = xnew(struct simple_track *, nr);
+	shuffle_tracks = xnew(struct shuffle_track *, nr);
+	for (i = 0; i < nr; i++) {
+		struct tree_track *track = views_new_track(tis[i]);
+
+		tracks[i] = (struct simple_track *)track;
+		shuffle_tracks[i] = &track->shuffle_track;
+	}
+	shuffle_list_add_tracks(shuffle_tracks, nr, &lib_shuffle_root);
+	editable_add_tracks(&lib_editable, tracks, nr);
+	free(shuffle_tracks);
+	free(tracks);
+}
 
-#define FH_SIZE (1024)
-static struct fh_entry *ti_hash[FH_SIZE] = { NULL, };
+/* ref count is increased when added to this hash */
+static struct ti_hash lib_hash = TI_HASH_INIT;
 
 static int hash_insert(struct track_info *ti)
 {
-	const char *filename = ti->filename;
-	unsigned int pos = hash_str(filename) % FH_SIZE;
-	struct fh_entry **entryp;
-	struct fh_entry *e;
+	uint32_t hash = hash_str(ti->filename);
 
-	entryp = &ti_hash[pos];
-	e = *entryp;
-	while (e) {
-		if (strcmp(e->ti->filename, filename) == 0) {
-			/* found, don't insert */
-			return 0;
-		}
-		e = e->next;
+	if (ti_hash_lookup(&lib_hash, ti->filename, hash)) {
+		/* found, don't insert */
+		return 0;
 	}
 
-	e = xnew(struct fh_entry, 1);
 	track_info_ref(ti);
-	e->ti = ti;
-	e->next = *entryp;
-	*entryp = e;
+	ti_hash_insert(&lib_hash, ti, hash);
+	ti_index_add(ti);
 	return 1;
 }
 
 static void hash_remove(struct track_info *ti)
 {
-	const char *filename = ti->filename;
-	unsigned int pos = hash_str(filename) % FH_SIZE;
-	struct fh_entry **entryp;
-
-	entryp = &ti_hash[pos];
-	while (1) {
-		struct fh_entry *e = *entryp;
+	int removed = ti_hash_remove(&lib_hash, ti, hash_str(ti->filename));
 
-		BUG_ON(e == NULL);
-		if (strcmp(e->ti->filename, filename) == 0) {
-			*entryp = e->next;
-			track_info_unref(e->ti);
-			free(e);
-			break;
-		}
-		entryp = &e->next;
-	}
+	BUG_ON(!removed);
+	ti_index_remove(ti);
+	track_info_unref(ti);
 }
 
-static int is_filtered(struct track_info *ti)
+static int do_is_filtered(struct track_info *ti, int indexed)
 {
 	if (live_filter_expr && !expr_eval(live_filter_expr, ti))
 		return 1;
-	if (!live_filter_expr && lib_live_filter && !track_info_matches(ti, lib_live_filter, TI_MATCH_ALL))
-		return 1;
+	if (!live_filter_expr && lib_live_filter) {
+		if (indexed && !track_info_matches(ti, lib_live_filter, TI_MATCH_ALL))
+			return 1;
+		if (!indexed && !track_info_matches_unindexed(ti, lib_live_filter,
+					TI_MATCH_ALL, 0, 1))
+			return 1;
+	}
 	if (filter && !expr_eval(filter, ti))
 		return 1;
 	return 0;
 }
 
+static int is_filtered(struct track_info *ti)
+{
+	return do_is_filtered(ti, 1);
+}
+
 void lib_add_track(struct track_info *ti, void *opaque)
 {
 	if (add_filter && !expr_eval(add_filter, ti)) {
@@ -175,6 +207,25 @@ void lib_add_track(struct track_info *ti, void *opaque)
 		views_add_track(ti);
 }
 
+void lib_add_tracks(struct track_info **tis, size_t nr)
+{
+	struct track_info **visible = xnew(struct track_info *, nr);
+	size_t i, nr_visible = 0;
+
+	for (i = 0; i < nr; i++) {
+		struct track_info *ti = tis[i];
+
+		if (add_filter && !expr_eval(add_filter, ti))
+			continue;
+		if (!hash_insert(ti))
+			continue;
+		if (!is_filtered(ti))
+			visible[nr_visible++] = ti;
+	}
+	views_add_tracks(visible, nr_visible);
+	free(visible);
+}
+
 static struct tree_track *album_first_track(const struct album *album)
 {
 	return to_tree_track(rb_first(&album->track_root));
@@ -319,6 +370,10 @@ static void free_lib_track(struct editable *e, struct list_head *item)
 	if (track == lib_cur_track)
 		lib_cur_track = NULL;
 
+	/* @item is unlinked already, start over */
+	if (live_filter_result && item == apply_pos)
+		apply_pos = lib_editable.head.next;
+
 	if (remove_from_hash)
 		hash_remove(ti);
 
@@ -354,7 +409,7 @@ struct track_info *lib_set_track(struct tree_track *track)
 	return ti;
 }
 
-struct track_info *lib_goto_next(void)
+static struct tree_track *lib_get_next(int peek)
 {
 	struct tree_track *track;
 
@@ -362,7 +417,10 @@ struct track_info *lib_goto_next(void)
 		BUG_ON(lib_cur_track != NULL);
 		return NULL;
 	}
-	if (shuffle) {
+	if (shuffle && peek) {
+		track = (struct tree_track *)shuffle_list_peek_next(&lib_shuffle_root,
+				(struct shuffle_track *)lib_cur_track, aaa_mode_filter);
+	} else if (shuffle) {
 		track = (struct tree_track *)shuffle_list_get_next(&lib_shuffle_root,
 				(struct shuffle_track *)lib_cur_track, aaa_mode_filter);
 	} else if (play_sorted) {
@@ -371,7 +429,24 @@ struct track_info *lib_goto_next(void)
 	} else {
 		track = normal_get_next();
 	}
-	return lib_set_track(track);
+	return track;
+}
+
+struct track_info *lib_goto_next(void)
+{
+	return lib_set_track(lib_get_next(0));
+}
+
+struct track_info *lib_peek_next(void)
+{
+	struct tree_track *track = lib_get_next(1);
+	struct track_info *ti;
+
+	if (!track)
+		return NULL;
+	ti = tree_track_info(track);
+	track_info_ref(ti);
+	return ti;
 }
 
 struct track_info *lib_goto_prev(void)
@@ -412,19 +487,18 @@ struct track_info *sorted_activate_selected(void)
 
 static void hash_add_to_views(void)
 {
-	int i;
-	for (i = 0; i < FH_SIZE; i++) {
-		struct fh_entry *e;
+	struct track_info *ti;
+	unsigned int pos = 0;
 
-		e = ti_hash[i];
-		while (e) {
-			struct track_info *ti = e->ti;
+	struct track_info **tis = xnew(struct track_info *, lib_hash.count + 1);
+	size_t nr = 0;
 
-			if (!is_filtered(ti))
-				views_add_track(ti);
-			e = e->next;
-		}
+	while ((ti = ti_hash_next(&lib_hash, &pos))) {
+		if (!is_filtered(ti))
+			tis[nr++] = ti;
 	}
+	views_add_tracks(tis, nr);
+	free(tis);
 }
 
 struct tree_track *lib_find_track(struct track_info *ti)
@@ -467,6 +541,18 @@ static int is_filtered_cb(void *data, struct track_info *ti)
 	return is_filtered(ti);
 }
 
+static void lib_filter_done(void)
+{
+	window_changed(lib_editable.shared->win);
+	window_goto_top(lib_editable.shared->win);
+	lib_cur_win = lib_tree_win;
+	window_goto_top(lib_tree_win);
+
+	/* restore cur_track */
+	if (cur_track_ti && !lib_cur_track)
+		restore_cur_track(cur_track_ti);
+}
+
 static void do_lib_filter(int clear_before)
 {
 	/* try to save cur_track */
@@ -484,27 +570,42 @@ static void do_lib_filter(int clear_before)
 		editable_remove_matching_tracks(&lib_editable, is_filtered_cb, NULL);
 	remove_from_hash = 1;
 
-	window_changed(lib_editable.shared->win);
-	window_goto_top(lib_editable.shared->win);
-	lib_cur_win = lib_tree_win;
-	window_goto_top(lib_tree_win);
-
-	/* restore cur_track */
-	if (cur_track_ti && !lib_cur_track)
-		restore_cur_track(cur_track_ti);
+	lib_filter_done();
 }
 
 static void unset_live_filter(void)
 {
 	free(lib_live_filter);
 	lib_live_filter = NULL;
-	free(live_filter_expr);
+	if (live_filter_expr)
+		expr_free(live_filter_expr);
 	live_filter_expr = NULL;
 }
 
+/*
+ * the job reads the filters, stop it before changing them.  returns 1 if
+ * its filter was not applied completely
+ */
+static int cancel_live_filter_job(void)
+{
+	if (live_filter_job) {
+		job_cancel_filter();
+		/* a finished job's result may still be queued, done_cb frees it */
+		live_filter_job = NULL;
+		return 1;
+	}
+	if (live_filter_result) {
+		filter_data_free(live_filter_result);
+		live_filter_result = NULL;
+		return 1;
+	}
+	return 0;
+}
+
 void lib_set_filter(struct expr *expr)
 {
 	int clear_before = lib_live_filter || filter;
+	cancel_live_filter_job();
 	unset_live_filter();
 	if (filter)
 		expr_free(filter);
@@ -549,6 +650,9 @@ static void store_sel_track(void)
 {
 	struct tree_track *tt = get_sel_track();
 	if (tt) {
+		/* not restored yet */
+		if (sel_track_ti)
+			track_info_unref(sel_track_ti);
 		sel_track_ti = tree_track_info(tt);
 		track_info_ref(sel_track_ti);
 	}
@@ -580,6 +684,158 @@ static int do_clear_before(const char *str, struct expr *expr)
 	return 1;
 }
 
+static void live_filter_applied(void)
+{
+	if (live_filter_expr) {
+		unsigned int match_type = expr_get_match_type(live_filter_expr);
+		if (match_type & TI_MATCH_ALBUM)
+			tree_expand_all();
+		if (match_type & TI_MATCH_TITLE)
+			tree_sel_first();
+	} else if (lib_live_filter)
+		tree_expand_matching(lib_live_filter);
+
+	if (!lib_live_filter)
+		restore_sel_track();
+}
+
+/* filter and pool threads, the live filter can't change while the job runs */
+static int live_filter_job_cb(struct track_info *ti)
+{
+	return !do_is_filtered(ti, 0);
+}
+
+static void live_filter_job_done(struct filter_data *d)
+{
+	if (d != live_filter_job) {
+		filter_data_free(d);
+		return;
+	}
+	live_filter_job = NULL;
+	live_filter_result = d;
+
+	/* try to save cur_track */
+	if (lib_cur_track)
+		lib_store_cur_track(tree_track_info(lib_cur_track));
+	apply_pos = lib_editable.head.next;
+	apply_order = lib_editable.order_generation;
+	apply_idx = 0;
+}
+
+/*
+ * Evaluating a live filter over a big library takes long enough to make
+ * typing lag, so it is done by a job.  Its result is applied a chunk per
+ * main loop iteration: first the tracks in the views are checked and the
+ * rejected ones removed, then if the filter could have grown the passing
+ * tracks that were not seen are added.  Tracks added in the meantime are
+ * filtered as usual.
+ */
+#define LIVE_FILTER_JOB_MIN 2048
+#define LIVE_FILTER_APPLY_CHUNK 1024
+
+int lib_filter_step(void)
+{
+	struct filter_data *d = live_filter_result;
+	struct track_info *tis[LIVE_FILTER_APPLY_CHUNK];
+	size_t nr = 0, n = 0;
+
+	if (!d)
+		return 0;
+
+	if (apply_pos != &lib_editable.head) {
+		/* checked tracks pass again, marking them shown is harmless */
+		if (apply_order != lib_editable.order_generation) {
+			apply_order = lib_editable.order_generation;
+			apply_pos = lib_editable.head.next;
+		}
+
+		remove_from_hash = 0;
+		while (apply_pos != &lib_editable.head && n < LIVE_FILTER_APPLY_CHUNK) {
+			struct simple_track *t = to_simple_track(apply_pos);
+			struct filter_track *e = filter_data_find(d, t->info);
+
+			apply_pos = apply_pos->next;
+			n++;
+			if (e && e->pass)
+				e->shown = 1;
+			else if (e || is_filtered(t->info))
+				editable_remove_track(&lib_editable, t);
+		}
+		remove_from_hash = 1;
+		if (n == LIVE_FILTER_APPLY_CHUNK)
+			return 1;
+	}
+
+	if (live_filter_job_clear_before) {
+		while (apply_idx < d->nr && n < LIVE_FILTER_APPLY_CHUNK) {
+			struct filter_track *e = &d->entries[apply_idx++];
+
+			n++;
+			/* not removed from the library since the job was scheduled */
+			if (e->pass && !e->shown && lib_lookup(e->ti->filename) == e->ti)
+				tis[nr++] = e->ti;
+		}
+		views_add_tracks(tis, nr);
+		if (apply_idx < d->nr)
+			return 1;
+	}
+
+	live_filter_result = NULL;
+	filter_data_free(d);
+	lib_filter_done();
+	live_filter_applied();
+	return 0;
+}
+
+static void filter_track_init(struct filter_track *e, struct track_info *ti)
+{
+	track_info_ref(ti);
+	e->ti = ti;
+	e->pass = -1;
+	e->shown = 0;
+}
+
+/* returns 0 if there are too few tracks to evaluate for a job to pay off */
+static int schedule_live_filter_job(int clear_before)
+{
+	struct filter_data *d;
+	struct track_info **tis = NULL;
+	size_t i, nr = lib_hash.count;
+
+	/*
+	 * only tracks that have the words of a text filter can pass, the
+	 * others are not in the job and rejected by ti_index when it's done
+	 */
+	if (!live_filter_expr && lib_live_filter) {
+		tis = ti_index_candidates(lib_live_filter, 1, &nr);
+		if (nr < LIVE_FILTER_JOB_MIN) {
+			free(tis);
+			return 0;
+		}
+	}
+
+	d = xnew(struct filter_data, 1);
+	d->nr = 0;
+	d->entries = xnew(struct filter_track, nr + 1);
+	if (tis) {
+		for (i = 0; i < nr; i++)
+			filter_track_init(&d->entries[d->nr++], tis[i]);
+		free(tis);
+	} else {
+		struct track_info *ti;
+		unsigned int pos = 0;
+
+		while ((ti = ti_hash_next(&lib_hash, &pos)))
+			filter_track_init(&d->entries[d->nr++], ti);
+	}
+	d->filter_cb = live_filter_job_cb;
+	d->done_cb = live_filter_job_done;
+	live_filter_job = d;
+	live_filter_job_clear_before = clear_before;
+	job_schedule_filter(d);
+	return 1;
+}
+
 void lib_set_live_filter(const char *str)
 {
 	int clear_before;
@@ -599,22 +855,19 @@ void lib_set_live_filter(const char *str)
 	if (!str)
 		store_sel_track();
 
+	/* a superseded filter was never applied, the views still show an older one */
+	if (cancel_live_filter_job())
+		clear_before |= live_filter_job_clear_before;
+
 	unset_live_filter();
 	lib_live_filter = str ? xstrdup(str) : NULL;
 	live_filter_expr = expr;
-	do_lib_filter(clear_before);
 
-	if (expr) {
-		unsigned int match_type = expr_get_match_type(expr);
-		if (match_type & TI_MATCH_ALBUM)
-			tree_expand_all();
-		if (match_type & TI_MATCH_TITLE)
-			tree_sel_first();
-	} else if (str)
-		tree_expand_matching(str);
-
-	if (!str)
-		restore_sel_track();
+	if (lib_hash.count >= LIVE_FILTER_JOB_MIN &&
+			schedule_live_filter_job(clear_before))
+		return;
+	do_lib_filter(clear_before);
+	live_filter_applied();
 }
 
 int lib_remove(struct track_info *ti)
@@ -630,22 +883,21 @@ int lib_remove(struct track_info *ti)
 	return 0;
 }
 
-void lib_clear_store(void)
+struct track_info *lib_lookup(const char *filename)
 {
-	int i;
+	return ti_hash_lookup(&lib_hash, filename, hash_str(filename));
+}
 
-	for (i = 0; i < FH_SIZE; i++) {
-		struct fh_entry *e, *next;
+void lib_clear_store(void)
+{
+	struct track_info *ti;
+	unsigned int pos = 0;
 
-		e = ti_hash[i];
-		while (e) {
-			next = e->next;
-			track_info_unref(e->ti);
-			free(e);
-			e = next;
-		}
-		ti_hash[i] = NULL;
-	}
+	cancel_live_filter_job();
+	ti_index_clear();
+	while ((ti = ti_hash_next(&lib_hash, &pos)))
+		track_info_unref(ti);
+	ti_hash_free(&lib_hash);
 }
 
 void sorted_sel_current(void)
@@ -668,25 +920,16 @@ static int ti_cmp(const void *a, const void *b)
 
 static int do_lib_for_each(int (*cb)(void *data, struct track_info *ti), void *data, int filtered)
 {
-	int i, rc = 0, count = 0, size = 1024;
-	struct track_info **tis;
+	int i, rc = 0, count = 0;
+	unsigned int pos = 0;
+	struct track_info **tis, *ti;
 
-	tis = xnew(struct track_info *, size);
+	tis = xnew(struct track_info *, lib_hash.count);
 
 	/* collect all track_infos */
-	for (i = 0; i < FH_SIZE; i++) {
-		struct fh_entry *e;
-
-		e = ti_hash[i];
-		while (e) {
-			if (count == size) {
-				size *= 2;
-				tis = xrenew(struct track_info *, tis, size);
-			}
-			if (!filtered || !filter || expr_eval(filter, e->ti))
-				tis[count++] = e->ti;
-			e = e->next;
-		}
+	while ((ti = ti_hash_next(&lib_hash, &pos))) {
+		if (!filtered || !filter || expr_eval(filter, ti))
+			tis[count++] = ti;
 	}
 
 	/* sort to speed up playlist loading */
@@ -53,10 +53,11 @@ struct album {
 	struct rb_root track_root;
 
 	struct artist *artist;
-	char *name;
-	char *sort_name;
-	char *collkey_name;
-	char *collkey_sort_name;
+	/* interned, see intern.h */
+	const char *name;
+	const char *sort_name;
+	const char *collkey_name;
+	const char *collkey_sort_name;
 	/* max date of the tracks added to this album */
 	int date;
 	/* min date of the tracks added to this album */
@@ -70,12 +71,13 @@ struct artist {
 	/* root of album tree */
 	struct rb_root album_root;
 
-	char *name;
-	char *sort_name;
-	char *auto_sort_name;
-	char *collkey_name;
-	char *collkey_sort_name;
-	char *collkey_auto_sort_name;
+	/* interned, see intern.h */
+	const char *name;
+	const char *sort_name;
+	const char *auto_sort_name;
+	const char *collkey_name;
+	const char *collkey_sort_name;
+	const char *collkey_auto_sort_name;
 
 	/* albums visible for this artist in the tree_win? */
 	unsigned int expanded : 1;
@@ -109,12 +111,20 @@ extern struct rb_root lib_artist_root;
 void lib_init(void);
 void tree_init(void);
 struct track_info *lib_goto_next(void);
+/* track lib_goto_next() would return without making it current, new reference */
+struct track_info *lib_peek_next(void);
 struct track_info *lib_goto_prev(void);
 void lib_add_track(struct track_info *track_info, void *opaque);
+/* like lib_add_track() for many tracks, faster for large batches */
+void lib_add_tracks(struct track_info **tis, size_t nr);
 void lib_set_filter(struct expr *expr);
 void lib_set_live_filter(const char *str);
+/* applies part of a finished live filter job, returns 1 if there is more to do */
+int lib_filter_step(void);
 void lib_set_add_filter(struct expr *expr);
 int lib_remove(struct track_info *ti);
+/* returns the track in the library with @filename or NULL, not referenced */
+struct track_info *lib_lookup(const char *filename);
 void lib_clear_store(void);
 void lib_reshuffle(void);
 void lib_set_view(int view);
@@ -24,6 +24,7 @@
 #include <unistd.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 
 int dir_open(struct directory *dir, const char *name)
 {
@@ -45,12 +46,43 @@ int dir_open(struct directory *dir, const char *name)
 	return 0;
 }
 
+int dir_openat(struct directory *dir, struct directory *parent, const char *name)
+{
+	int nlen = strlen(name);
+	int len = parent->len + nlen;
+	int fd;
+
+	if (len >= sizeof(dir->path) - 2) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	fd = openat(dir_fd(parent), name, O_RDONLY | O_DIRECTORY);
+	if (fd == -1)
+		return -1;
+	dir->d = fdopendir(fd);
+	if (!dir->d) {
+		int save = errno;
+
+		close(fd);
+		errno = save;
+		return -1;
+	}
+
+	memcpy(dir->path, parent->path, parent->len);
+	memcpy(dir->path + parent->len, name, nlen);
+	dir->path[len++] = '/';
+	dir->path[len] = 0;
+	dir->len = len;
+	return 0;
+}
+
 void dir_close(struct directory *dir)
 {
 	closedir(dir->d);
 }
 
-const char *dir_read(struct directory *dir)
+static const char *do_dir_read(struct directory *dir, int need_stat)
 {
 	DIR *d = dir->d;
 	int len = dir->len;
@@ -76,13 +108,19 @@ const char *dir_read(struct directory *dir)
 			continue;
 
 		memcpy(full + len, name, nlen + 1);
-		if (lstat(full, &dir->st))
+		dir->is_link = 0;
+#ifdef DT_UNKNOWN
+		if (!need_stat && (de->d_type == DT_REG || de->d_type == DT_DIR)) {
+			dir->st.st_mode = de->d_type == DT_DIR ? S_IFDIR : S_IFREG;
+			return full + len;
+		}
+#endif
+		if (fstatat(dirfd(d), name, &dir->st, AT_SYMLINK_NOFOLLOW))
 			continue;
 
-		dir->is_link = 0;
 		if (S_ISLNK(dir->st.st_mode)) {
 			/* argh. must stat the target */
-			if (stat(full, &dir->st))
+			if (fstatat(dirfd(d), name, &dir->st, 0))
 				continue;
 			dir->is_link = 1;
 		}
@@ -92,6 +130,16 @@ const char *dir_read(struct directory *dir)
 	return NULL;
 }
 
+const char *dir_read(struct directory *dir)
+{
+	return do_dir_read(dir, 1);
+}
+
+const char *dir_read_mode(struct directory *dir)
+{
+	return do_dir_read(dir, 0);
+}
+
 void ptr_array_add(struct ptr_array *array, void *ptr)
 {
 	void **ptrs = array->ptrs;
@@ -34,8 +34,19 @@ struct directory {
 };
 
 int dir_open(struct directory *dir, const char *name);
+/* opens @name in @parent without resolving the whole path again */
+int dir_openat(struct directory *dir, struct directory *parent, const char *name);
 void dir_close(struct directory *dir);
 const char *dir_read(struct directory *dir);
+/*
+ * like dir_read() but only st.st_mode is valid.  it is taken from the
+ * directory entry if possible to avoid stat()ing every file
+ */
+const char *dir_read_mode(struct directory *dir);
+static inline int dir_fd(struct directory *dir)
+{
+	return dirfd(dir->d);
+}
 
 
 struct ptr_array {
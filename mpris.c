@@ -18,6 +18,7 @@
 #include <systemd/sd-bus.h>
 
 #include "mpris.h"
+#include "server.h"
 #include "ui_curses.h"
 #include "cmus.h"
 #include "player.h"
@@ -230,6 +231,8 @@ static int mpris_set_loop_status(sd_bus *_bus, const char *_path,
 		player_repeat_current = 0;
 		repeat = 1;
 	}
+	server_option_changed("repeat");
+	server_option_changed("repeat_current");
 	update_statusline();
 	return sd_bus_reply_method_return(value, "");
 }
@@ -260,6 +263,7 @@ static int mpris_set_shuffle(sd_bus *_bus, const char *_path,
 	uint32_t s = 0;
 	CK(sd_bus_message_read_basic(value, 'b', &s));
 	shuffle = s;
+	server_option_changed("shuffle");
 	update_statusline();
 	return sd_bus_reply_method_return(value, "");
 }
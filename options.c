@@ -41,6 +41,8 @@
 #include "debug.h"
 #include "discid.h"
 #include "mpris.h"
+#include "server.h"
+#include "watch.h"
 
 #include <stdio.h>
 #include <errno.h>
@@ -75,6 +77,8 @@ int display_artist_sort_name;
 int smart_artist_sort = 1;
 int scroll_offset = 2;
 int rewind_offset = 5;
+int scan_threads = 0;
+int remote_max_clients = 64;
 int skip_track_info = 0;
 int auto_expand_albums_follow = 1;
 int auto_expand_albums_search = 1;
@@ -87,6 +91,8 @@ int start_view = TREE_VIEW;
 int stop_after_queue = 0;
 int tree_width_percent = 33;
 int tree_width_max = 0;
+int watch_library = 0;
+int watch_rescan_interval = 60;
 
 int colors[NR_COLORS] = {
 	-1,
@@ -306,6 +312,32 @@ static void set_scroll_offset(void *data, const char *buf)
 		scroll_offset = offset;
 }
 
+static void get_scan_threads(void *data, char *buf, size_t size)
+{
+	buf_int(buf, scan_threads, size);
+}
+
+static void set_scan_threads(void *data, const char *buf)
+{
+	int threads;
+
+	if (parse_int(buf, 0, 256, &threads))
+		scan_threads = threads;
+}
+
+static void get_remote_max_clients(void *data, char *buf, size_t size)
+{
+	buf_int(buf, remote_max_clients, size);
+}
+
+static void set_remote_max_clients(void *data, const char *buf)
+{
+	int n;
+
+	if (parse_int(buf, 1, 512, &n))
+		remote_max_clients = n;
+}
+
 static void get_rewind_offset(void *data, char *buf, size_t size)
 {
 	buf_int(buf, rewind_offset, size);
@@ -500,6 +532,19 @@ static void set_tree_width_max(void *data, const char *buf)
 	update_size();
 }
 
+static void get_watch_rescan_interval(void *data, char *buf, size_t size)
+{
+	buf_int(buf, watch_rescan_interval, size);
+}
+
+static void set_watch_rescan_interval(void *data, const char *buf)
+{
+	int minutes;
+
+	if (parse_int(buf, 0, 10080, &minutes))
+		watch_rescan_interval = minutes;
+}
+
 /* }}} */
 
 /* callbacks for toggle options {{{ */
@@ -1053,6 +1098,21 @@ static void toggle_softvol(void *data)
 	do_set_softvol(soft_vol ^ 1);
 }
 
+static void get_softvol_dither(void *data, char *buf, size_t size)
+{
+	strscpy(buf, bool_names[soft_vol_dither], size);
+}
+
+static void set_softvol_dither(void *data, const char *buf)
+{
+	parse_bool(buf, &soft_vol_dither);
+}
+
+static void toggle_softvol_dither(void *data)
+{
+	soft_vol_dither ^= 1;
+}
+
 static void get_wrap_search(void *data, char *buf, size_t size)
 {
 	strscpy(buf, bool_names[wrap_search], size);
@@ -1137,6 +1197,27 @@ static void toggle_mpris(void *data)
 	mpris ^= 1;
 }
 
+static void get_watch_library(void *data, char *buf, size_t size)
+{
+	strscpy(buf, bool_names[watch_library], size);
+}
+
+static void set_watch_library(void *data, const char *buf)
+{
+	int old = watch_library;
+
+	if (!parse_bool(buf, &watch_library))
+		return;
+	if (watch_library != old)
+		watch_update();
+}
+
+static void toggle_watch_library(void *data)
+{
+	watch_library ^= 1;
+	watch_update();
+}
+
 static void get_time_show_leading_zero(void *data, char *buf, size_t size)
 {
 	strscpy(buf, bool_names[time_show_leading_zero], size);
@@ -1390,6 +1471,8 @@ static const struct {
 	DN(buffer_seconds)
 	DN(scroll_offset)
 	DN(rewind_offset)
+	DN(scan_threads)
+	DN(remote_max_clients)
 	DT(confirm_run)
 	DT(continue)
 	DT(continue_album)
@@ -1421,6 +1504,7 @@ static const struct {
 	DT(shuffle)
 	DT(follow)
 	DT(softvol)
+	DT(softvol_dither)
 	DN(softvol_state)
 	DN_FLAGS(status_display_program, OPT_PROGRAM_PATH)
 	DT(wrap_search)
@@ -1433,6 +1517,8 @@ static const struct {
 	DT(stop_after_queue)
 	DN(tree_width_percent)
 	DN(tree_width_max)
+	DT(watch_library)
+	DN(watch_rescan_interval)
 	{ NULL, NULL, NULL, NULL, 0 }
 };
 
@@ -1531,8 +1617,10 @@ void option_set(const char *name, const char *value)
 {
 	struct cmus_opt *opt = option_find(name);
 
-	if (opt)
+	if (opt) {
 		opt->set(opt->data, value);
+		server_option_changed(opt->name);
+	}
 }
 
 void options_add(void)
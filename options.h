@@ -143,6 +143,10 @@ extern int display_artist_sort_name;
 extern int smart_artist_sort;
 extern int scroll_offset;
 extern int rewind_offset;
+extern int scan_threads;
+extern int remote_max_clients;
+extern int watch_library;
+extern int watch_rescan_interval;
 extern int skip_track_info;
 extern int mouse;
 extern int mpris;
@@ -633,6 +633,27 @@ struct track_info *pl_goto_next(void)
 	return pl_goto_generic(pl_get_next_shuffled, pl_get_next);
 }
 
+struct track_info *pl_peek_next(void)
+{
+	struct simple_track *track;
+
+	if (!pl_playing_track)
+		return NULL;
+
+	if (shuffle) {
+		struct shuffle_track *st = shuffle_list_peek_next(&pl_playing->shuffle_root,
+				simple_track_to_shuffle_track(pl_playing_track), pl_dummy_filter);
+		track = st ? &st->simple_track : NULL;
+	} else {
+		track = pl_get_next(pl_playing, pl_playing_track);
+	}
+
+	if (!track)
+		return NULL;
+	track_info_ref(track->info);
+	return track->info;
+}
+
 struct track_info *pl_goto_prev(void)
 {
 	return pl_goto_generic(pl_get_prev_shuffled, pl_get_prev);
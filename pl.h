@@ -49,6 +49,8 @@ void pl_get_sort_str(char *buf, size_t size);
 void pl_set_sort_str(const char *buf);
 void pl_clear(void);
 struct track_info *pl_goto_next(void);
+/* track pl_goto_next() would return without playing it, new reference */
+struct track_info *pl_peek_next(void);
 struct track_info *pl_goto_prev(void);
 struct track_info *pl_play_selected_row(void);
 void pl_select_playing_track(void);
@@ -66,6 +66,18 @@ struct track_info *play_queue_remove(void)
 	return info;
 }
 
+struct track_info *play_queue_peek(void)
+{
+	struct track_info *info = NULL;
+
+	if (!list_empty(&pq_editable.head)) {
+		info = to_simple_track(pq_editable.head.next)->info;
+		track_info_ref(info);
+	}
+
+	return info;
+}
+
 int play_queue_for_each(int (*cb)(void *data, struct track_info *ti),
 		void *data, void *opaque)
 {
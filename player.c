@@ -18,6 +18,8 @@
 
 #include "player.h"
 #include "buffer.h"
+#include "scale.h"
+#include "channelmap.h"
 #include "input.h"
 #include "output.h"
 #include "sf.h"
@@ -38,6 +40,7 @@
 #include <sys/time.h>
 #include <stdarg.h>
 #include <math.h>
+#include <stdatomic.h>
 
 const char * const player_status_names[] = {
 	"stopped", "playing", "paused", NULL
@@ -60,6 +63,8 @@ enum consumer_status {
 static pthread_mutex_t player_info_mutex = CMUS_MUTEX_INITIALIZER;
 struct player_info player_info;
 char player_metadata[255 * 16 + 1];
+/* size of player_info_priv.played */
+static int played_alloc;
 static struct player_info player_info_priv = {
 	.ti = NULL,
 	.status = PLAYER_STATUS_STOPPED,
@@ -68,10 +73,14 @@ static struct player_info player_info_priv = {
 	.buffer_fill = 0,
 	.buffer_size = 0,
 	.error_msg = NULL,
+	.comments = NULL,
+	.played = NULL,
+	.nr_played = 0,
 	.file_changed = 0,
 	.metadata_changed = 0,
 	.status_changed = 0,
 	.position_changed = 0,
+	.seeked = 0,
 	.buffer_fill_changed = 0,
 };
 
@@ -89,6 +98,7 @@ int replaygain_limit = 1;
 double replaygain_preamp = 0.0;
 
 int soft_vol;
+int soft_vol_dither;
 int soft_vol_l;
 int soft_vol_r;
 
@@ -101,6 +111,30 @@ static pthread_cond_t producer_playing = CMUS_COND_INITIALIZER;
 static int producer_running = 1;
 static enum producer_status producer_status = PS_UNLOADED;
 static struct input_plugin *ip = NULL;
+/* consumer_pos of the end of the data in the buffer */
+static unsigned long producer_pos;
+
+/*
+ * Track following ip, peeked at by the producer as soon as it reaches the
+ * end of ip so that opening it does not happen on the audio path.  It is
+ * taken from the queue or library only when playback moves on, and dropped
+ * if by then something else has become the next track.
+ */
+static struct track_info *next_ti;
+static int next_fetched;
+/* producer_lock is dropped while next_ti is provided and opened */
+static int next_fetching;
+/* incremented whenever a pending next_ti would become stale */
+static unsigned int next_gen;
+/* next_ti opened ahead of time, or NULL */
+static struct input_plugin *next_ip;
+/*
+ * Set when the samples of next_ip follow those of ip in the buffer,
+ * starting at consumer_pos seam_pos.  Read without producer_lock by the
+ * consumer, cleared only with both locks held.
+ */
+static atomic_int next_queued;
+static unsigned long seam_pos;
 
 static pthread_t consumer_thread;
 static pthread_mutex_t consumer_mutex = CMUS_MUTEX_INITIALIZER;
@@ -140,29 +174,60 @@ static double replaygain_scale = 1.0;
 
 /* locking }}} */
 
+static void _producer_drop_next_ip(void)
+{
+	if (next_ip) {
+		ip_delete(next_ip);
+		next_ip = NULL;
+	}
+	next_queued = 0;
+}
+
+static void _producer_drop_next(void)
+{
+	_producer_drop_next_ip();
+	if (next_ti) {
+		track_info_unref(next_ti);
+		next_ti = NULL;
+	}
+	next_fetched = 0;
+	next_gen++;
+}
+
 static void reset_buffer(void)
 {
+	/* peeked at again when the producer reaches the end of ip */
+	if (next_queued)
+		_producer_drop_next();
 	buffer_reset();
 	consumer_pos = 0;
+	producer_pos = 0;
 	scale_pos = 0;
 	pthread_cond_broadcast(&producer_playing);
 }
 
-static void set_buffer_sf(void)
+static sample_format_t get_buffer_sf(struct input_plugin *p, channel_position_t *map)
 {
-	buffer_sf = ip_get_sf(ip);
-	ip_get_channel_map(ip, buffer_channel_map);
+	sample_format_t sf = ip_get_sf(p);
+
+	ip_get_channel_map(p, map);
 
 	/* ip_read converts samples to this format */
-	if (sf_get_channels(buffer_sf) <= 2 && sf_get_bits(buffer_sf) <= 16) {
-		buffer_sf &= SF_RATE_MASK;
-		buffer_sf |= sf_channels(2) | sf_bits(16) | sf_signed(1);
-		buffer_sf |= sf_host_endian();
-		channel_map_init_stereo(buffer_channel_map);
+	if (sf_get_channels(sf) <= 2 && sf_get_bits(sf) <= 16) {
+		sf &= SF_RATE_MASK;
+		sf |= sf_channels(2) | sf_bits(16) | sf_signed(1);
+		sf |= sf_host_endian();
+		channel_map_init_stereo(map);
 	}
+	return sf;
+}
+
+static void set_buffer_sf(void)
+{
+	buffer_sf = get_buffer_sf(ip, buffer_channel_map);
 }
 
-#define SOFT_VOL_SCALE 65536
+#define SOFT_VOL_SCALE SCALE_UNITY
 
 /* coefficients for volumes 0..99, for 100 65536 is used
  * data copied from alsa-lib src/pcm/pcm_softvol.c
@@ -183,124 +248,41 @@ static const unsigned short soft_vol_db[100] = {
 	0xcdf1, 0xd71a, 0xe59c, 0xefd3
 };
 
-static inline void scale_sample_int16_t(int16_t *buf, int i, int vol, int swap)
-{
-	int32_t sample = swap ? (int16_t)swap_uint16(buf[i]) : buf[i];
-
-	if (sample < 0) {
-		sample = (sample * vol - SOFT_VOL_SCALE / 2) / SOFT_VOL_SCALE;
-		if (sample < INT16_MIN)
-			sample = INT16_MIN;
-	} else {
-		sample = (sample * vol + SOFT_VOL_SCALE / 2) / SOFT_VOL_SCALE;
-		if (sample > INT16_MAX)
-			sample = INT16_MAX;
-	}
-	buf[i] = swap ? swap_uint16(sample) : sample;
-}
-
-static inline int32_t scale_sample_s24le(int32_t s, int vol)
+static int channel_is_left(channel_position_t pos)
 {
-	int64_t sample = s;
-	if (sample < 0) {
-		sample = (sample * vol - SOFT_VOL_SCALE / 2) / SOFT_VOL_SCALE;
-		if (sample < -0x800000)
-			sample = -0x800000;
-	} else {
-		sample = (sample * vol + SOFT_VOL_SCALE / 2) / SOFT_VOL_SCALE;
-		if (sample > 0x7fffff)
-			sample = 0x7fffff;
+	switch (pos) {
+	case CHANNEL_POSITION_FRONT_LEFT:
+	case CHANNEL_POSITION_REAR_LEFT:
+	case CHANNEL_POSITION_FRONT_LEFT_OF_CENTER:
+	case CHANNEL_POSITION_SIDE_LEFT:
+	case CHANNEL_POSITION_TOP_FRONT_LEFT:
+	case CHANNEL_POSITION_TOP_REAR_LEFT:
+		return 1;
+	default:
+		return 0;
 	}
-	return sample;
 }
 
-static inline void scale_sample_int32_t(int32_t *buf, int i, int vol, int swap)
+static int channel_is_right(channel_position_t pos)
 {
-	int64_t sample = swap ? (int32_t)swap_uint32(buf[i]) : buf[i];
-
-	if (sample < 0) {
-		sample = (sample * vol - SOFT_VOL_SCALE / 2) / SOFT_VOL_SCALE;
-		if (sample < INT32_MIN)
-			sample = INT32_MIN;
-	} else {
-		sample = (sample * vol + SOFT_VOL_SCALE / 2) / SOFT_VOL_SCALE;
-		if (sample > INT32_MAX)
-			sample = INT32_MAX;
-	}
-	buf[i] = swap ? swap_uint32(sample) : sample;
-}
-
-static inline int sf_need_swap(sample_format_t sf)
-{
-#ifdef WORDS_BIGENDIAN
-	return !sf_get_bigendian(sf);
-#else
-	return sf_get_bigendian(sf);
-#endif
-}
-
-#define SCALE_SAMPLES(TYPE, buffer, count, l, r, swap)				\
-{										\
-	const int frames = count / sizeof(TYPE) / 2;				\
-	TYPE *buf = (void *) buffer;						\
-	int i;									\
-	/* avoid underflowing -32768 to 32767 when scale is 65536 */		\
-	if (l != SOFT_VOL_SCALE && r != SOFT_VOL_SCALE) {			\
-		for (i = 0; i < frames; i++) {					\
-			scale_sample_##TYPE(buf, i * 2, l, swap);		\
-			scale_sample_##TYPE(buf, i * 2 + 1, r, swap);		\
-		}								\
-	} else if (l != SOFT_VOL_SCALE) {					\
-		for (i = 0; i < frames; i++)					\
-			scale_sample_##TYPE(buf, i * 2, l, swap);		\
-	} else if (r != SOFT_VOL_SCALE) {					\
-		for (i = 0; i < frames; i++)					\
-			scale_sample_##TYPE(buf, i * 2 + 1, r, swap);		\
-	}									\
-}
-
-static inline int32_t read_s24le(const char *buf)
-{
-	const unsigned char *b = (const unsigned char *) buf;
-	return b[0] | (b[1] << 8) | (((const signed char *) buf)[2] << 16);
-}
-
-static inline void write_s24le(char *buf, int32_t x)
-{
-	unsigned char *b = (unsigned char *) buf;
-	b[0] = x;
-	b[1] = x >> 8;
-	b[2] = x >> 16;
-}
-
-static void scale_samples_s24le(char *buf, unsigned int count, int l, int r)
-{
-	int frames = count / 3 / 2;
-	if (l != SOFT_VOL_SCALE && r != SOFT_VOL_SCALE) {
-		while (frames--) {
-			write_s24le(buf, scale_sample_s24le(read_s24le(buf), l));
-			buf += 3;
-			write_s24le(buf, scale_sample_s24le(read_s24le(buf), r));
-			buf += 3;
-		}
-	} else if (l != SOFT_VOL_SCALE) {
-		while (frames--) {
-			write_s24le(buf, scale_sample_s24le(read_s24le(buf), l));
-			buf += 3 * 2;
-		}
-	} else if (r != SOFT_VOL_SCALE) {
-		buf += 3;
-		while (frames--) {
-			write_s24le(buf, scale_sample_s24le(read_s24le(buf), r));
-			buf += 3 * 2;
-		}
+	switch (pos) {
+	case CHANNEL_POSITION_FRONT_RIGHT:
+	case CHANNEL_POSITION_REAR_RIGHT:
+	case CHANNEL_POSITION_FRONT_RIGHT_OF_CENTER:
+	case CHANNEL_POSITION_SIDE_RIGHT:
+	case CHANNEL_POSITION_TOP_FRONT_RIGHT:
+	case CHANNEL_POSITION_TOP_REAR_RIGHT:
+		return 1;
+	default:
+		return 0;
 	}
 }
 
 static void scale_samples(char *buffer, unsigned int *countp)
 {
 	unsigned int count = *countp;
-	int ch, bits, l, r;
+	int vol[CHANNELS_MAX];
+	int ch, l, r, i;
 
 	BUG_ON(scale_pos < consumer_pos);
 
@@ -318,8 +300,7 @@ static void scale_samples(char *buffer, unsigned int *countp)
 		return;
 
 	ch = sf_get_channels(buffer_sf);
-	bits = sf_get_bits(buffer_sf);
-	if (ch != 2 || (bits != 16 && bits != 24 && bits != 32))
+	if (ch > CHANNELS_MAX)
 		return;
 
 	l = SOFT_VOL_SCALE;
@@ -332,18 +313,23 @@ static void scale_samples(char *buffer, unsigned int *countp)
 	l *= replaygain_scale;
 	r *= replaygain_scale;
 
-	switch (bits) {
-	case 16:
-		SCALE_SAMPLES(int16_t, buffer, count, l, r, sf_need_swap(buffer_sf));
-		break;
-	case 24:
-		if (likely(!sf_get_bigendian(buffer_sf)))
-			scale_samples_s24le(buffer, count, l, r);
-		break;
-	case 32:
-		SCALE_SAMPLES(int32_t, buffer, count, l, r, sf_need_swap(buffer_sf));
-		break;
+	/* channels that are neither left nor right get the average */
+	if (!channel_map_valid(buffer_channel_map)) {
+		for (i = 0; i < ch; i++)
+			vol[i] = ch == 2 ? (i ? r : l) : (l + r) / 2;
+	} else {
+		for (i = 0; i < ch; i++) {
+			if (channel_is_left(buffer_channel_map[i]))
+				vol[i] = l;
+			else if (channel_is_right(buffer_channel_map[i]))
+				vol[i] = r;
+			else
+				vol[i] = (l + r) / 2;
+		}
 	}
+
+	scale_samples_sf(buffer, count, buffer_sf, vol,
+			soft_vol_dither ? SCALE_DITHER : 0);
 }
 
 static void update_rg_scale(void)
@@ -406,6 +392,22 @@ static inline unsigned int buffer_second_size(void)
 
 /* updating player status {{{ */
 
+static void _player_played(void)
+{
+	player_info_priv_lock();
+	if (player_info_priv.ti) {
+		player_info_priv.ti->play_count++;
+		if (player_info_priv.nr_played == played_alloc) {
+			played_alloc = played_alloc ? played_alloc * 2 : 4;
+			player_info_priv.played = xrenew(struct track_info *,
+					player_info_priv.played, played_alloc);
+		}
+		track_info_ref(player_info_priv.ti);
+		player_info_priv.played[player_info_priv.nr_played++] = player_info_priv.ti;
+	}
+	player_info_priv_unlock();
+}
+
 static inline void _file_changed(struct track_info *ti)
 {
 	player_info_priv_lock();
@@ -413,6 +415,10 @@ static inline void _file_changed(struct track_info *ti)
 		track_info_unref(player_info_priv.ti);
 
 	player_info_priv.ti = ti;
+	if (player_info_priv.comments) {
+		keyvals_free(player_info_priv.comments);
+		player_info_priv.comments = NULL;
+	}
 	update_rg_scale();
 	player_metadata[0] = 0;
 	player_info_priv.file_changed = 1;
@@ -442,9 +448,10 @@ static inline void metadata_changed(void)
 
 	rc = ip_read_comments(ip, &comments);
 	if (!rc) {
-		if (player_info_priv.ti->comments)
-			keyvals_free(player_info_priv.ti->comments);
-		track_info_set_comments(player_info_priv.ti, comments);
+		/* ti may be compared or displayed by other threads */
+		if (player_info_priv.comments)
+			keyvals_free(player_info_priv.comments);
+		player_info_priv.comments = comments;
 	}
 
 	player_info_priv.metadata_changed = 1;
@@ -612,6 +619,7 @@ static void _prebuffer(void)
 
 		/* buffer_fill with 0 count marks current chunk filled */
 		buffer_fill(nr_read);
+		producer_pos += nr_read;
 
 		_producer_buffer_fill_update();
 		if (nr_read == 0) {
@@ -682,6 +690,7 @@ static void _producer_stop(void)
 
 static void _producer_unload(void)
 {
+	_producer_drop_next();
 	_producer_stop();
 	if (producer_status == PS_STOPPED) {
 		ip_delete(ip);
@@ -698,6 +707,81 @@ static void _producer_pause(void)
 	}
 }
 
+/* should playback continue from the current track to @ti? */
+static int player_cont_to(struct track_info *ti)
+{
+	return player_cont && (player_cont_album == 1 ||
+			strcmp(player_info_priv.ti->album, ti->album) == 0);
+}
+
+/*
+ * Called when the producer has read all of ip.  Peeks at and opens the next
+ * track while the consumer is still draining the buffer and, if it decodes
+ * to the format of the buffer, queues its samples right after those of ip.
+ */
+static void _producer_prepare_next(void)
+{
+	CHANNEL_MAP(map);
+	struct input_plugin *nip = NULL;
+	struct track_info *ti;
+	sample_format_t sf;
+	unsigned int gen;
+
+	if (!player_cont || player_repeat_current || ip_is_remote(ip))
+		return;
+
+	/*
+	 * the main thread might be waiting for producer_lock, and opening may
+	 * touch the network or a slow disk.  only the result is published
+	 */
+	gen = next_gen;
+	next_fetching = 1;
+	producer_unlock();
+	ti = cmus_peek_next_track();
+	if (ti) {
+		nip = ip_new(ti->filename);
+		if (ip_open(nip)) {
+			/* error is reported when the consumer gets there */
+			ip_delete(nip);
+			nip = NULL;
+		} else {
+			ip_setup(nip);
+		}
+	}
+	producer_lock();
+	next_fetching = 0;
+	pthread_cond_broadcast(&producer_playing);
+
+	if (gen != next_gen) {
+		/* another file was selected */
+		if (nip)
+			ip_delete(nip);
+		if (ti)
+			track_info_unref(ti);
+		return;
+	}
+	next_fetched = 1;
+	next_ti = ti;
+	/* not continuing to it, or stopped or seeked meanwhile */
+	if (!nip || !player_cont_to(next_ti) ||
+			producer_status != PS_PLAYING || !ip_eof(ip)) {
+		if (nip)
+			ip_delete(nip);
+		return;
+	}
+	next_ip = nip;
+
+	sf = get_buffer_sf(next_ip, map);
+	if (sf != buffer_sf || !channel_map_equal(map, buffer_channel_map, sf_get_channels(sf))) {
+		/* output must be reopened, stays pre-opened only */
+		d_print("next track has a different sample format\n");
+		return;
+	}
+	d_print("queueing next track: %s\n", next_ti->filename);
+	seam_pos = producer_pos;
+	next_queued = 1;
+}
+
 static void _producer_set_file(struct track_info *ti)
 {
 	_producer_unload();
@@ -795,39 +879,43 @@ static int change_sf(int drop)
 	return 0;
 }
 
-static void _consumer_handle_eof(void)
+/*
+ * Takes the track following ip now that playback moves on.  The pre-opened
+ * next_ip is dropped unless its track still is the next one.
+ */
+static struct track_info *_consumer_take_next(void)
 {
 	struct track_info *ti;
 
-	if (ip_is_remote(ip)) {
-		_producer_stop();
-		_consumer_drain_and_stop();
-		player_error("lost connection");
-		return;
+	while (next_fetching)
+		pthread_cond_wait(&producer_playing, &producer_mutex);
+	ti = cmus_get_next_track();
+	if (next_ti && ti != next_ti) {
+		d_print("next track changed after it was opened\n");
+		_producer_drop_next();
 	}
+	return ti;
+}
 
-	if (player_info_priv.ti)
-		player_info_priv.ti->play_count++;
+/* switch to @ti after ip has been played, consumes the reference */
+static void _consumer_play_next(struct track_info *ti)
+{
+	if (ti) {
+		struct input_plugin *pre = next_ip;
 
-	if (player_repeat_current) {
-		if (player_cont) {
-			ip_seek(ip, 0);
-			reset_buffer();
+		next_ip = NULL;
+		_producer_unload();
+		if (pre) {
+			ip = pre;
+			_producer_status_update(PS_PLAYING);
 		} else {
-			_producer_stop();
-			_consumer_drain_and_stop();
+			ip = ip_new(ti->filename);
+			_producer_status_update(PS_STOPPED);
 		}
-		_player_status_changed();
-		return;
-	}
-
-	if ((ti = cmus_get_next_track())) {
-		_producer_unload();
-		ip = ip_new(ti->filename);
-		_producer_status_update(PS_STOPPED);
-		/* PS_STOPPED, CS_PLAYING */
-		if (player_cont && (player_cont_album == 1 || strcmp(player_info_priv.ti->album,ti->album) == 0)) {
-			_producer_play();
+		/* PS_STOPPED or PS_PLAYING, CS_PLAYING */
+		if (player_cont_to(ti)) {
+			if (producer_status == PS_STOPPED)
+				_producer_play();
 			if (producer_status == PS_UNLOADED) {
 				_consumer_stop();
 				track_info_unref(ti);
@@ -839,6 +927,8 @@ static void _consumer_handle_eof(void)
 					_prebuffer();
 			}
 		} else {
+			/* closes the pre-opened track */
+			_producer_stop();
 			_consumer_drain_and_stop();
 			file_changed(ti);
 		}
@@ -850,6 +940,71 @@ static void _consumer_handle_eof(void)
 	_player_status_changed();
 }
 
+static void _consumer_handle_eof(void)
+{
+	if (ip_is_remote(ip)) {
+		_producer_stop();
+		_consumer_drain_and_stop();
+		player_error("lost connection");
+		return;
+	}
+
+	_player_played();
+
+	if (player_repeat_current) {
+		if (player_cont) {
+			ip_seek(ip, 0);
+			reset_buffer();
+		} else {
+			_producer_stop();
+			_consumer_drain_and_stop();
+		}
+		_player_status_changed();
+		return;
+	}
+
+	_consumer_play_next(_consumer_take_next());
+}
+
+/* the consumer has played everything before seam_pos */
+static void _consumer_handle_seam(void)
+{
+	struct track_info *ti;
+
+	if (player_repeat_current || !player_cont_to(next_ti)) {
+		/* options changed after next_ip was queued */
+		reset_buffer();
+		_consumer_handle_eof();
+		return;
+	}
+
+	_player_played();
+
+	ti = _consumer_take_next();
+	if (!next_queued) {
+		/* the queue or the cursor changed after next_ip was queued */
+		_consumer_play_next(ti);
+		return;
+	}
+	track_info_unref(ti);
+
+	ip_delete(ip);
+	ip = next_ip;
+	next_ip = NULL;
+	next_queued = 0;
+	next_fetched = 0;
+
+	consumer_pos -= seam_pos;
+	scale_pos -= seam_pos;
+	producer_pos -= seam_pos;
+
+	file_changed(next_ti);
+	next_ti = NULL;
+	_player_status_changed();
+	/* the producer may be waiting at the end of the new ip */
+	pthread_cond_broadcast(&producer_playing);
+}
+
 static void *consumer_loop(void *arg)
 {
 	while (1) {
@@ -895,6 +1050,18 @@ static void *consumer_loop(void *arg)
 				break;
 			}
 			size = buffer_get_rpos(&rpos);
+			if (atomic_load(&next_queued)) {
+				if (consumer_pos >= seam_pos) {
+					producer_lock();
+					_consumer_handle_seam();
+					producer_unlock();
+					consumer_unlock();
+					break;
+				}
+				/* don't scale samples of the next track with our gain */
+				if (size > seam_pos - consumer_pos)
+					size = seam_pos - consumer_pos;
+			}
 			if (size == 0) {
 				producer_lock();
 				if (producer_status != PS_PLAYING) {
@@ -905,8 +1072,17 @@ static void *consumer_loop(void *arg)
 				/* must recheck rpos */
 				size = buffer_get_rpos(&rpos);
 				if (size == 0) {
-					/* OK. now it's safe to check if we are at EOF */
-					if (ip_eof(ip)) {
+					if (next_queued) {
+						/* next track was queued meanwhile */
+						producer_unlock();
+						continue;
+					}
+					/*
+					 * OK. now it's safe to check if we are at EOF.
+					 * while the next track is being opened wait
+					 * without the locks like for an underrun
+					 */
+					if (ip_eof(ip) && !next_fetching) {
 						/* EOF */
 						_consumer_handle_eof();
 						producer_unlock();
@@ -918,7 +1094,7 @@ static void *consumer_loop(void *arg)
 						_consumer_position_update();
 						consumer_unlock();
 /* 						d_print("possible underrun\n"); */
-						ms_sleep(10);
+						buffer_wait_data(10);
 						break;
 					}
 				}
@@ -961,6 +1137,7 @@ static void *producer_loop(void *arg)
 		 * too small => underruns?
 		 */
 		const int chunks = 1;
+		struct input_plugin *rip;
 		int size, nr_read, i;
 		char *wpos;
 
@@ -968,9 +1145,14 @@ static void *producer_loop(void *arg)
 		if (!producer_running)
 			break;
 
+		if (producer_status == PS_PLAYING && ip_eof(ip) && !next_fetched)
+			_producer_prepare_next();
+		/* after the seam the next track is read */
+		rip = next_queued ? next_ip : ip;
+
 		if (producer_status == PS_UNLOADED ||
 		    producer_status == PS_PAUSED ||
-		    producer_status == PS_STOPPED || ip_eof(ip)) {
+		    producer_status == PS_STOPPED || ip_eof(rip)) {
 			pthread_cond_wait(&producer_playing, &producer_mutex);
 			producer_unlock();
 			continue;
@@ -980,31 +1162,31 @@ static void *producer_loop(void *arg)
 			if (size == 0) {
 				/* buffer is full */
 				producer_unlock();
-				ms_sleep(50);
+				buffer_wait_space(50);
 				break;
 			}
-			nr_read = ip_read(ip, wpos, size);
+			nr_read = ip_read(rip, wpos, size);
 			if (nr_read < 0) {
 				if (nr_read != -1 || errno != EAGAIN) {
 					player_ip_error(nr_read, "reading file %s",
-							ip_get_filename(ip));
+							ip_get_filename(rip));
 					/* ip_read sets eof */
 					nr_read = 0;
 				} else {
+					/* ip_read already waited for the stream */
 					producer_unlock();
-					ms_sleep(50);
 					break;
 				}
 			}
-			if (ip_metadata_changed(ip))
+			if (rip == ip && ip_metadata_changed(ip))
 				metadata_changed();
 
 			/* buffer_fill with 0 count marks current chunk filled */
 			buffer_fill(nr_read);
+			producer_pos += nr_read;
 			if (nr_read == 0) {
-				/* consumer handles EOF */
+				/* consumer handles EOF, we wait for producer_playing */
 				producer_unlock();
-				ms_sleep(50);
 				break;
 			}
 			if (i == chunks) {
@@ -1289,8 +1471,12 @@ void player_seek(double offset, int relative, int start_playing)
 			op_drop();
 			reset_buffer();
 			consumer_pos = new_pos * buffer_second_size();
+			producer_pos = consumer_pos;
 			scale_pos = consumer_pos;
 			_consumer_position_update();
+			player_info_priv_lock();
+			player_info_priv.seeked = 1;
+			player_info_priv_unlock();
 			if (stopped && !start_playing) {
 				_producer_pause();
 				_consumer_pause();
@@ -1464,21 +1650,35 @@ void player_set_rg_preamp(double db)
 
 void player_info_snapshot(void)
 {
+	int i;
+
 	player_info_priv_lock();
 
 	free(player_info.error_msg);
 	if (player_info.ti)
 		track_info_unref(player_info.ti);
+	for (i = 0; i < player_info.nr_played; i++)
+		track_info_unref(player_info.played[i]);
+	free(player_info.played);
 	memcpy(&player_info, &player_info_priv, sizeof(player_info));
 	if (player_info.ti)
 		track_info_ref(player_info.ti);
+	if (player_info.comments) {
+		track_info_set_comments(player_info.ti, player_info.comments);
+		player_info.comments = NULL;
+	}
 
 	player_info_priv.file_changed = 0;
 	player_info_priv.metadata_changed = 0;
 	player_info_priv.status_changed = 0;
 	player_info_priv.position_changed = 0;
+	player_info_priv.seeked = 0;
 	player_info_priv.buffer_fill_changed = 0;
 	player_info_priv.error_msg = NULL;
+	player_info_priv.comments = NULL;
+	player_info_priv.played = NULL;
+	player_info_priv.nr_played = 0;
+	played_alloc = 0;
 
 	player_info_priv_unlock();
 }
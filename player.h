@@ -64,10 +64,21 @@ struct player_info {
 	/* display this if not NULL */
 	char *error_msg;
 
+	/* new tags of ti, track_info_set_comments() is called on the main
+	 * thread by player_info_snapshot() */
+	struct keyval *comments;
+
+	/* finished playing since the last snapshot, oldest first.  their
+	 * play_counts have been incremented */
+	struct track_info **played;
+	int nr_played;
+
 	unsigned int file_changed : 1;
 	unsigned int metadata_changed : 1;
 	unsigned int status_changed : 1;
 	unsigned int position_changed : 1;
+	/* player_seek() succeeded, even if pos did not change */
+	unsigned int seeked : 1;
 	unsigned int buffer_fill_changed : 1;
 };
 
@@ -80,6 +91,7 @@ extern enum replaygain replaygain;
 extern int replaygain_limit;
 extern double replaygain_preamp;
 extern int soft_vol;
+extern int soft_vol_dither;
 extern int soft_vol_l;
 extern int soft_vol_r;
 
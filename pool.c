@@ -0,0 +1,176 @@
+/*
+ * Copyright 2008-2013 Various Authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pool.h"
+#include "locking.h"
+#include "options.h"
+#include "debug.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define POOL_MAX_THREADS 256
+
+static pthread_mutex_t pool_mutex = CMUS_MUTEX_INITIALIZER;
+/* helpers wait for work */
+static pthread_cond_t pool_cond = CMUS_COND_INITIALIZER;
+/* pool_run() waits for helpers to finish */
+static pthread_cond_t pool_done_cond = CMUS_COND_INITIALIZER;
+/* serializes pool_run() */
+static pthread_mutex_t pool_run_mutex = CMUS_MUTEX_INITIALIZER;
+
+static pthread_t pool_threads[POOL_MAX_THREADS - 1];
+static int pool_pending[POOL_MAX_THREADS - 1];
+static int pool_nr_spawned;
+static int pool_stop;
+
+/* current task, written only while no helper is working on it */
+static pool_cb task_cb;
+static void *task_opaque;
+static int task_n;
+static atomic_int task_next;
+/* number of helpers still working on the task */
+static int task_active;
+
+#define pool_lock() cmus_mutex_lock(&pool_mutex)
+#define pool_unlock() cmus_mutex_unlock(&pool_mutex)
+
+static void pool_work(void)
+{
+	int i;
+
+	while ((i = atomic_fetch_add(&task_next, 1)) < task_n)
+		task_cb(i, task_opaque);
+}
+
+static void *pool_loop(void *arg)
+{
+	int id = (intptr_t)arg;
+
+	pool_lock();
+	while (1) {
+		if (pool_stop)
+			break;
+		if (!pool_pending[id]) {
+			pthread_cond_wait(&pool_cond, &pool_mutex);
+			continue;
+		}
+		pool_unlock();
+
+		pool_work();
+
+		pool_lock();
+		pool_pending[id] = 0;
+		if (--task_active == 0)
+			pthread_cond_signal(&pool_done_cond);
+	}
+	pool_unlock();
+	return NULL;
+}
+
+int pool_nr_threads(void)
+{
+	long n = scan_threads;
+
+	if (n <= 0)
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n < 1)
+		n = 1;
+	if (n > POOL_MAX_THREADS)
+		n = POOL_MAX_THREADS;
+	return n;
+}
+
+/* called with pool_run_mutex held */
+static void do_pool_run(int n, pool_cb cb, void *opaque)
+{
+	int helpers, i;
+
+	helpers = pool_nr_threads() - 1;
+	if (helpers > n - 1)
+		helpers = n - 1;
+
+	pool_lock();
+	while (pool_nr_spawned < helpers) {
+		int rc = pthread_create(&pool_threads[pool_nr_spawned], NULL,
+				pool_loop, (void *)(intptr_t)pool_nr_spawned);
+
+		if (rc) {
+			d_print("pthread_create: %s\n", strerror(rc));
+			break;
+		}
+		pool_nr_spawned++;
+	}
+	if (helpers > pool_nr_spawned)
+		helpers = pool_nr_spawned;
+
+	task_cb = cb;
+	task_opaque = opaque;
+	task_n = n;
+	atomic_store(&task_next, 0);
+	task_active = helpers;
+	for (i = 0; i < helpers; i++)
+		pool_pending[i] = 1;
+	pthread_cond_broadcast(&pool_cond);
+	pool_unlock();
+
+	pool_work();
+
+	pool_lock();
+	while (task_active)
+		pthread_cond_wait(&pool_done_cond, &pool_mutex);
+	pool_unlock();
+}
+
+void pool_run(int n, pool_cb cb, void *opaque)
+{
+	if (n <= 0)
+		return;
+
+	cmus_mutex_lock(&pool_run_mutex);
+	do_pool_run(n, cb, opaque);
+	cmus_mutex_unlock(&pool_run_mutex);
+}
+
+int pool_try_run(int n, pool_cb cb, void *opaque)
+{
+	if (n <= 0)
+		return 0;
+
+	if (pthread_mutex_trylock(&pool_run_mutex))
+		return -1;
+	do_pool_run(n, cb, opaque);
+	cmus_mutex_unlock(&pool_run_mutex);
+	return 0;
+}
+
+void pool_exit(void)
+{
+	int i;
+
+	pool_lock();
+	pool_stop = 1;
+	pthread_cond_broadcast(&pool_cond);
+	pool_unlock();
+
+	for (i = 0; i < pool_nr_spawned; i++)
+		pthread_join(pool_threads[i], NULL);
+	pool_nr_spawned = 0;
+}
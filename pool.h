@@ -0,0 +1,43 @@
+/*
+ * Copyright 2008-2013 Various Authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CMUS_POOL_H
+#define CMUS_POOL_H
+
+typedef void (*pool_cb)(int i, void *opaque);
+
+/* number of threads (including the caller) pool_run() distributes work on */
+int pool_nr_threads(void);
+
+/*
+ * Calls cb(i, opaque) for every i in [0, n) and returns when all calls
+ * have finished. The calls are spread over the pool threads and the
+ * calling thread, in no particular order.
+ *
+ * Only one pool_run() is active at a time; concurrent callers wait.
+ */
+void pool_run(int n, pool_cb cb, void *opaque);
+
+/*
+ * Like pool_run() but returns -1 without calling @cb if another pool_run()
+ * is active.  For threads that must not wait for a worker job.
+ */
+int pool_try_run(int n, pool_cb cb, void *opaque);
+
+void pool_exit(void);
+
+#endif
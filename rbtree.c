@@ -23,7 +23,20 @@
 
 #include "rbtree.h"
 
-static void _rb_rotate_left(struct rb_node *node, struct rb_root *root)
+static inline unsigned long rb_count(const struct rb_node *node)
+{
+	return node ? rb_entry(node, struct rb_counted_node, rb)->count : 0;
+}
+
+/* @top took the place of @node, which is now one of its children */
+static inline void rb_rotate_count(struct rb_node *node, struct rb_node *top)
+{
+	rb_entry(top, struct rb_counted_node, rb)->count = rb_count(node);
+	rb_entry(node, struct rb_counted_node, rb)->count =
+		rb_count(node->rb_left) + rb_count(node->rb_right) + 1;
+}
+
+static inline void _rb_rotate_left(struct rb_node *node, struct rb_root *root, int counted)
 {
 	struct rb_node *right = node->rb_right;
 	struct rb_node *parent = rb_parent(node);
@@ -44,9 +57,11 @@ static void _rb_rotate_left(struct rb_node *node, struct rb_root *root)
 	else
 		root->rb_node = right;
 	rb_set_parent(node, right);
+	if (counted)
+		rb_rotate_count(node, right);
 }
 
-static void _rb_rotate_right(struct rb_node *node, struct rb_root *root)
+static inline void _rb_rotate_right(struct rb_node *node, struct rb_root *root, int counted)
 {
 	struct rb_node *left = node->rb_left;
 	struct rb_node *parent = rb_parent(node);
@@ -67,9 +82,11 @@ static void _rb_rotate_right(struct rb_node *node, struct rb_root *root)
 	else
 		root->rb_node = left;
 	rb_set_parent(node, left);
+	if (counted)
+		rb_rotate_count(node, left);
 }
 
-void rb_insert_color(struct rb_node *node, struct rb_root *root)
+static inline void _rb_insert_color(struct rb_node *node, struct rb_root *root, int counted)
 {
 	struct rb_node *parent, *gparent;
 
@@ -94,7 +111,7 @@ void rb_insert_color(struct rb_node *node, struct rb_root *root)
 			if (parent->rb_right == node)
 			{
 				register struct rb_node *tmp;
-				_rb_rotate_left(parent, root);
+				_rb_rotate_left(parent, root, counted);
 				tmp = parent;
 				parent = node;
 				node = tmp;
@@ -102,7 +119,7 @@ void rb_insert_color(struct rb_node *node, struct rb_root *root)
 
 			rb_set_black(parent);
 			rb_set_red(gparent);
-			_rb_rotate_right(gparent, root);
+			_rb_rotate_right(gparent, root, counted);
 		} else {
 			{
 				register struct rb_node *uncle = gparent->rb_left;
@@ -119,7 +136,7 @@ void rb_insert_color(struct rb_node *node, struct rb_root *root)
 			if (parent->rb_left == node)
 			{
 				register struct rb_node *tmp;
-				_rb_rotate_right(parent, root);
+				_rb_rotate_right(parent, root, counted);
 				tmp = parent;
 				parent = node;
 				node = tmp;
@@ -127,15 +144,20 @@ void rb_insert_color(struct rb_node *node, struct rb_root *root)
 
 			rb_set_black(parent);
 			rb_set_red(gparent);
-			_rb_rotate_left(gparent, root);
+			_rb_rotate_left(gparent, root, counted);
 		}
 	}
 
 	rb_set_black(root->rb_node);
 }
 
-static void _rb_erase_color(struct rb_node *node, struct rb_node *parent,
-			     struct rb_root *root)
+void rb_insert_color(struct rb_node *node, struct rb_root *root)
+{
+	_rb_insert_color(node, root, 0);
+}
+
+static inline void _rb_erase_color(struct rb_node *node, struct rb_node *parent,
+			     struct rb_root *root, int counted)
 {
 	struct rb_node *other;
 
@@ -148,7 +170,7 @@ static void _rb_erase_color(struct rb_node *node, struct rb_node *parent,
 			{
 				rb_set_black(other);
 				rb_set_red(parent);
-				_rb_rotate_left(parent, root);
+				_rb_rotate_left(parent, root, counted);
 				other = parent->rb_right;
 			}
 			if ((!other->rb_left || rb_is_black(other->rb_left)) &&
@@ -164,13 +186,13 @@ static void _rb_erase_color(struct rb_node *node, struct rb_node *parent,
 				{
 					rb_set_black(other->rb_left);
 					rb_set_red(other);
-					_rb_rotate_right(other, root);
+					_rb_rotate_right(other, root, counted);
 					other = parent->rb_right;
 				}
 				rb_set_color(other, rb_color(parent));
 				rb_set_black(parent);
 				rb_set_black(other->rb_right);
-				_rb_rotate_left(parent, root);
+				_rb_rotate_left(parent, root, counted);
 				node = root->rb_node;
 				break;
 			}
@@ -182,7 +204,7 @@ static void _rb_erase_color(struct rb_node *node, struct rb_node *parent,
 			{
 				rb_set_black(other);
 				rb_set_red(parent);
-				_rb_rotate_right(parent, root);
+				_rb_rotate_right(parent, root, counted);
 				other = parent->rb_left;
 			}
 			if ((!other->rb_left || rb_is_black(other->rb_left)) &&
@@ -198,13 +220,13 @@ static void _rb_erase_color(struct rb_node *node, struct rb_node *parent,
 				{
 					rb_set_black(other->rb_right);
 					rb_set_red(other);
-					_rb_rotate_left(other, root);
+					_rb_rotate_left(other, root, counted);
 					other = parent->rb_left;
 				}
 				rb_set_color(other, rb_color(parent));
 				rb_set_black(parent);
 				rb_set_black(other->rb_left);
-				_rb_rotate_right(parent, root);
+				_rb_rotate_right(parent, root, counted);
 				node = root->rb_node;
 				break;
 			}
@@ -214,7 +236,7 @@ static void _rb_erase_color(struct rb_node *node, struct rb_node *parent,
 		rb_set_black(node);
 }
 
-void rb_erase(struct rb_node *node, struct rb_root *root)
+static inline void _rb_erase(struct rb_node *node, struct rb_root *root, int counted)
 {
 	struct rb_node *child, *parent;
 	int color;
@@ -257,6 +279,9 @@ void rb_erase(struct rb_node *node, struct rb_root *root)
 		node->rb_parent_color = old->rb_parent_color;
 		node->rb_left = old->rb_left;
 		rb_set_parent(old->rb_left, node);
+		if (counted)
+			rb_entry(node, struct rb_counted_node, rb)->count =
+				rb_entry(old, struct rb_counted_node, rb)->count;
 
 		goto color;
 	}
@@ -278,7 +303,12 @@ void rb_erase(struct rb_node *node, struct rb_root *root)
 
  color:
 	if (color == RB_BLACK)
-		_rb_erase_color(child, parent, root);
+		_rb_erase_color(child, parent, root, counted);
+}
+
+void rb_erase(struct rb_node *node, struct rb_root *root)
+{
+	_rb_erase(node, root, 0);
 }
 
 /*
@@ -382,3 +412,75 @@ void rb_replace_node(struct rb_node *victim, struct rb_node *new,
 	/* Copy the pointers/colour from the victim to the replacement */
 	*new = *victim;
 }
+
+void rb_insert_counted_after(struct rb_counted_node *node, struct rb_counted_node *prev,
+		struct rb_root *root)
+{
+	struct rb_node *parent, **link, *p;
+
+	if (!prev) {
+		parent = rb_first(root);
+		link = parent ? &parent->rb_left : &root->rb_node;
+	} else if (!prev->rb.rb_right) {
+		parent = &prev->rb;
+		link = &parent->rb_right;
+	} else {
+		parent = prev->rb.rb_right;
+		while (parent->rb_left)
+			parent = parent->rb_left;
+		link = &parent->rb_left;
+	}
+
+	rb_link_node(&node->rb, parent, link);
+	node->count = 1;
+	for (p = parent; p; p = rb_parent(p))
+		rb_entry(p, struct rb_counted_node, rb)->count++;
+	_rb_insert_color(&node->rb, root, 1);
+}
+
+void rb_erase_counted(struct rb_counted_node *node, struct rb_root *root)
+{
+	struct rb_node *gone = &node->rb, *p;
+
+	/* the node that is unlinked from its place, see _rb_erase() */
+	if (gone->rb_left && gone->rb_right) {
+		gone = gone->rb_right;
+		while (gone->rb_left)
+			gone = gone->rb_left;
+	}
+	for (p = rb_parent(gone); p; p = rb_parent(p))
+		rb_entry(p, struct rb_counted_node, rb)->count--;
+	_rb_erase(&node->rb, root, 1);
+}
+
+unsigned long rb_counted_index(const struct rb_counted_node *node)
+{
+	const struct rb_node *n = &node->rb, *parent;
+	unsigned long index = rb_count(n->rb_left);
+
+	while ((parent = rb_parent(n))) {
+		if (n == parent->rb_right)
+			index += rb_count(parent->rb_left) + 1;
+		n = parent;
+	}
+	return index;
+}
+
+struct rb_counted_node *rb_counted_at(const struct rb_root *root, unsigned long index)
+{
+	struct rb_node *n = root->rb_node;
+
+	while (n) {
+		unsigned long left = rb_count(n->rb_left);
+
+		if (index < left) {
+			n = n->rb_left;
+		} else if (index == left) {
+			return rb_entry(n, struct rb_counted_node, rb);
+		} else {
+			index -= left + 1;
+			n = n->rb_right;
+		}
+	}
+	return NULL;
+}
@@ -162,6 +162,35 @@ static inline void rb_link_node(struct rb_node * node, struct rb_node * parent,
 
 /* Cmus extensions */
 
+/*
+ * Order statistics.  Nodes of these trees know the size of their subtree,
+ * so nodes can be found by position and the position of a node is known in
+ * O(log n).  The order is given by the caller, not by keys.  All nodes of
+ * such a tree must be rb_counted_nodes and must be inserted and erased with
+ * the functions below.
+ */
+struct rb_counted_node {
+	struct rb_node rb;
+	unsigned long count;
+};
+
+/* inserts @node after @prev, or first if @prev is NULL */
+void rb_insert_counted_after(struct rb_counted_node *node, struct rb_counted_node *prev,
+		struct rb_root *root);
+void rb_erase_counted(struct rb_counted_node *node, struct rb_root *root);
+
+/* 0-based position of @node */
+unsigned long rb_counted_index(const struct rb_counted_node *node);
+/* NULL if @index is out of range */
+struct rb_counted_node *rb_counted_at(const struct rb_root *root, unsigned long index);
+
+static inline unsigned long rb_counted_size(const struct rb_root *root)
+{
+	if (!root->rb_node)
+		return 0;
+	return rb_entry(root->rb_node, struct rb_counted_node, rb)->count;
+}
+
 static inline void rb_root_init(struct rb_root *root)
 {
 	root->rb_node = NULL;
@@ -0,0 +1,621 @@
+/*
+ * Copyright 2008-2013 Various Authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "scale.h"
+#include "channelmap.h"
+#include "utils.h"
+
+#include <stdint.h>
+#include <math.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCALE_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * Samples are scaled in double precision which is exact for all supported
+ * sample sizes as long as the factor is below 2^21 (gain of +30 dB).
+ *
+ * The per-channel factors are expanded to SCALE_PERIOD_FRAMES frames so that
+ * the vector code can load the factors of consecutive samples directly, no
+ * matter how many channels there are.  The period is a multiple of the
+ * largest vector width (16 samples).
+ */
+#define SCALE_PERIOD_FRAMES 16
+#define SCALE_MAX_PERIOD (SCALE_PERIOD_FRAMES * CHANNELS_MAX)
+
+/*
+ * 24-bit samples and samples going through the float stage are unpacked to
+ * 32 bits in blocks of this many samples
+ */
+#define SCALE_BLOCK 2048
+
+#define S24_MIN (-0x800000)
+#define S24_MAX 0x7fffff
+
+typedef void (*scale_s16_cb)(int16_t *buf, unsigned int n, const double *gain,
+		unsigned int period, int swap);
+typedef void (*scale_s32_cb)(int32_t *buf, unsigned int n, const double *gain,
+		unsigned int period, int swap, double lo, double hi);
+typedef void (*scale_f32_cb)(int32_t *buf, unsigned int n, const float *gain,
+		const float *amp, unsigned int period, float lo, float hi,
+		uint32_t *seed);
+
+struct scale_ops {
+	const char *name;
+	scale_s16_cb s16;
+	scale_s32_cb s32;
+	scale_f32_cb f32;
+};
+
+/* one xorshift32 state per sample of a 4-wide vector */
+static uint32_t dither_seed[4] = { 0x9e3779b9, 0x7f4a7c15, 0x85ebca6b, 0xc2b2ae35 };
+
+static inline int32_t scale_one(int32_t s, double gain, double lo, double hi)
+{
+	double x = s * gain;
+
+	x += x < 0 ? -0.5 : 0.5;
+	if (x < lo)
+		x = lo;
+	else if (x > hi)
+		x = hi;
+	return x;
+}
+
+/* j is the index of buf[0] within the period */
+static void scale_s16_tail(int16_t *buf, unsigned int n, const double *gain,
+		unsigned int j, unsigned int period, int swap)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		int32_t s = swap ? (int16_t)swap_uint16(buf[i]) : buf[i];
+
+		s = scale_one(s, gain[j], INT16_MIN, INT16_MAX);
+		buf[i] = swap ? swap_uint16(s) : s;
+		if (++j == period)
+			j = 0;
+	}
+}
+
+static void scale_s32_tail(int32_t *buf, unsigned int n, const double *gain,
+		unsigned int j, unsigned int period, int swap, double lo, double hi)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		int32_t s = swap ? (int32_t)swap_uint32(buf[i]) : buf[i];
+
+		s = scale_one(s, gain[j], lo, hi);
+		buf[i] = swap ? swap_uint32(s) : s;
+		if (++j == period)
+			j = 0;
+	}
+}
+
+static inline uint32_t xorshift32(uint32_t x)
+{
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return x;
+}
+
+/*
+ * Float stage: samples are scaled in float32 (in units of the output LSB),
+ * triangular (TPDF) noise of +-amp LSB is added, and the result is rounded to
+ * nearest and clipped to [lo, hi].  amp is 0 for channels at unity gain so
+ * that they pass through unchanged.
+ *
+ * Sample i uses dither state i % 4 so that the scalar and vector versions
+ * produce the same output.
+ */
+static void scale_f32_tail(int32_t *buf, unsigned int n, const float *gain,
+		const float *amp, unsigned int j, unsigned int period, float lo,
+		float hi, uint32_t *seed)
+{
+	const float unit = 1.0f / (1 << 24);
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		uint32_t *x = &seed[i & 3];
+		float noise, f;
+
+		*x = xorshift32(*x);
+		noise = (*x >> 8) * unit;
+		*x = xorshift32(*x);
+		noise += (*x >> 8) * unit;
+
+		f = buf[i] * gain[j] + (noise - 1.0f) * amp[j];
+		if (f < lo)
+			f = lo;
+		else if (f > hi)
+			f = hi;
+		buf[i] = lrintf(f);
+		if (++j == period)
+			j = 0;
+	}
+}
+
+static void scale_s16_scalar(int16_t *buf, unsigned int n, const double *gain,
+		unsigned int period, int swap)
+{
+	scale_s16_tail(buf, n, gain, 0, period, swap);
+}
+
+static void scale_s32_scalar(int32_t *buf, unsigned int n, const double *gain,
+		unsigned int period, int swap, double lo, double hi)
+{
+	scale_s32_tail(buf, n, gain, 0, period, swap, lo, hi);
+}
+
+static void scale_f32_scalar(int32_t *buf, unsigned int n, const float *gain,
+		const float *amp, unsigned int period, float lo, float hi,
+		uint32_t *seed)
+{
+	scale_f32_tail(buf, n, gain, amp, 0, period, lo, hi, seed);
+}
+
+#ifdef SCALE_X86
+
+/* sse2 {{{ */
+
+__attribute__((target("sse2")))
+static inline __m128i bswap16_sse2(__m128i v)
+{
+	return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i bswap32_sse2(__m128i v)
+{
+	v = bswap16_sse2(v);
+	return _mm_or_si128(_mm_slli_epi32(v, 16), _mm_srli_epi32(v, 16));
+}
+
+__attribute__((target("sse2")))
+static inline __m128d round_clamp_sse2(__m128d x, __m128d lo, __m128d hi)
+{
+	const __m128d sign = _mm_set1_pd(-0.0);
+	const __m128d half = _mm_set1_pd(0.5);
+
+	/* +-0.5 and truncation rounds half away from zero */
+	x = _mm_add_pd(x, _mm_or_pd(_mm_and_pd(x, sign), half));
+	return _mm_min_pd(_mm_max_pd(x, lo), hi);
+}
+
+__attribute__((target("sse2")))
+static inline __m128i scale4_sse2(__m128i s, const double *gain, __m128d lo,
+		__m128d hi)
+{
+	__m128d a = _mm_cvtepi32_pd(s);
+	__m128d b = _mm_cvtepi32_pd(_mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+
+	a = round_clamp_sse2(_mm_mul_pd(a, _mm_loadu_pd(gain)), lo, hi);
+	b = round_clamp_sse2(_mm_mul_pd(b, _mm_loadu_pd(gain + 2)), lo, hi);
+	return _mm_unpacklo_epi64(_mm_cvttpd_epi32(a), _mm_cvttpd_epi32(b));
+}
+
+__attribute__((target("sse2")))
+static void scale_s16_sse2(int16_t *buf, unsigned int n, const double *gain,
+		unsigned int period, int swap)
+{
+	const __m128d lo = _mm_set1_pd(INT16_MIN);
+	const __m128d hi = _mm_set1_pd(INT16_MAX);
+	unsigned int i, j = 0;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m128i v = _mm_loadu_si128((__m128i *)(buf + i));
+		__m128i l, h;
+
+		if (swap)
+			v = bswap16_sse2(v);
+		l = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+		h = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+		l = scale4_sse2(l, gain + j, lo, hi);
+		h = scale4_sse2(h, gain + j + 4, lo, hi);
+		v = _mm_packs_epi32(l, h);
+		if (swap)
+			v = bswap16_sse2(v);
+		_mm_storeu_si128((__m128i *)(buf + i), v);
+
+		j += 8;
+		if (j == period)
+			j = 0;
+	}
+	scale_s16_tail(buf + i, n - i, gain, j, period, swap);
+}
+
+__attribute__((target("sse2")))
+static void scale_s32_sse2(int32_t *buf, unsigned int n, const double *gain,
+		unsigned int period, int swap, double lo, double hi)
+{
+	const __m128d vlo = _mm_set1_pd(lo);
+	const __m128d vhi = _mm_set1_pd(hi);
+	unsigned int i, j = 0;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128i v = _mm_loadu_si128((__m128i *)(buf + i));
+
+		if (swap)
+			v = bswap32_sse2(v);
+		v = scale4_sse2(v, gain + j, vlo, vhi);
+		if (swap)
+			v = bswap32_sse2(v);
+		_mm_storeu_si128((__m128i *)(buf + i), v);
+
+		j += 4;
+		if (j == period)
+			j = 0;
+	}
+	scale_s32_tail(buf + i, n - i, gain, j, period, swap, lo, hi);
+}
+
+__attribute__((target("sse2")))
+static inline __m128i xorshift32_sse2(__m128i x)
+{
+	x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+	x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+	return _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+}
+
+/* also used by the avx2 implementation */
+__attribute__((target("sse2")))
+static void scale_f32_sse2(int32_t *buf, unsigned int n, const float *gain,
+		const float *amp, unsigned int period, float lo, float hi,
+		uint32_t *seed)
+{
+	const __m128 unit = _mm_set1_ps(1.0f / (1 << 24));
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 vlo = _mm_set1_ps(lo);
+	const __m128 vhi = _mm_set1_ps(hi);
+	__m128i x = _mm_loadu_si128((__m128i *)seed);
+	unsigned int i, j = 0;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128 f = _mm_cvtepi32_ps(_mm_loadu_si128((__m128i *)(buf + i)));
+		__m128 noise;
+
+		x = xorshift32_sse2(x);
+		noise = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(x, 8)), unit);
+		x = xorshift32_sse2(x);
+		noise = _mm_add_ps(noise,
+				_mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(x, 8)), unit));
+
+		f = _mm_mul_ps(f, _mm_loadu_ps(gain + j));
+		noise = _mm_mul_ps(_mm_sub_ps(noise, one), _mm_loadu_ps(amp + j));
+		f = _mm_add_ps(f, noise);
+		f = _mm_min_ps(_mm_max_ps(f, vlo), vhi);
+		_mm_storeu_si128((__m128i *)(buf + i), _mm_cvtps_epi32(f));
+
+		j += 4;
+		if (j == period)
+			j = 0;
+	}
+	_mm_storeu_si128((__m128i *)seed, x);
+	scale_f32_tail(buf + i, n - i, gain, amp, j, period, lo, hi, seed);
+}
+
+/* }}} */
+
+/* avx2 {{{ */
+
+__attribute__((target("avx2")))
+static inline __m256i bswap16_avx2(__m256i v)
+{
+	const __m256i mask = _mm256_setr_epi8(
+			1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+			1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+
+	return _mm256_shuffle_epi8(v, mask);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i bswap32_avx2(__m256i v)
+{
+	const __m256i mask = _mm256_setr_epi8(
+			3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+			3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+	return _mm256_shuffle_epi8(v, mask);
+}
+
+__attribute__((target("avx2")))
+static inline __m256d round_clamp_avx2(__m256d x, __m256d lo, __m256d hi)
+{
+	const __m256d sign = _mm256_set1_pd(-0.0);
+	const __m256d half = _mm256_set1_pd(0.5);
+
+	x = _mm256_add_pd(x, _mm256_or_pd(_mm256_and_pd(x, sign), half));
+	return _mm256_min_pd(_mm256_max_pd(x, lo), hi);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i scale8_avx2(__m256i s, const double *gain, __m256d lo,
+		__m256d hi)
+{
+	__m256d a = _mm256_cvtepi32_pd(_mm256_castsi256_si128(s));
+	__m256d b = _mm256_cvtepi32_pd(_mm256_extracti128_si256(s, 1));
+
+	a = round_clamp_avx2(_mm256_mul_pd(a, _mm256_loadu_pd(gain)), lo, hi);
+	b = round_clamp_avx2(_mm256_mul_pd(b, _mm256_loadu_pd(gain + 4)), lo, hi);
+	return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm256_cvttpd_epi32(a)),
+			_mm256_cvttpd_epi32(b), 1);
+}
+
+__attribute__((target("avx2")))
+static void scale_s16_avx2(int16_t *buf, unsigned int n, const double *gain,
+		unsigned int period, int swap)
+{
+	const __m256d lo = _mm256_set1_pd(INT16_MIN);
+	const __m256d hi = _mm256_set1_pd(INT16_MAX);
+	unsigned int i, j = 0;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		__m256i v = _mm256_loadu_si256((__m256i *)(buf + i));
+		__m256i l, h;
+
+		if (swap)
+			v = bswap16_avx2(v);
+		l = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(v));
+		h = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(v, 1));
+		l = scale8_avx2(l, gain + j, lo, hi);
+		h = scale8_avx2(h, gain + j + 8, lo, hi);
+		/* packs works within 128-bit lanes */
+		v = _mm256_permute4x64_epi64(_mm256_packs_epi32(l, h),
+				_MM_SHUFFLE(3, 1, 2, 0));
+		if (swap)
+			v = bswap16_avx2(v);
+		_mm256_storeu_si256((__m256i *)(buf + i), v);
+
+		j += 16;
+		if (j == period)
+			j = 0;
+	}
+	scale_s16_tail(buf + i, n - i, gain, j, period, swap);
+}
+
+__attribute__((target("avx2")))
+static void scale_s32_avx2(int32_t *buf, unsigned int n, const double *gain,
+		unsigned int period, int swap, double lo, double hi)
+{
+	const __m256d vlo = _mm256_set1_pd(lo);
+	const __m256d vhi = _mm256_set1_pd(hi);
+	unsigned int i, j = 0;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256i v = _mm256_loadu_si256((__m256i *)(buf + i));
+
+		if (swap)
+			v = bswap32_avx2(v);
+		v = scale8_avx2(v, gain + j, vlo, vhi);
+		if (swap)
+			v = bswap32_avx2(v);
+		_mm256_storeu_si256((__m256i *)(buf + i), v);
+
+		j += 8;
+		if (j == period)
+			j = 0;
+	}
+	scale_s32_tail(buf + i, n - i, gain, j, period, swap, lo, hi);
+}
+
+/* }}} */
+
+#endif
+
+static const struct scale_ops scale_ops[NR_SCALE_IMPLS] = {
+	[SCALE_IMPL_SCALAR] = { "scalar", scale_s16_scalar, scale_s32_scalar,
+		scale_f32_scalar },
+#ifdef SCALE_X86
+	[SCALE_IMPL_SSE2] = { "sse2", scale_s16_sse2, scale_s32_sse2,
+		scale_f32_sse2 },
+	[SCALE_IMPL_AVX2] = { "avx2", scale_s16_avx2, scale_s32_avx2,
+		scale_f32_sse2 },
+#else
+	[SCALE_IMPL_SSE2] = { "sse2", NULL, NULL, NULL },
+	[SCALE_IMPL_AVX2] = { "avx2", NULL, NULL, NULL },
+#endif
+};
+
+static const struct scale_ops *ops;
+
+static int scale_impl_supported(enum scale_impl impl)
+{
+	switch (impl) {
+	case SCALE_IMPL_SCALAR:
+		return 1;
+#ifdef SCALE_X86
+	case SCALE_IMPL_SSE2:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("sse2");
+	case SCALE_IMPL_AVX2:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+#endif
+	default:
+		return 0;
+	}
+}
+
+int scale_set_impl(enum scale_impl impl)
+{
+	if (impl < 0 || impl >= NR_SCALE_IMPLS || !scale_impl_supported(impl))
+		return -1;
+	ops = &scale_ops[impl];
+	return 0;
+}
+
+const char *scale_impl_name(enum scale_impl impl)
+{
+	return scale_ops[impl].name;
+}
+
+static void scale_select_impl(void)
+{
+	int impl;
+
+	for (impl = NR_SCALE_IMPLS - 1; impl >= 0; impl--) {
+		if (scale_set_impl(impl) == 0)
+			break;
+	}
+}
+
+static void unpack_block(int32_t *dst, const char *buf, unsigned int n,
+		unsigned int bits, int bigendian)
+{
+	const unsigned char *b = (const unsigned char *)buf;
+	unsigned int i;
+
+	if (bits == 16) {
+		for (i = 0; i < n; i++, b += 2) {
+			if (bigendian)
+				dst[i] = (int16_t)((b[0] << 8) | b[1]);
+			else
+				dst[i] = (int16_t)(b[0] | (b[1] << 8));
+		}
+		return;
+	}
+	for (i = 0; i < n; i++, b += 3) {
+		if (bigendian)
+			dst[i] = ((signed char)b[0] << 16) | (b[1] << 8) | b[2];
+		else
+			dst[i] = b[0] | (b[1] << 8) | ((signed char)b[2] << 16);
+	}
+}
+
+static void pack_block(char *buf, const int32_t *src, unsigned int n,
+		unsigned int bits, int bigendian)
+{
+	unsigned char *b = (unsigned char *)buf;
+	unsigned int i;
+
+	if (bits == 16) {
+		for (i = 0; i < n; i++, b += 2) {
+			if (bigendian) {
+				b[0] = src[i] >> 8;
+				b[1] = src[i];
+			} else {
+				b[0] = src[i];
+				b[1] = src[i] >> 8;
+			}
+		}
+		return;
+	}
+	for (i = 0; i < n; i++, b += 3) {
+		if (bigendian) {
+			b[0] = src[i] >> 16;
+			b[1] = src[i] >> 8;
+			b[2] = src[i];
+		} else {
+			b[0] = src[i];
+			b[1] = src[i] >> 8;
+			b[2] = src[i] >> 16;
+		}
+	}
+}
+
+/*
+ * Scales 16 or 24 bit samples via 32-bit blocks, either with the double
+ * kernel or (if fgain is set) through the float stage.
+ */
+static void scale_blocks(char *buf, unsigned int n, unsigned int bits,
+		int bigendian, const double *gain, const float *fgain,
+		const float *amp, unsigned int period)
+{
+	/* whole periods so that each block starts at gain[0] */
+	unsigned int block = SCALE_BLOCK / period * period;
+	unsigned int size = bits / 8;
+	int32_t lo = bits == 16 ? INT16_MIN : S24_MIN;
+	int32_t hi = bits == 16 ? INT16_MAX : S24_MAX;
+	int32_t tmp[SCALE_BLOCK];
+
+	while (n) {
+		unsigned int k = min_u(n, block);
+
+		unpack_block(tmp, buf, k, bits, bigendian);
+		if (fgain)
+			ops->f32(tmp, k, fgain, amp, period, lo, hi, dither_seed);
+		else
+			ops->s32(tmp, k, gain, period, 0, lo, hi);
+		pack_block(buf, tmp, k, bits, bigendian);
+		buf += k * size;
+		n -= k;
+	}
+}
+
+void scale_samples_sf(char *buf, unsigned int count, sample_format_t sf,
+		const int *vol, unsigned int flags)
+{
+	double gain[SCALE_MAX_PERIOD];
+	float fgain[SCALE_MAX_PERIOD];
+	float amp[SCALE_MAX_PERIOD];
+	unsigned int ch = sf_get_channels(sf);
+	unsigned int bits = sf_get_bits(sf);
+	unsigned int period, i;
+	int swap;
+
+	if (!sf_get_signed(sf) || ch == 0 || ch > CHANNELS_MAX)
+		return;
+	if (bits != 16 && bits != 24 && bits != 32)
+		return;
+
+	/* unity on every channel, keep the output bit-perfect */
+	for (i = 0; i < ch; i++) {
+		if (vol[i] != SCALE_UNITY)
+			break;
+	}
+	if (i == ch)
+		return;
+
+	if (!ops)
+		scale_select_impl();
+
+	period = ch * SCALE_PERIOD_FRAMES;
+	for (i = 0; i < period; i++) {
+		gain[i] = (double)vol[i % ch] / SCALE_UNITY;
+		fgain[i] = gain[i];
+		amp[i] = vol[i % ch] == SCALE_UNITY ? 0.0f : 1.0f;
+	}
+
+#ifdef WORDS_BIGENDIAN
+	swap = !sf_get_bigendian(sf);
+#else
+	swap = sf_get_bigendian(sf);
+#endif
+
+	switch (bits) {
+	case 16:
+		if (flags & SCALE_DITHER)
+			scale_blocks(buf, count / 2, 16, sf_get_bigendian(sf),
+					gain, fgain, amp, period);
+		else
+			ops->s16((int16_t *)buf, count / 2, gain, period, swap);
+		break;
+	case 24:
+		scale_blocks(buf, count / 3, 24, sf_get_bigendian(sf), gain,
+				flags & SCALE_DITHER ? fgain : NULL, amp, period);
+		break;
+	case 32:
+		/* float32 can't represent 32-bit samples, dither would be lost */
+		ops->s32((int32_t *)buf, count / 4, gain, period, swap,
+				INT32_MIN, INT32_MAX);
+		break;
+	}
+}
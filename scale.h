@@ -0,0 +1,59 @@
+/*
+ * Copyright 2008-2013 Various Authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CMUS_SCALE_H
+#define CMUS_SCALE_H
+
+#include "sf.h"
+
+/* volume factors are 16.16 fixed point */
+#define SCALE_UNITY 65536
+
+enum scale_impl {
+	SCALE_IMPL_SCALAR,
+	SCALE_IMPL_SSE2,
+	SCALE_IMPL_AVX2,
+	NR_SCALE_IMPLS
+};
+
+/*
+ * Scale in float32 and add TPDF dither before requantizing.  Applies to 16
+ * and 24 bit samples only; 32-bit samples are always scaled at full
+ * precision without dither.  Channels at SCALE_UNITY are not dithered.
+ */
+#define SCALE_DITHER	(1 << 0)
+
+/*
+ * Multiplies interleaved samples in place by one factor per channel,
+ * rounding half away from zero (or dithering, see SCALE_DITHER) and
+ * saturating.
+ *
+ * Signed 16, 24 and 32 bit samples of either byte order and any number of
+ * channels are supported, other formats are left untouched.  @buf must start
+ * at a frame boundary.
+ */
+void scale_samples_sf(char *buf, unsigned int count, sample_format_t sf,
+		const int *vol, unsigned int flags);
+
+/*
+ * The fastest implementation supported by the cpu is selected by default.
+ * Returns -1 if @impl is not supported.
+ */
+int scale_set_impl(enum scale_impl impl);
+const char *scale_impl_name(enum scale_impl impl);
+
+#endif
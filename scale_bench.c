@@ -0,0 +1,310 @@
+/*
+ * Copyright 2008-2013 Various Authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmark for the soft volume / ReplayGain kernels in scale.c.
+ *
+ * Compares every kernel supported by the cpu against the stereo-only
+ * per-sample code player.c used before, and checks that they agree.
+ *
+ *     make scale_bench && ./scale_bench
+ */
+
+#include "scale.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#define SOFT_VOL_SCALE SCALE_UNITY
+
+/* reference implementation {{{ */
+
+static inline void scale_sample_int16_t(int16_t *buf, int i, int vol, int swap)
+{
+	int32_t sample = swap ? (int16_t)swap_uint16(buf[i]) : buf[i];
+
+	if (sample < 0) {
+		sample = (sample * vol - SOFT_VOL_SCALE / 2) / SOFT_VOL_SCALE;
+		if (sample < INT16_MIN)
+			sample = INT16_MIN;
+	} else {
+		sample = (sample * vol + SOFT_VOL_SCALE / 2) / SOFT_VOL_SCALE;
+		if (sample > INT16_MAX)
+			sample = INT16_MAX;
+	}
+	buf[i] = swap ? swap_uint16(sample) : sample;
+}
+
+static inline int32_t scale_sample_s24le(int32_t s, int vol)
+{
+	int64_t sample = s;
+	if (sample < 0) {
+		sample = (sample * vol - SOFT_VOL_SCALE / 2) / SOFT_VOL_SCALE;
+		if (sample < -0x800000)
+			sample = -0x800000;
+	} else {
+		sample = (sample * vol + SOFT_VOL_SCALE / 2) / SOFT_VOL_SCALE;
+		if (sample > 0x7fffff)
+			sample = 0x7fffff;
+	}
+	return sample;
+}
+
+static inline void scale_sample_int32_t(int32_t *buf, int i, int vol, int swap)
+{
+	int64_t sample = swap ? (int32_t)swap_uint32(buf[i]) : buf[i];
+
+	if (sample < 0) {
+		sample = (sample * vol - SOFT_VOL_SCALE / 2) / SOFT_VOL_SCALE;
+		if (sample < INT32_MIN)
+			sample = INT32_MIN;
+	} else {
+		sample = (sample * vol + SOFT_VOL_SCALE / 2) / SOFT_VOL_SCALE;
+		if (sample > INT32_MAX)
+			sample = INT32_MAX;
+	}
+	buf[i] = swap ? swap_uint32(sample) : sample;
+}
+
+static inline int sf_need_swap(sample_format_t sf)
+{
+#ifdef WORDS_BIGENDIAN
+	return !sf_get_bigendian(sf);
+#else
+	return sf_get_bigendian(sf);
+#endif
+}
+
+#define REF_SCALE_SAMPLES(TYPE, buffer, count, l, r, swap)				\
+{										\
+	const int frames = count / sizeof(TYPE) / 2;				\
+	TYPE *buf = (void *) buffer;						\
+	int i;									\
+	/* avoid underflowing -32768 to 32767 when scale is 65536 */		\
+	if (l != SOFT_VOL_SCALE && r != SOFT_VOL_SCALE) {			\
+		for (i = 0; i < frames; i++) {					\
+			scale_sample_##TYPE(buf, i * 2, l, swap);		\
+			scale_sample_##TYPE(buf, i * 2 + 1, r, swap);		\
+		}								\
+	} else if (l != SOFT_VOL_SCALE) {					\
+		for (i = 0; i < frames; i++)					\
+			scale_sample_##TYPE(buf, i * 2, l, swap);		\
+	} else if (r != SOFT_VOL_SCALE) {					\
+		for (i = 0; i < frames; i++)					\
+			scale_sample_##TYPE(buf, i * 2 + 1, r, swap);		\
+	}									\
+}
+
+static inline int32_t read_s24le(const char *buf)
+{
+	const unsigned char *b = (const unsigned char *) buf;
+	return b[0] | (b[1] << 8) | (((const signed char *) buf)[2] << 16);
+}
+
+static inline void write_s24le(char *buf, int32_t x)
+{
+	unsigned char *b = (unsigned char *) buf;
+	b[0] = x;
+	b[1] = x >> 8;
+	b[2] = x >> 16;
+}
+
+static void scale_samples_s24le(char *buf, unsigned int count, int l, int r)
+{
+	int frames = count / 3 / 2;
+	if (l != SOFT_VOL_SCALE && r != SOFT_VOL_SCALE) {
+		while (frames--) {
+			write_s24le(buf, scale_sample_s24le(read_s24le(buf), l));
+			buf += 3;
+			write_s24le(buf, scale_sample_s24le(read_s24le(buf), r));
+			buf += 3;
+		}
+	} else if (l != SOFT_VOL_SCALE) {
+		while (frames--) {
+			write_s24le(buf, scale_sample_s24le(read_s24le(buf), l));
+			buf += 3 * 2;
+		}
+	} else if (r != SOFT_VOL_SCALE) {
+		buf += 3;
+		while (frames--) {
+			write_s24le(buf, scale_sample_s24le(read_s24le(buf), r));
+			buf += 3 * 2;
+		}
+	}
+}
+
+/* }}} */
+
+#define BENCH_BYTES (4 * 1024 * 1024)
+#define BENCH_ROUNDS 20
+
+static char src_buf[BENCH_BYTES];
+static char ref_buf[BENCH_BYTES];
+static char dst_buf[BENCH_BYTES];
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void ref_scale(char *b, unsigned int count, int bits, int swap, int l, int r)
+{
+	switch (bits) {
+	case 16:
+		REF_SCALE_SAMPLES(int16_t, b, count, l, r, swap);
+		break;
+	case 24:
+		scale_samples_s24le(b, count, l, r);
+		break;
+	case 32:
+		REF_SCALE_SAMPLES(int32_t, b, count, l, r, swap);
+		break;
+	}
+}
+
+static void bench(int bits, int bigendian, unsigned int channels)
+{
+	sample_format_t sf = sf_signed(1) | sf_bits(bits) | sf_channels(channels) |
+		sf_bigendian(bigendian) | sf_rate(44100);
+	unsigned int frame = bits / 8 * channels;
+	unsigned int count = BENCH_BYTES / frame * frame;
+	unsigned int samples = count / (bits / 8);
+	int vol[8] = { 0x5466, 0xb8b7, 0x9b35, 0x4f11, 0xefd3, 0x2297, 0x826a, 0x0ccc };
+	int swap;
+	double t;
+	int i, impl;
+
+#ifdef WORDS_BIGENDIAN
+	swap = !bigendian;
+#else
+	swap = bigendian;
+#endif
+
+	printf("s%d%s %u ch:\n", bits, bigendian ? "be" : "le", channels);
+
+	/* the old code handled only stereo and s24le */
+	if (channels == 2 && (bits != 24 || !bigendian)) {
+		memcpy(ref_buf, src_buf, count);
+		t = now();
+		for (i = 0; i < BENCH_ROUNDS; i++) {
+			memcpy(dst_buf, src_buf, count);
+			ref_scale(dst_buf, count, bits, swap, vol[0], vol[1]);
+		}
+		t = now() - t;
+		memcpy(ref_buf, dst_buf, count);
+		printf("  %-8s %6.2f ns/sample\n", "old", t * 1e9 / BENCH_ROUNDS / samples);
+	}
+
+	for (impl = 0; impl < NR_SCALE_IMPLS; impl++) {
+		if (scale_set_impl(impl))
+			continue;
+		t = now();
+		for (i = 0; i < BENCH_ROUNDS; i++) {
+			memcpy(dst_buf, src_buf, count);
+			scale_samples_sf(dst_buf, count, sf, vol, 0);
+		}
+		t = now() - t;
+		printf("  %-8s %6.2f ns/sample", scale_impl_name(impl),
+				t * 1e9 / BENCH_ROUNDS / samples);
+		if (channels == 2 && (bits != 24 || !bigendian))
+			printf("  %s", memcmp(ref_buf, dst_buf, count) ? "MISMATCH" : "ok");
+		printf("\n");
+	}
+
+	if (bits == 32)
+		return;
+
+	/*
+	 * dither adds at most +-1 LSB to the rounded result, float32 rounding
+	 * of loud 24-bit samples at most another LSB
+	 */
+	for (impl = 0; impl < NR_SCALE_IMPLS; impl++) {
+		unsigned int bad = 0, size = bits / 8;
+		int tolerance = bits == 16 ? 1 : 2;
+
+		if (scale_set_impl(impl))
+			continue;
+		memcpy(ref_buf, src_buf, count);
+		scale_samples_sf(ref_buf, count, sf, vol, 0);
+		t = now();
+		for (i = 0; i < BENCH_ROUNDS; i++) {
+			memcpy(dst_buf, src_buf, count);
+			scale_samples_sf(dst_buf, count, sf, vol, SCALE_DITHER);
+		}
+		t = now() - t;
+		for (i = 0; i < count; i += size) {
+			const unsigned char *a = (unsigned char *)ref_buf + i;
+			const unsigned char *b = (unsigned char *)dst_buf + i;
+			int32_t x, y;
+
+			if (bigendian) {
+				x = size == 2 ? (int16_t)(a[0] << 8 | a[1]) : ((signed char)a[0] << 16 | a[1] << 8 | a[2]);
+				y = size == 2 ? (int16_t)(b[0] << 8 | b[1]) : ((signed char)b[0] << 16 | b[1] << 8 | b[2]);
+			} else {
+				x = size == 2 ? (int16_t)(a[1] << 8 | a[0]) : ((signed char)a[2] << 16 | a[1] << 8 | a[0]);
+				y = size == 2 ? (int16_t)(b[1] << 8 | b[0]) : ((signed char)b[2] << 16 | b[1] << 8 | b[0]);
+			}
+			if (x - y > tolerance || y - x > tolerance)
+				bad++;
+		}
+		printf("  %-8s %6.2f ns/sample dithered  %s\n", scale_impl_name(impl),
+				t * 1e9 / BENCH_ROUNDS / samples, bad ? "MISMATCH" : "ok");
+	}
+
+	/* channels at unity gain must pass through the dithered path unchanged */
+	for (impl = 0; impl < NR_SCALE_IMPLS; impl++) {
+		int unity[8];
+		unsigned int bad = 0, size = bits / 8;
+
+		if (scale_set_impl(impl))
+			continue;
+		for (i = 0; i < channels; i++)
+			unity[i] = i ? vol[i] : SCALE_UNITY;
+		memcpy(dst_buf, src_buf, count);
+		scale_samples_sf(dst_buf, count, sf, unity, SCALE_DITHER);
+		for (i = 0; i < count; i += size * channels)
+			bad += memcmp(src_buf + i, dst_buf + i, size) != 0;
+		for (i = 0; i < channels; i++)
+			unity[i] = SCALE_UNITY;
+		memcpy(dst_buf, src_buf, count);
+		scale_samples_sf(dst_buf, count, sf, unity, SCALE_DITHER);
+		bad += memcmp(src_buf, dst_buf, count) != 0;
+		printf("  %-8s unity dithered  %s\n", scale_impl_name(impl),
+				bad ? "MISMATCH" : "ok");
+	}
+}
+
+int main(void)
+{
+	static const int formats[][2] = { { 16, 0 }, { 16, 1 }, { 24, 0 }, { 24, 1 }, { 32, 0 }, { 32, 1 } };
+	unsigned int i;
+
+	srand(1);
+	for (i = 0; i < BENCH_BYTES; i++)
+		src_buf[i] = rand();
+
+	for (i = 0; i < N_ELEMENTS(formats); i++) {
+		bench(formats[i][0], formats[i][1], 2);
+		bench(formats[i][0], formats[i][1], 8);
+	}
+	return 0;
+}
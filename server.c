@@ -34,8 +34,8 @@
 #include "keyval.h"
 #include "convert.h"
 #include "format_print.h"
+#include "play_queue.h"
 
-#include <stdarg.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -62,67 +62,68 @@ static union {
 	struct sockaddr_storage sas;
 } addr;
 
-#define MAX_CLIENTS 10
+/* longest command line a client may send */
+#define MAX_LINE_SIZE		(64 * 1024)
+/* stop running commands of a client that does not read its answers */
+#define MAX_PENDING_OUTPUT	(256 * 1024)
+/* output that a single answer may add, the client is dropped above this */
+#define MAX_ANSWER_SIZE		(64 * 1024 * 1024)
+/* commands run per client before other clients and the UI get a turn */
+#define MAX_BATCH		32
+
+static int nr_clients;
+/* length of the client output before the running command */
+static size_t answer_start;
+static int nr_subscribers;
+/* last pq_editable.generation sent to subscribers */
+static unsigned int queue_generation;
+
+static size_t pending_output(const struct client *client)
+{
+	return client->out.len - client->out_pos;
+}
 
-static int cmd_status(struct client *client)
+static void add_track(struct gbuf *buf)
 {
-	const char *export_options[] = {
-		"aaa_mode",
-		"continue",
-		"play_library",
-		"play_sorted",
-		"replaygain",
-		"replaygain_limit",
-		"replaygain_preamp",
-		"repeat",
-		"repeat_current",
-		"shuffle",
-		"softvol",
-		NULL
-	};
-	const struct track_info *ti;
-	struct cmus_opt *opt;
-	char optbuf[OPTION_MAX_SIZE];
-	GBUF(buf);
-	int vol_left, vol_right;
-	int i, ret;
-	enum player_status status;
+	const struct track_info *ti = player_info.ti;
+	int i;
 
-	gbuf_addf(&buf, "status %s\n", player_status_names[player_info.status]);
-	ti = player_info.ti;
 	if (ti) {
-		gbuf_addf(&buf, "file %s\n", escape(ti->filename));
-		gbuf_addf(&buf, "duration %d\n", ti->duration);
-		gbuf_addf(&buf, "position %d\n", player_info.pos);
+		gbuf_addf(buf, "file %s\n", escape(ti->filename));
+		gbuf_addf(buf, "duration %d\n", ti->duration);
+		gbuf_addf(buf, "position %d\n", player_info.pos);
 		for (i = 0; ti->comments[i].key; i++)
-			gbuf_addf(&buf, "tag %s %s\n",
+			gbuf_addf(buf, "tag %s %s\n",
 					ti->comments[i].key,
 					escape(ti->comments[i].val));
 	}
 
 	/* add track metadata to cmus-status */
-	status = player_info.status;
-	if (status == PLAYER_STATUS_PLAYING && ti && is_http_url(player_info.ti->filename)) {
-	const char *title = get_stream_title();
+	if (player_info.status == PLAYER_STATUS_PLAYING && ti && is_http_url(ti->filename)) {
+		const char *title = get_stream_title();
 		if (title != NULL) {
 			free(title_buf);
 			title_buf = to_utf8(title, icecast_default_charset);
 			// we have a stream title (probably artist/track/album info)
-			gbuf_addf(&buf, "stream %s\n", escape(title_buf));
+			gbuf_addf(buf, "stream %s\n", escape(title_buf));
 		} else if (ti->comment != NULL) {
 			// fallback to the radio station name
-			gbuf_addf(&buf, "stream %s\n", escape(ti->comment));
+			gbuf_addf(buf, "stream %s\n", escape(ti->comment));
 		}
 	}
+}
 
-	/* output options */
-	for (i = 0; export_options[i]; i++) {
-		opt = option_find(export_options[i]);
-		if (opt) {
-			opt->get(opt->data, optbuf, OPTION_MAX_SIZE);
-			gbuf_addf(&buf, "set %s %s\n", opt->name, optbuf);
-		}
-	}
+static void add_option(struct gbuf *buf, const struct cmus_opt *opt)
+{
+	char optbuf[OPTION_MAX_SIZE];
+
+	opt->get(opt->data, optbuf, OPTION_MAX_SIZE);
+	gbuf_addf(buf, "set %s %s\n", opt->name, optbuf);
+}
+
+static void add_volume(struct gbuf *buf)
+{
+	int vol_left, vol_right;
 
 	/* get volume (copied from ui_curses.c) */
 	if (soft_vol) {
@@ -135,25 +136,236 @@ static int cmd_status(struct client *client)
 		vol_right = scale_to_percentage(volume_r, volume_max);
 	}
 
-	/* output volume */
-	gbuf_addf(&buf, "set vol_left %d\n", vol_left);
-	gbuf_addf(&buf, "set vol_right %d\n", vol_right);
+	gbuf_addf(buf, "set vol_left %d\n", vol_left);
+	gbuf_addf(buf, "set vol_right %d\n", vol_right);
+}
 
-	gbuf_add_str(&buf, "\n");
+static void add_status(struct gbuf *buf)
+{
+	const char *export_options[] = {
+		"aaa_mode",
+		"continue",
+		"play_library",
+		"play_sorted",
+		"replaygain",
+		"replaygain_limit",
+		"replaygain_preamp",
+		"repeat",
+		"repeat_current",
+		"shuffle",
+		"softvol",
+		NULL
+	};
+	struct cmus_opt *opt;
+	int i;
 
-	ret = write_all(client->fd, buf.buffer, buf.len);
-	gbuf_free(&buf);
-	return ret;
+	gbuf_addf(buf, "status %s\n", player_status_names[player_info.status]);
+	add_track(buf);
+
+	/* output options */
+	for (i = 0; export_options[i]; i++) {
+		opt = option_find(export_options[i]);
+		if (opt)
+			add_option(buf, opt);
+	}
+
+	add_volume(buf);
+}
+
+static void cmd_status(struct client *client)
+{
+	add_status(&client->out);
+	gbuf_add_ch(&client->out, '\n');
+}
+
+/* answer is the status, events follow in blocks starting with "event <name>" */
+static void cmd_subscribe(struct client *client, const char *arg)
+{
+	long int interval = 1;
+
+	if (arg && (str_to_int(arg, &interval) || interval < 0 || interval > 3600)) {
+		set_client_output(&client->out);
+		error_msg("invalid position interval: %s", arg);
+		set_client_output(NULL);
+		gbuf_add_ch(&client->out, '\n');
+		return;
+	}
+
+	if (!client->subscribed) {
+		if (!nr_subscribers)
+			queue_generation = pq_editable.generation;
+		nr_subscribers++;
+		client->subscribed = 1;
+	}
+	client->missed = 0;
+	client->pos_interval = interval;
+	client->last_pos = player_info.pos;
+	cmd_status(client);
+}
+
+static void unsubscribe(struct client *client)
+{
+	if (client->subscribed) {
+		client->subscribed = 0;
+		nr_subscribers--;
+	}
+	gbuf_clear(&client->events);
+}
+
+static void event_begin(struct gbuf *buf, const char *name)
+{
+	gbuf_clear(buf);
+	gbuf_addf(buf, "event %s\n", name);
 }
 
-static int cmd_format_print(struct client *client, char *arg)
+/*
+ * queues the event in @buf for all subscribers.  a command can cause events
+ * for its own client, they must not end up inside its answer
+ */
+static void push_event(struct gbuf *buf)
+{
+	struct client *client;
+
+	gbuf_add_ch(buf, '\n');
+	list_for_each_entry(client, &client_head, node) {
+		if (!client->subscribed || client->missed)
+			continue;
+		if (pending_output(client) + client->events.len >= MAX_PENDING_OUTPUT) {
+			/* sent a full status when it catches up */
+			client->missed = 1;
+			gbuf_clear(&client->events);
+			continue;
+		}
+		gbuf_add_bytes(&client->events, buf->buffer, buf->len);
+	}
+}
+
+/* only between answers */
+static void flush_events(struct client *client)
+{
+	if (client->events.len) {
+		gbuf_add_bytes(&client->out, client->events.buffer, client->events.len);
+		gbuf_clear(&client->events);
+	}
+}
+
+/* the position is part of status and track events */
+static void reset_positions(void)
+{
+	struct client *client;
+
+	list_for_each_entry(client, &client_head, node)
+		client->last_pos = player_info.pos;
+}
+
+void server_status_changed(void)
+{
+	static GBUF(buf);
+
+	if (!nr_subscribers)
+		return;
+	event_begin(&buf, "status");
+	gbuf_addf(&buf, "status %s\n", player_status_names[player_info.status]);
+	gbuf_addf(&buf, "position %d\n", player_info.pos);
+	push_event(&buf);
+	reset_positions();
+}
+
+void server_track_changed(void)
+{
+	static GBUF(buf);
+
+	if (!nr_subscribers)
+		return;
+	event_begin(&buf, "track");
+	add_track(&buf);
+	push_event(&buf);
+	reset_positions();
+}
+
+void server_volume_changed(void)
+{
+	static GBUF(buf);
+
+	if (!nr_subscribers)
+		return;
+	event_begin(&buf, "volume");
+	add_volume(&buf);
+	push_event(&buf);
+}
+
+void server_option_changed(const char *name)
+{
+	static GBUF(buf);
+	struct cmus_opt *opt;
+
+	if (!nr_subscribers)
+		return;
+	opt = option_find(name);
+	if (!opt)
+		return;
+	event_begin(&buf, "option");
+	add_option(&buf, opt);
+	push_event(&buf);
+}
+
+void server_update(void)
+{
+	static GBUF(buf);
+	struct client *client;
+
+	if (!nr_subscribers)
+		return;
+
+	if (pq_editable.generation != queue_generation) {
+		queue_generation = pq_editable.generation;
+		event_begin(&buf, "queue");
+		gbuf_addf(&buf, "queue %u %u\n", pq_editable.nr_tracks,
+				pq_editable.total_time);
+		push_event(&buf);
+	}
+
+	list_for_each_entry(client, &client_head, node) {
+		int pos = player_info.pos;
+
+		if (!client->subscribed)
+			continue;
+		flush_events(client);
+		if (pending_output(client) >= MAX_PENDING_OUTPUT)
+			continue;
+
+		if (client->missed) {
+			client->missed = 0;
+			client->last_pos = pos;
+			gbuf_add_str(&client->out, "event sync\n");
+			add_status(&client->out);
+			gbuf_add_ch(&client->out, '\n');
+			continue;
+		}
+
+		/* ticks while playing, seeks are sent at once */
+		if (!client->pos_interval || !player_info.ti)
+			continue;
+		if (!player_info.seeked) {
+			if (pos == client->last_pos)
+				continue;
+			if (pos > client->last_pos && pos - client->last_pos < client->pos_interval)
+				continue;
+		}
+		client->last_pos = pos;
+		gbuf_addf(&client->out, "event position\nposition %d\n\n", pos);
+	}
+}
+
+static void cmd_format_print(struct client *client, char *arg)
 {
 	if (run_only_safe_commands) {
 		d_print("trying to execute unsafe command over net\n");
-		return write_all(client->fd, "\n", strlen("\n"));
+		gbuf_add_ch(&client->out, '\n');
+		return;
 	}
 
-	int args_idx, ac, i, ret;
+	int args_idx, ac, i;
 	char **args = NULL;
 
 	if (arg)
@@ -161,7 +373,8 @@ static int cmd_format_print(struct client *client, char *arg)
 
 	if (args == NULL) {
 		error_msg("not enough arguments\n");
-		return write_all(client->fd, "\n", strlen("\n"));
+		gbuf_add_ch(&client->out, '\n');
+		return;
 	}
 
 	GBUF(buf);
@@ -175,134 +388,248 @@ static int cmd_format_print(struct client *client, char *arg)
 	}
 	gbuf_add_ch(&buf, '\n');
 
-	ret = write_all(client->fd, buf.buffer, buf.len);
+	gbuf_add_bytes(&client->out, buf.buffer, buf.len);
 	gbuf_free(&buf);
 	free(args);
-	return ret;
 }
 
-static ssize_t send_answer(int fd, const char *format, ...)
+static void send_answer(struct client *client, const char *msg)
+{
+	d_print("%s\n", msg);
+	gbuf_addf(&client->out, "%s\n\n", msg);
+	/* ignore the rest of the input */
+	gbuf_clear(&client->in);
+	client->closing = 1;
+}
+
+/* returns length of the first complete line in the input, -1 if none */
+static ssize_t next_line(const struct client *client)
 {
-	char buf[512];
-	va_list ap;
+	const char *nl;
+
+	if (client->closing || pending_output(client) >= MAX_PENDING_OUTPUT)
+		return -1;
+	nl = memchr(client->in.buffer, '\n', client->in.len);
+	if (!nl)
+		return -1;
+	return nl - client->in.buffer;
+}
 
-	va_start(ap, format);
-	vsnprintf(buf, sizeof(buf), format, ap);
-	va_end(ap);
+static void run_client_command(struct client *client, char *line)
+{
+	char *cmd, *arg;
 
-	return write_all(fd, buf, strlen(buf));
+	if (!client->authenticated) {
+		if (!server_password) {
+			send_answer(client, "password is unset, tcp/ip disabled");
+			return;
+		}
+		if (strncmp(line, "passwd ", 7) == 0)
+			line += 7;
+		client->authenticated = !strcmp(line, server_password);
+		if (!client->authenticated) {
+			send_answer(client, "authentication failed");
+			return;
+		}
+		gbuf_add_ch(&client->out, '\n');
+		return;
+	}
+
+	while (isspace((unsigned char)*line))
+		line++;
+
+	if (*line == '/') {
+		int restricted = 0;
+		line++;
+		search_direction = SEARCH_FORWARD;
+		if (*line == '/') {
+			line++;
+			restricted = 1;
+		}
+		search_text(line, restricted, 1);
+	} else if (*line == '?') {
+		int restricted = 0;
+		line++;
+		search_direction = SEARCH_BACKWARD;
+		if (*line == '?') {
+			line++;
+			restricted = 1;
+		}
+		search_text(line, restricted, 1);
+	} else if (parse_command(line, &cmd, &arg)) {
+		int answered = 0;
+
+		answer_start = client->out.len;
+
+		if (!strcmp(cmd, "status")) {
+			cmd_status(client);
+			answered = 1;
+		} else if (!strcmp(cmd, "subscribe")) {
+			cmd_subscribe(client, arg);
+			answered = 1;
+		} else if (!strcmp(cmd, "unsubscribe")) {
+			unsubscribe(client);
+		} else if (!strcmp(cmd, "format_print")) {
+			cmd_format_print(client, arg);
+			answered = 1;
+		} else if (strcmp(cmd, "passwd") != 0) {
+			set_client_output(&client->out);
+			run_parsed_command(cmd, arg);
+			set_client_output(NULL);
+		}
+		free(cmd);
+		free(arg);
+		if (server_output_full(&client->out)) {
+			client->out.len = answer_start;
+			client->out.buffer[answer_start] = 0;
+			send_answer(client, "answer too long");
+			return;
+		}
+		if (answered)
+			return;
+	}
+	/* empty line ends the answer, also for unknown commands so that
+	 * cmus-remote does not hang */
+	gbuf_add_ch(&client->out, '\n');
 }
 
-static void read_commands(struct client *client)
+/*
+ * runs at most MAX_BATCH of the buffered commands.  a client that pipelines
+ * many commands is served in several main loop iterations
+ */
+static void run_commands(struct client *client)
 {
-	char buf[1024];
-	int pos = 0;
+	size_t start = 0;
+	int n;
+
 	if (!client->authenticated)
 		client->authenticated = addr.sa.sa_family == AF_UNIX;
 
+	for (n = 0; n < MAX_BATCH; n++) {
+		const char *nl;
+		char *line;
+
+		if (client->closing || pending_output(client) >= MAX_PENDING_OUTPUT)
+			break;
+		nl = memchr(client->in.buffer + start, '\n', client->in.len - start);
+		if (!nl)
+			break;
+
+		line = client->in.buffer + start;
+		start = nl - client->in.buffer + 1;
+		*(char *)nl = 0;
+		run_client_command(client, line);
+		flush_events(client);
+	}
+
+	/* send_answer() may have cleared the input */
+	if (start > client->in.len)
+		start = client->in.len;
+	if (start) {
+		memmove(client->in.buffer, client->in.buffer + start, client->in.len - start);
+		client->in.len -= start;
+		client->in.buffer[client->in.len] = 0;
+	}
+}
+
+/* returns -1 on error */
+static int read_input(struct client *client)
+{
 	while (1) {
-		int rc, s, i;
+		ssize_t rc;
+
+		if (client->in.len >= MAX_LINE_SIZE) {
+			if (!memchr(client->in.buffer, '\n', client->in.len)) {
+				d_print("command too long\n");
+				return -1;
+			}
+			/* run some of the buffered commands first */
+			return 0;
+		}
 
-		rc = read(client->fd, buf + pos, sizeof(buf) - pos);
+		gbuf_grow(&client->in, 4096);
+		rc = read(client->fd, client->in.buffer + client->in.len,
+				gbuf_avail(&client->in));
 		if (rc == -1) {
 			if (errno == EINTR)
 				continue;
-			if (errno == EAGAIN)
-				return;
-			goto close;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			return -1;
+		}
+		if (rc == 0) {
+			client->eof = 1;
+			return 0;
 		}
-		if (rc == 0)
-			goto close;
-		pos += rc;
+		client->in.len += rc;
+		client->in.buffer[client->in.len] = 0;
+	}
+}
 
-		s = 0;
-		for (i = 0; i < pos; i++) {
-			const char *line, *msg;
-			char *cmd, *arg;
-			int ret;
+/* returns -1 on error */
+static int flush_output(struct client *client)
+{
+	while (pending_output(client)) {
+		ssize_t rc;
 
-			if (buf[i] != '\n')
+		rc = write(client->fd, client->out.buffer + client->out_pos,
+				pending_output(client));
+		if (rc == -1) {
+			if (errno == EINTR)
 				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			d_print("write: %s\n", strerror(errno));
+			return -1;
+		}
+		client->out_pos += rc;
+	}
 
-			buf[i] = 0;
-			line = buf + s;
-			s = i + 1;
-
-			if (!client->authenticated) {
-				if (!server_password) {
-					msg = "password is unset, tcp/ip disabled";
-					d_print("%s\n", msg);
-					ret = send_answer(client->fd, "%s\n\n", msg);
-					goto close;
-				}
-				if (strncmp(line, "passwd ", 7) == 0)
-					line += 7;
-				client->authenticated = !strcmp(line, server_password);
-				if (!client->authenticated) {
-					msg = "authentication failed";
-					d_print("%s\n", msg);
-					ret = send_answer(client->fd, "%s\n\n", msg);
-					goto close;
-				}
-				ret = write_all(client->fd, "\n", 1);
-				continue;
-			}
+	if (!pending_output(client)) {
+		gbuf_clear(&client->out);
+		client->out_pos = 0;
+	} else if (client->out_pos >= MAX_PENDING_OUTPUT) {
+		size_t len = pending_output(client);
 
-			while (isspace((unsigned char)*line))
-				line++;
-
-			if (*line == '/') {
-				int restricted = 0;
-				line++;
-				search_direction = SEARCH_FORWARD;
-				if (*line == '/') {
-					line++;
-					restricted = 1;
-				}
-				search_text(line, restricted, 1);
-				ret = write_all(client->fd, "\n", 1);
-			} else if (*line == '?') {
-				int restricted = 0;
-				line++;
-				search_direction = SEARCH_BACKWARD;
-				if (*line == '?') {
-					line++;
-					restricted = 1;
-				}
-				search_text(line, restricted, 1);
-				ret = write_all(client->fd, "\n", 1);
-			} else if (parse_command(line, &cmd, &arg)) {
-				if (!strcmp(cmd, "status")) {
-					ret = cmd_status(client);
-				} else if (!strcmp(cmd, "format_print")) {
-					ret = cmd_format_print(client, arg);
-				} else {
-					if (strcmp(cmd, "passwd") != 0) {
-						set_client_fd(client->fd);
-						run_parsed_command(cmd, arg);
-						set_client_fd(-1);
-					}
-					ret = write_all(client->fd, "\n", 1);
-				}
-				free(cmd);
-				free(arg);
-			} else {
-				// don't hang cmus-remote
-				ret = write_all(client->fd, "\n", 1);
-			}
-			if (ret < 0) {
-				d_print("write: %s\n", strerror(errno));
-				goto close;
-			}
-		}
-		memmove(buf, buf + s, pos - s);
-		pos -= s;
+		memmove(client->out.buffer, client->out.buffer + client->out_pos, len);
+		client->out.len = len;
+		client->out.buffer[len] = 0;
+		client->out_pos = 0;
 	}
-	return;
-close:
+	return 0;
+}
+
+static void close_client(struct client *client)
+{
+	unsubscribe(client);
 	close(client->fd);
 	list_del(&client->node);
+	gbuf_free(&client->in);
+	gbuf_free(&client->out);
+	gbuf_free(&client->events);
 	free(client);
+	nr_clients--;
+}
+
+int server_output_full(const struct gbuf *out)
+{
+	return out->len - answer_start > MAX_ANSWER_SIZE;
+}
+
+int server_client_wants_input(const struct client *client)
+{
+	return !client->eof && !client->closing &&
+		pending_output(client) < MAX_PENDING_OUTPUT;
+}
+
+int server_client_wants_output(const struct client *client)
+{
+	return pending_output(client) > 0;
+}
+
+int server_client_has_commands(const struct client *client)
+{
+	return next_line(client) >= 0;
 }
 
 void server_accept(void)
@@ -316,20 +643,48 @@ void server_accept(void)
 	if (fd == -1)
 		return;
 
+	/* the main loop uses select() */
+	if (nr_clients >= remote_max_clients || fd >= FD_SETSIZE) {
+		d_print("too many clients, closing connection\n");
+		close(fd);
+		return;
+	}
+
 	fcntl(fd, F_SETFL, O_NONBLOCK);
 
-	client = xnew(struct client, 1);
+	client = xnew0(struct client, 1);
 	client->fd = fd;
-	client->authenticated = 0;
+	client->in.buffer = gbuf_empty_buffer;
+	client->out.buffer = gbuf_empty_buffer;
+	client->events.buffer = gbuf_empty_buffer;
 	list_add_tail(&client->node, &client_head);
+	nr_clients++;
 }
 
-void server_serve(struct client *client)
+void server_serve(struct client *client, int readable, int writable)
 {
+	if (writable && flush_output(client))
+		goto close;
+
+	if (readable && read_input(client))
+		goto close;
+
 	/* unix connection is secure, other insecure */
 	run_only_safe_commands = addr.sa.sa_family != AF_UNIX;
-	read_commands(client);
+	run_commands(client);
 	run_only_safe_commands = 0;
+
+	if (flush_output(client))
+		goto close;
+	if (pending_output(client))
+		return;
+	/* commands that were sent before EOF are still answered, events are
+	 * sent until writing fails */
+	if (client->closing || (client->eof && !client->subscribed && next_line(client) < 0))
+		goto close;
+	return;
+close:
+	close_client(client);
 }
 
 void server_init(char *address)
@@ -400,7 +755,7 @@ void server_init(char *address)
 		close(sock);
 	}
 
-	if (listen(server_socket, MAX_CLIENTS) == -1)
+	if (listen(server_socket, SOMAXCONN) == -1)
 		die_errno("listen");
 }
 
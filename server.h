@@ -20,11 +20,31 @@
 #define CMUS_SERVER_H
 
 #include "list.h"
+#include "gbuf.h"
 
 struct client {
 	struct list_head node;
 	int fd;
 	unsigned int authenticated : 1;
+	/* client has closed its end */
+	unsigned int eof : 1;
+	/* close after the pending output has been sent */
+	unsigned int closing : 1;
+	/* sent "subscribe", receives events */
+	unsigned int subscribed : 1;
+	/* events were dropped because the client did not read them */
+	unsigned int missed : 1;
+	/* seconds between position events, 0 for none */
+	int pos_interval;
+	/* position in the last event */
+	int last_pos;
+	/* commands not yet run */
+	struct gbuf in;
+	/* answers not yet sent, starting at out_pos */
+	struct gbuf out;
+	size_t out_pos;
+	/* events waiting for the running answer to end */
+	struct gbuf events;
 };
 
 extern int server_socket;
@@ -33,6 +53,29 @@ extern struct list_head client_head;
 void server_init(char *address);
 void server_exit(void);
 void server_accept(void);
-void server_serve(struct client *client);
+
+/* what the main loop should select() for */
+int server_client_wants_input(const struct client *client);
+int server_client_wants_output(const struct client *client);
+/* buffered commands that can be run without waiting for input */
+int server_client_has_commands(const struct client *client);
+
+/*
+ * true if the running command has added more to @out, the output of its
+ * client, than one answer may.  the answer is then dropped and so is the
+ * client
+ */
+int server_output_full(const struct gbuf *out);
+
+/* may remove @client from client_head */
+void server_serve(struct client *client, int readable, int writable);
+
+/* push events to subscribed clients, main thread only */
+void server_status_changed(void);
+void server_track_changed(void);
+void server_volume_changed(void);
+void server_option_changed(const char *name);
+/* queue changes and position ticks, called every main loop iteration */
+void server_update(void);
 
 #endif
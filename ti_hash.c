@@ -0,0 +1,146 @@
+/*
+ * Copyright 2008-2013 Various Authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ti_hash.h"
+#include "xmalloc.h"
+
+#include <string.h>
+
+#define TI_HASH_MIN_SIZE 64
+
+static inline unsigned int home_slot(const struct ti_hash *h, uint32_t hash)
+{
+	/* spread the bits of hash_str(), it is weak for similar paths */
+	return (hash * 2654435761u) & h->mask;
+}
+
+static void place(struct ti_hash *h, struct track_info *ti, uint32_t hash)
+{
+	unsigned int i = home_slot(h, hash);
+
+	while (h->slots[i].ti)
+		i = (i + 1) & h->mask;
+	h->slots[i].hash = hash;
+	h->slots[i].ti = ti;
+}
+
+static void resize(struct ti_hash *h, unsigned int size)
+{
+	struct ti_hash_slot *old = h->slots;
+	unsigned int i, old_size = old ? h->mask + 1 : 0;
+
+	h->slots = xnew0(struct ti_hash_slot, size);
+	h->mask = size - 1;
+	for (i = 0; i < old_size; i++) {
+		if (old[i].ti)
+			place(h, old[i].ti, old[i].hash);
+	}
+	free(old);
+}
+
+struct track_info *ti_hash_lookup(const struct ti_hash *h, const char *filename, uint32_t hash)
+{
+	unsigned int i;
+
+	if (!h->slots)
+		return NULL;
+
+	i = home_slot(h, hash);
+	while (h->slots[i].ti) {
+		if (h->slots[i].hash == hash && !strcmp(h->slots[i].ti->filename, filename))
+			return h->slots[i].ti;
+		i = (i + 1) & h->mask;
+	}
+	return NULL;
+}
+
+void ti_hash_insert(struct ti_hash *h, struct track_info *ti, uint32_t hash)
+{
+	/* keep the load factor below 3/4 */
+	if (!h->slots)
+		resize(h, TI_HASH_MIN_SIZE);
+	else if ((h->count + 1) * 4 > (h->mask + 1) * 3)
+		resize(h, (h->mask + 1) * 2);
+
+	place(h, ti, hash);
+	h->count++;
+}
+
+int ti_hash_remove(struct ti_hash *h, struct track_info *ti, uint32_t hash)
+{
+	unsigned int i, j;
+
+	if (!h->slots)
+		return 0;
+
+	i = home_slot(h, hash);
+	while (h->slots[i].ti != ti) {
+		if (!h->slots[i].ti)
+			return 0;
+		i = (i + 1) & h->mask;
+	}
+
+	/*
+	 * Shift following entries of the probe sequence back into the hole
+	 * instead of leaving a tombstone.  An entry at j may fill the hole
+	 * at i unless its home slot lies cyclically in (i, j].
+	 */
+	j = i;
+	while (1) {
+		unsigned int k;
+
+		j = (j + 1) & h->mask;
+		if (!h->slots[j].ti)
+			break;
+		k = home_slot(h, h->slots[j].hash);
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+		h->slots[i] = h->slots[j];
+		i = j;
+	}
+	h->slots[i].ti = NULL;
+	h->count--;
+
+	if (h->mask + 1 > TI_HASH_MIN_SIZE && h->count * 8 < h->mask + 1)
+		resize(h, (h->mask + 1) / 2);
+	return 1;
+}
+
+struct track_info *ti_hash_next(const struct ti_hash *h, unsigned int *pos)
+{
+	unsigned int i;
+
+	if (!h->slots)
+		return NULL;
+
+	for (i = *pos; i <= h->mask; i++) {
+		if (h->slots[i].ti) {
+			*pos = i + 1;
+			return h->slots[i].ti;
+		}
+	}
+	*pos = i;
+	return NULL;
+}
+
+void ti_hash_free(struct ti_hash *h)
+{
+	free(h->slots);
+	h->slots = NULL;
+	h->mask = 0;
+	h->count = 0;
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright 2008-2013 Various Authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CMUS_TI_HASH_H
+#define CMUS_TI_HASH_H
+
+#include "track_info.h"
+
+#include <stdint.h>
+
+struct ti_hash_slot {
+	/* hash_str(ti->filename), compared before touching ti */
+	uint32_t hash;
+	struct track_info *ti;
+};
+
+/*
+ * Track infos keyed by filename.  Open addressing with linear probing; the
+ * table grows and shrinks with the number of entries.  It does not take
+ * references.
+ */
+struct ti_hash {
+	struct ti_hash_slot *slots;
+	unsigned int mask;
+	unsigned int count;
+};
+
+#define TI_HASH_INIT { NULL, 0, 0 }
+
+struct track_info *ti_hash_lookup(const struct ti_hash *h, const char *filename, uint32_t hash);
+
+/* @ti->filename must not be in the table yet */
+void ti_hash_insert(struct ti_hash *h, struct track_info *ti, uint32_t hash);
+
+/* returns 0 if @ti is not in the table */
+int ti_hash_remove(struct ti_hash *h, struct track_info *ti, uint32_t hash);
+
+/*
+ * Returns the entry at or after *@pos and advances *@pos past it, or NULL at
+ * the end.  Start with *@pos = 0.  The table must not be modified while
+ * iterating.
+ */
+struct track_info *ti_hash_next(const struct ti_hash *h, unsigned int *pos);
+
+/* empties the table */
+void ti_hash_free(struct ti_hash *h);
+
+#endif
@@ -0,0 +1,426 @@
+/*
+ * Copyright 2008-2013 Various Authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ti_index.h"
+#include "uchar.h"
+#include "convert.h"
+#include "ui_curses.h" /* using_utf8, charset */
+#include "path.h"
+#include "misc.h"
+#include "gbuf.h"
+#include "xmalloc.h"
+#include "utils.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define WORD_HASH_MIN_SIZE	1024
+#define COMPACT_MIN_IDS		1024
+
+struct word {
+	/* offset in words_buf */
+	uint32_t offset;
+	uint32_t nr_ids;
+	uint32_t alloc_ids;
+	/* tracks containing the word, may include removed ones */
+	uint32_t *ids;
+};
+
+struct word_slot {
+	uint32_t hash;
+	/* index in words + 1, 0 if the slot is empty */
+	uint32_t word;
+};
+
+/*
+ * all words, each preceded by a space.  folded words never contain spaces
+ * so a search word can be looked up in all words with one strstr() pass
+ */
+static GBUF(words_buf);
+static struct word *words;
+static uint32_t nr_words;
+static uint32_t alloc_words;
+
+static struct word_slot *slots;
+static unsigned int mask;
+
+/* id -> track, NULL if removed.  id 0 means not indexed */
+static struct track_info **tis;
+static uint32_t nr_ids;
+static uint32_t alloc_ids;
+static uint32_t nr_live;
+
+/* streams, their bits are always set in match_bits.  may include removed ones */
+static uint32_t *stream_ids;
+static uint32_t nr_stream_ids;
+static uint32_t alloc_stream_ids;
+
+/* result of the last ti_index_may_match() call */
+static char *match_text;
+static int match_all;
+static uint64_t *match_bits;
+
+static void forget_match(void)
+{
+	free(match_text);
+	free(match_bits);
+	match_text = NULL;
+	match_bits = NULL;
+}
+
+static inline unsigned int home_slot(uint32_t hash)
+{
+	return (hash * 2654435761u) & mask;
+}
+
+static void place(uint32_t word, uint32_t hash)
+{
+	unsigned int i = home_slot(hash);
+
+	while (slots[i].word)
+		i = (i + 1) & mask;
+	slots[i].hash = hash;
+	slots[i].word = word;
+}
+
+static void resize(unsigned int size)
+{
+	struct word_slot *old = slots;
+	unsigned int i, old_size = old ? mask + 1 : 0;
+
+	slots = xnew0(struct word_slot, size);
+	mask = size - 1;
+	for (i = 0; i < old_size; i++) {
+		if (old[i].word)
+			place(old[i].word, old[i].hash);
+	}
+	free(old);
+}
+
+static struct word *get_word(const char *str)
+{
+	uint32_t hash = hash_str(str);
+	size_t len = strlen(str);
+	struct word *w;
+
+	if (slots) {
+		unsigned int i = home_slot(hash);
+
+		while (slots[i].word) {
+			w = &words[slots[i].word - 1];
+			if (slots[i].hash == hash &&
+					!memcmp(words_buf.buffer + w->offset, str, len) &&
+					(words_buf.buffer[w->offset + len] == ' ' ||
+					 words_buf.buffer[w->offset + len] == 0))
+				return w;
+			i = (i + 1) & mask;
+		}
+	}
+
+	if (!slots)
+		resize(WORD_HASH_MIN_SIZE);
+	else if ((nr_words + 1) * 4 > (mask + 1) * 3)
+		resize((mask + 1) * 2);
+
+	if (nr_words == alloc_words) {
+		alloc_words = alloc_words ? alloc_words * 2 : 1024;
+		words = xrenew(struct word, words, alloc_words);
+	}
+	gbuf_add_ch(&words_buf, ' ');
+	w = &words[nr_words++];
+	w->offset = words_buf.len;
+	w->nr_ids = 0;
+	w->alloc_ids = 0;
+	w->ids = NULL;
+	gbuf_add_bytes(&words_buf, str, len);
+	place(nr_words, hash);
+	return w;
+}
+
+static void word_add_id(struct word *w, uint32_t id)
+{
+	/* the same word can appear in several fields */
+	if (w->nr_ids && w->ids[w->nr_ids - 1] == id)
+		return;
+	if (w->nr_ids == w->alloc_ids) {
+		w->alloc_ids = w->alloc_ids ? w->alloc_ids * 2 : 2;
+		w->ids = xrenew(uint32_t, w->ids, w->alloc_ids);
+	}
+	w->ids[w->nr_ids++] = id;
+}
+
+static void add_field(const char *str, uint32_t id)
+{
+	char *folded, *s;
+
+	if (!str)
+		return;
+
+	folded = u_casefold_base(str);
+	s = folded;
+	while (*s) {
+		char *end = strchr(s, ' ');
+
+		if (end)
+			*end = 0;
+		if (*s)
+			word_add_id(get_word(s), id);
+		if (!end)
+			break;
+		s = end + 1;
+	}
+	free(folded);
+}
+
+/* same string as u_strcasestr_filename() searches in */
+static void add_filename(const char *filename, uint32_t id)
+{
+	char *ustr = NULL;
+
+	if (!is_url(filename))
+		filename = path_basename(filename);
+	if (!using_utf8 && utf8_encode(filename, charset, &ustr) == 0)
+		filename = ustr;
+	add_field(filename, id);
+	free(ustr);
+}
+
+void ti_index_add(struct track_info *ti)
+{
+	uint32_t id;
+
+	if (ti->index_id)
+		return;
+
+	if (!nr_ids)
+		nr_ids = 1;
+	if (nr_ids >= alloc_ids) {
+		alloc_ids = alloc_ids ? alloc_ids * 2 : 1024;
+		tis = xrenew(struct track_info *, tis, alloc_ids);
+	}
+	id = nr_ids++;
+	tis[id] = ti;
+	ti->index_id = id;
+	nr_live++;
+	forget_match();
+
+	if (is_http_url(ti->filename)) {
+		if (nr_stream_ids == alloc_stream_ids) {
+			alloc_stream_ids = alloc_stream_ids ? alloc_stream_ids * 2 : 16;
+			stream_ids = xrenew(uint32_t, stream_ids, alloc_stream_ids);
+		}
+		stream_ids[nr_stream_ids++] = id;
+		return;
+	}
+
+	add_field(ti->artist, id);
+	add_field(ti->album, id);
+	add_field(ti->title, id);
+	add_field(ti->albumartist, id);
+	add_filename(ti->filename, id);
+}
+
+/* drop the words of removed tracks */
+static void rebuild(void)
+{
+	struct track_info **live = xnew(struct track_info *, nr_live + 1);
+	uint32_t i, n = 0;
+
+	for (i = 1; i < nr_ids; i++) {
+		if (tis[i])
+			live[n++] = tis[i];
+	}
+	ti_index_clear();
+	for (i = 0; i < n; i++)
+		ti_index_add(live[i]);
+	free(live);
+}
+
+void ti_index_remove(struct track_info *ti)
+{
+	if (!ti->index_id)
+		return;
+
+	/* ids are not reused, the word lists can keep the old id */
+	tis[ti->index_id] = NULL;
+	ti->index_id = 0;
+	nr_live--;
+
+	if (nr_ids > COMPACT_MIN_IDS && nr_live * 2 < nr_ids)
+		rebuild();
+}
+
+void ti_index_clear(void)
+{
+	uint32_t i;
+
+	for (i = 1; i < nr_ids; i++) {
+		if (tis[i])
+			tis[i]->index_id = 0;
+	}
+	for (i = 0; i < nr_words; i++)
+		free(words[i].ids);
+	free(words);
+	free(slots);
+	free(tis);
+	free(stream_ids);
+	gbuf_free(&words_buf);
+	words = NULL;
+	nr_words = alloc_words = 0;
+	slots = NULL;
+	mask = 0;
+	tis = NULL;
+	nr_ids = alloc_ids = nr_live = 0;
+	stream_ids = NULL;
+	nr_stream_ids = alloc_stream_ids = 0;
+	forget_match();
+}
+
+/* index of the word at @offset in words_buf */
+static uint32_t word_at(size_t offset)
+{
+	uint32_t lo = 0, hi = nr_words;
+
+	while (hi - lo > 1) {
+		uint32_t mid = (lo + hi) / 2;
+
+		if (words[mid].offset <= offset)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* sets the bits of all tracks that have a word containing @str */
+static void find_tracks(const char *str, uint64_t *bits)
+{
+	const char *buf = words_buf.buffer;
+	const char *p = buf;
+
+	while ((p = strstr(p, str))) {
+		uint32_t w = word_at(p - buf), i;
+
+		for (i = 0; i < words[w].nr_ids; i++) {
+			uint32_t id = words[w].ids[i];
+
+			bits[id / 64] |= (uint64_t)1 << (id % 64);
+		}
+		if (w + 1 == nr_words)
+			break;
+		p = buf + words[w + 1].offset;
+	}
+}
+
+static void update_match(const char *text, int match_all_words)
+{
+	size_t i, j, n = (nr_ids + 63) / 64;
+	uint64_t *word_bits = xnew(uint64_t, n);
+	char **search_words;
+
+	forget_match();
+	match_text = xstrdup(text);
+	match_all = match_all_words;
+	match_bits = xnew(uint64_t, n);
+	memset(match_bits, match_all_words ? 0xff : 0, n * sizeof(uint64_t));
+
+	search_words = get_words(text);
+	for (i = 0; search_words[i]; i++) {
+		char *folded;
+
+		if (!u_is_valid(search_words[i])) {
+			if (match_all_words)
+				continue;
+			memset(match_bits, 0xff, n * sizeof(uint64_t));
+			break;
+		}
+
+		folded = u_casefold_base(search_words[i]);
+		if (strchr(folded, ' ')) {
+			/* can match across words, e.g. no-break space */
+			free(folded);
+			if (match_all_words)
+				continue;
+			memset(match_bits, 0xff, n * sizeof(uint64_t));
+			break;
+		}
+
+		memset(word_bits, 0, n * sizeof(uint64_t));
+		find_tracks(folded, word_bits);
+		free(folded);
+		for (j = 0; j < n; j++) {
+			if (match_all_words)
+				match_bits[j] &= word_bits[j];
+			else
+				match_bits[j] |= word_bits[j];
+		}
+	}
+	free_str_array(search_words);
+	free(word_bits);
+
+	for (i = 0; i < nr_stream_ids; i++)
+		match_bits[stream_ids[i] / 64] |= (uint64_t)1 << (stream_ids[i] % 64);
+}
+
+static void match(const char *text, int match_all_words)
+{
+	if (!match_text || match_all != match_all_words || strcmp(match_text, text))
+		update_match(text, match_all_words);
+}
+
+int ti_index_may_match(const struct track_info *ti, const char *text, int match_all_words)
+{
+	uint32_t id = ti->index_id;
+
+	if (!id)
+		return 1;
+
+	match(text, match_all_words);
+	return (match_bits[id / 64] >> (id % 64)) & 1;
+}
+
+struct track_info **ti_index_candidates(const char *text, int match_all_words, size_t *nr)
+{
+	size_t i, n = (nr_ids + 63) / 64, count = 0;
+	struct track_info **cand;
+
+	if (!nr_ids) {
+		*nr = 0;
+		return xnew(struct track_info *, 1);
+	}
+
+	match(text, match_all_words);
+	for (i = 0; i < n; i++)
+		count += __builtin_popcountll(match_bits[i]);
+
+	cand = xnew(struct track_info *, count + 1);
+	count = 0;
+	for (i = 0; i < n; i++) {
+		uint64_t bits = match_bits[i];
+
+		while (bits) {
+			uint32_t id = i * 64 + __builtin_ctzll(bits);
+
+			bits &= bits - 1;
+			/* bits of removed tracks and past the last id may be set */
+			if (id && id < nr_ids && tis[id])
+				cand[count++] = tis[id];
+		}
+	}
+	*nr = count;
+	return cand;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright 2008-2013 Various Authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CMUS_TI_INDEX_H
+#define CMUS_TI_INDEX_H
+
+#include "track_info.h"
+
+/*
+ * Inverted index of the words in artist, album, title, albumartist and
+ * filename of the library tracks.  Words are split at spaces and folded
+ * with u_casefold_base(), so a search word can only match a track if it is
+ * contained in one of the track's words.  track_info_matches_full() uses
+ * it to skip tracks that cannot match.
+ *
+ * The words of streams are not indexed because their metadata changes while
+ * they play, they always may match.
+ *
+ * Main thread only.
+ */
+
+void ti_index_add(struct track_info *ti);
+void ti_index_remove(struct track_info *ti);
+void ti_index_clear(void);
+
+/*
+ * returns 0 if @ti certainly does not match any word of @text (all words if
+ * @match_all_words) in any of the indexed fields, 1 otherwise.  tracks that
+ * are not in the index always return 1
+ */
+int ti_index_may_match(const struct track_info *ti, const char *text, int match_all_words);
+
+/*
+ * indexed tracks for which ti_index_may_match() returns 1, without walking
+ * all tracks.  returns a malloc'd array of @nr unreferenced tracks
+ */
+struct track_info **ti_index_candidates(const char *text, int match_all_words, size_t *nr);
+
+#endif
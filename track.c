@@ -25,7 +25,10 @@
 #include "xmalloc.h"
 #include "debug.h"
 #include "misc.h"
+#include "utils.h"
+#include "pool.h"
 
+#include <stdint.h>
 #include <string.h>
 
 void simple_track_init(struct simple_track *track, struct track_info *ti)
@@ -47,6 +50,11 @@ struct simple_track *simple_track_new(struct track_info *ti)
 GENERIC_ITER_PREV(simple_track_get_prev, struct simple_track, node)
 GENERIC_ITER_NEXT(simple_track_get_next, struct simple_track, node)
 
+int simple_track_get_pos(struct iter *iter)
+{
+	return rb_counted_index(&iter_to_simple_track(iter)->pos_node);
+}
+
 int simple_track_search_get_current(void *data, struct iter *iter)
 {
 	return window_get_sel(data, iter);
@@ -91,8 +99,9 @@ void shuffle_insert(struct rb_root *root, struct shuffle_track *previous, struct
 	rb_insert_color(&next->tree_node, root);
 }
 
-struct shuffle_track *shuffle_list_get_next(struct rb_root *root, struct shuffle_track *cur,
-		int (*filter_callback)(const struct simple_track *))
+static struct shuffle_track *shuffle_list_next(struct rb_root *root,
+		struct shuffle_track *cur,
+		int (*filter_callback)(const struct simple_track *), int peek)
 {
 	struct rb_node *node;
 
@@ -109,14 +118,30 @@ again:
 		node = rb_next(node);
 	}
 	if (repeat) {
-		if (auto_reshuffle)
+		if (auto_reshuffle) {
+			/* the order after the reshuffle is not known yet */
+			if (peek)
+				return NULL;
 			shuffle_list_reshuffle(root);
+		}
 		node = rb_first(root);
 		goto again;
 	}
 	return NULL;
 }
 
+struct shuffle_track *shuffle_list_get_next(struct rb_root *root, struct shuffle_track *cur,
+		int (*filter_callback)(const struct simple_track *))
+{
+	return shuffle_list_next(root, cur, filter_callback, 0);
+}
+
+struct shuffle_track *shuffle_list_peek_next(struct rb_root *root, struct shuffle_track *cur,
+		int (*filter_callback)(const struct simple_track *))
+{
+	return shuffle_list_next(root, cur, filter_callback, 1);
+}
+
 struct shuffle_track *shuffle_list_get_prev(struct rb_root *root, struct shuffle_track *cur,
 		int (*filter_callback)(const struct simple_track *))
 {
@@ -288,16 +313,273 @@ void rand_list_rebuild(struct list_head *head, struct rb_root *tree_root)
 
 void sorted_list_rebuild(struct list_head *head, struct rb_root *tree_root, const sort_key_t *keys)
 {
-	struct list_head *item, *tmp;
-	struct rb_root tmp_tree = RB_ROOT;
+	struct simple_track **tracks;
+	struct list_head *item;
+	size_t nr = 0;
+
+	list_for_each(item, head)
+		nr++;
+	if (nr == 0)
+		return;
+
+	tracks = xnew(struct simple_track *, nr);
+	nr = 0;
+	list_for_each(item, head)
+		tracks[nr++] = to_simple_track(item);
+
+	/* relinks everything, the old list and tree are just dropped */
+	list_init(head);
+	tree_root->rb_node = NULL;
+	sorted_list_add_tracks(head, tree_root, tracks, nr, keys);
+	free(tracks);
+}
+
+/*
+ * Sorting works on a contiguous array of these.  @prefix orders by the first
+ * sort key as far as possible without touching the track_info, only equal
+ * prefixes need track_info_cmp().
+ */
+struct sort_entry {
+	uint64_t prefix;
+	struct simple_track *track;
+};
+
+/* tracks per pool_run() task, smaller arrays are sorted on one thread */
+#define SORT_CHUNK_MIN 8192
+
+struct sort_ctx {
+	const sort_key_t *keys;
+	struct sort_entry *src;
+	struct sort_entry *dst;
+	size_t nr;
+	size_t width;
+};
+
+/* the first 7 bytes, NULL sorts before "" like in strcmp0() */
+static uint64_t str_prefix(const char *str)
+{
+	uint64_t p;
+	int i;
+
+	if (!str)
+		return 0;
+	p = 1ULL << 56;
+	for (i = 0; i < 7 && str[i]; i++)
+		p |= (uint64_t)(unsigned char)str[i] << (8 * (6 - i));
+	return p;
+}
+
+/* has to agree with track_info_cmp() */
+static uint64_t sort_prefix(const struct track_info *ti, sort_key_t key)
+{
+	int rev = 0;
+	uint64_t p;
+
+	if (key >= REV_SORT__START) {
+		rev = 1;
+		key -= REV_SORT__START;
+	}
+
+	switch (key) {
+	case SORT_TRACKNUMBER:
+	case SORT_DISCNUMBER:
+	case SORT_DATE:
+	case SORT_ORIGINALDATE:
+	case SORT_PLAY_COUNT:
+	case SORT_BPM:
+		p = (uint64_t)(int64_t)getentry(ti, key, int) ^ (1ULL << 63);
+		break;
+	case SORT_ARTIST:
+	case SORT_ALBUM:
+	case SORT_TITLE:
+	case SORT_GENRE:
+	case SORT_COMMENT:
+	case SORT_ALBUMARTIST:
+		p = str_prefix(track_info_collkey(ti, key));
+		break;
+	case SORT_CODEC:
+	case SORT_CODEC_PROFILE:
+	case SORT_MEDIA:
+		p = str_prefix(getentry(ti, key, const char *));
+		break;
+	default:
+		/* filename uses strcoll(), the rest is rare */
+		p = 0;
+		break;
+	}
+	return rev ? ~p : p;
+}
+
+static inline int sort_entry_cmp(const struct sort_entry *a, const struct sort_entry *b,
+		const sort_key_t *keys)
+{
+	if (a->prefix != b->prefix)
+		return a->prefix < b->prefix ? -1 : 1;
+	return track_info_cmp(a->track->info, b->track->info, keys);
+}
+
+/* merges the sorted runs [lo, mid) and [mid, hi) of @src into @dst */
+static void merge_runs(const struct sort_entry *src, struct sort_entry *dst,
+		size_t lo, size_t mid, size_t hi, const sort_key_t *keys)
+{
+	size_t i = lo, j = mid, k = lo;
+
+	while (i < mid && j < hi) {
+		/* ties take the left run to keep the sort stable */
+		if (sort_entry_cmp(&src[j], &src[i], keys) < 0)
+			dst[k++] = src[j++];
+		else
+			dst[k++] = src[i++];
+	}
+	while (i < mid)
+		dst[k++] = src[i++];
+	while (j < hi)
+		dst[k++] = src[j++];
+}
+
+/* bottom-up merge sort of [lo, hi), the result ends up in @a */
+static void sort_range(struct sort_entry *a, struct sort_entry *tmp,
+		size_t lo, size_t hi, const sort_key_t *keys)
+{
+	struct sort_entry *src = a, *dst = tmp;
+	size_t width;
+
+	for (width = 1; width < hi - lo; width *= 2) {
+		size_t l;
+
+		for (l = lo; l < hi; l += 2 * width)
+			merge_runs(src, dst, l, min_u(l + width, hi),
+					min_u(l + 2 * width, hi), keys);
+		dst = src;
+		src = src == a ? tmp : a;
+	}
+	if (src != a)
+		memcpy(a + lo, src + lo, (hi - lo) * sizeof(a[0]));
+}
+
+static void sort_chunk_cb(int i, void *opaque)
+{
+	struct sort_ctx *ctx = opaque;
+	size_t lo = i * ctx->width;
+	size_t hi = min_u(lo + ctx->width, ctx->nr);
+	size_t j;
+
+	for (j = lo; j < hi; j++)
+		ctx->src[j].prefix = sort_prefix(ctx->src[j].track->info, ctx->keys[0]);
+	sort_range(ctx->src, ctx->dst, lo, hi, ctx->keys);
+}
+
+static void merge_chunk_cb(int i, void *opaque)
+{
+	struct sort_ctx *ctx = opaque;
+	size_t lo = i * 2 * ctx->width;
+
+	merge_runs(ctx->src, ctx->dst, lo, min_u(lo + ctx->width, ctx->nr),
+			min_u(lo + 2 * ctx->width, ctx->nr), ctx->keys);
+}
+
+/* on the pool if it is idle, otherwise on this thread */
+static void sort_run(int n, pool_cb cb, struct sort_ctx *ctx)
+{
+	int i;
+
+	if (n > 1 && pool_try_run(n, cb, ctx) == 0)
+		return;
+	for (i = 0; i < n; i++)
+		cb(i, ctx);
+}
+
+/*
+ * Stable merge sort, equal tracks keep their order.  Chunks are sorted on
+ * the pool threads and then merged pairwise, also in parallel.  The pool
+ * is not waited for: when a worker job is using it the sort runs on the
+ * calling thread.
+ */
+static void sort_tracks(struct simple_track **tracks, size_t nr, const sort_key_t *keys)
+{
+	struct sort_ctx ctx;
+	struct sort_entry *entries, *tmp;
+	size_t i, nr_chunks;
+
+	if (nr <= 1 || keys[0] == SORT_INVALID)
+		return;
+
+	entries = xnew(struct sort_entry, nr);
+	tmp = xnew(struct sort_entry, nr);
+	for (i = 0; i < nr; i++)
+		entries[i].track = tracks[i];
+
+	nr_chunks = min_u(pool_nr_threads(), (nr + SORT_CHUNK_MIN - 1) / SORT_CHUNK_MIN);
+	ctx.keys = keys;
+	ctx.src = entries;
+	ctx.dst = tmp;
+	ctx.nr = nr;
+	ctx.width = (nr + nr_chunks - 1) / nr_chunks;
+	sort_run(nr_chunks, sort_chunk_cb, &ctx);
+
+	while (ctx.width < nr) {
+		size_t nr_pairs = (nr + 2 * ctx.width - 1) / (2 * ctx.width);
+
+		sort_run(nr_pairs, merge_chunk_cb, &ctx);
+		tmp = ctx.src;
+		ctx.src = ctx.dst;
+		ctx.dst = tmp;
+		ctx.width *= 2;
+	}
+
+	for (i = 0; i < nr; i++)
+		tracks[i] = ctx.src[i].track;
+	free(ctx.src);
+	free(ctx.dst);
+}
+
+/* @node is greater than everything in @root, no comparisons needed */
+static void rb_append(struct rb_root *root, struct rb_node **last, struct rb_node *node)
+{
+	rb_link_node(node, *last, *last ? &(*last)->rb_right : &root->rb_node);
+	rb_insert_color(node, root);
+	*last = node;
+}
+
+void sorted_list_add_tracks(struct list_head *head, struct rb_root *tree_root,
+		struct simple_track **tracks, size_t nr, const sort_key_t *keys)
+{
+	struct list_head *item = head->next;
+	struct simple_track *prev = NULL;
+	struct rb_node *last = NULL;
+	size_t i = 0;
 	LIST_HEAD(tmp_head);
 
-	list_for_each_safe(item, tmp, head) {
-		struct simple_track *track = to_simple_track(item);
-		sorted_list_remove_track(head, tree_root, track);
-		sorted_list_add_track(&tmp_head, &tmp_tree, track, keys, 0);
+	if (nr == 0)
+		return;
+
+	sort_tracks(tracks, nr, keys);
+
+	/*
+	 * Merge into the existing list.  New tracks go after equal ones that
+	 * are already there, like sorted_list_add_track() with tiebreak +1.
+	 * The tree of first tracks of each run is rebuilt along the way.
+	 */
+	tree_root->rb_node = NULL;
+	while (item != head || i < nr) {
+		struct simple_track *t;
+
+		if (item != head && (i == nr ||
+				track_info_cmp(to_simple_track(item)->info, tracks[i]->info, keys) <= 0)) {
+			t = to_simple_track(item);
+			item = item->next;
+		} else {
+			t = tracks[i++];
+		}
+
+		if (!prev || track_info_cmp(prev->info, t->info, keys) != 0)
+			rb_append(tree_root, &last, &t->tree_node);
+		else
+			RB_CLEAR_NODE(&t->tree_node);
+		list_add_tail(&t->node, &tmp_head);
+		prev = t;
 	}
-	tree_root->rb_node = tmp_tree.rb_node;
+
 	_list_add(head, tmp_head.prev, tmp_head.next);
 }
 
@@ -359,6 +641,49 @@ void shuffle_list_reshuffle(struct rb_root *tree_root)
 	tree_root->rb_node = tmptree.rb_node;
 }
 
+static int shuffle_track_cmp(const void *a, const void *b)
+{
+	const struct shuffle_track *ta = *(const struct shuffle_track **)a;
+	const struct shuffle_track *tb = *(const struct shuffle_track **)b;
+
+	return compare_rand(&ta->tree_node, &tb->tree_node);
+}
+
+void shuffle_list_add_tracks(struct shuffle_track **tracks, size_t nr, struct rb_root *tree_root)
+{
+	struct shuffle_track **old;
+	struct rb_node *node, *last = NULL;
+	size_t nr_old = 0, i = 0, j = 0;
+
+	if (nr == 0)
+		return;
+
+	for (i = 0; i < nr; i++)
+		shuffle_track_init(tracks[i]);
+	qsort(tracks, nr, sizeof(tracks[0]), shuffle_track_cmp);
+
+	/* the old tree is relinked below, collect it first */
+	for (node = rb_first(tree_root); node; node = rb_next(node))
+		nr_old++;
+	old = xnew(struct shuffle_track *, nr_old ? nr_old : 1);
+	i = 0;
+	for (node = rb_first(tree_root); node; node = rb_next(node))
+		old[i++] = tree_node_to_shuffle_track(node);
+
+	tree_root->rb_node = NULL;
+	i = 0;
+	while (i < nr_old || j < nr) {
+		struct shuffle_track *t;
+
+		if (i < nr_old && (j == nr || old[i]->rand <= tracks[j]->rand))
+			t = old[i++];
+		else
+			t = tracks[j++];
+		rb_append(tree_root, &last, &t->tree_node);
+	}
+	free(old);
+}
+
 /* expensive */
 void list_add_rand(struct list_head *head, struct list_head *node, int nr)
 {
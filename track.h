@@ -28,6 +28,8 @@
 struct simple_track {
 	struct list_head node;
 	struct rb_node tree_node;
+	/* row number in the editable, see editable.h */
+	struct rb_counted_node pos_node;
 	struct track_info *info;
 	unsigned int marked : 1;
 };
@@ -77,6 +79,7 @@ struct simple_track *simple_track_new(struct track_info *ti);
 
 int simple_track_get_prev(struct iter *);
 int simple_track_get_next(struct iter *);
+int simple_track_get_pos(struct iter *);
 
 /* data is window */
 int simple_track_search_get_current(void *data, struct iter *iter);
@@ -86,6 +89,13 @@ int _simple_track_search_matches(struct iter *iter, const char *text);
 struct shuffle_track *shuffle_list_get_next(struct rb_root *root, struct shuffle_track *cur,
 		int (*filter)(const struct simple_track *));
 
+/*
+ * like shuffle_list_get_next() but never reshuffles the list, returns NULL
+ * if that would be needed to know the next track
+ */
+struct shuffle_track *shuffle_list_peek_next(struct rb_root *root, struct shuffle_track *cur,
+		int (*filter)(const struct simple_track *));
+
 struct shuffle_track *shuffle_list_get_prev(struct rb_root *root, struct shuffle_track *cur,
 		int (*filter)(const struct simple_track *));
 
@@ -97,6 +107,13 @@ struct simple_track *simple_list_get_prev(struct list_head *head, struct simple_
 
 void sorted_list_add_track(struct list_head *head, struct rb_root *tree_root, struct simple_track *track,
 		const sort_key_t *keys, int tiebreak);
+/*
+ * Adds @nr tracks at once by sorting them and merging them into the list.
+ * Rebuilds the whole list, only worth it if @nr is not small compared to
+ * the length of the list.  Reorders @tracks.
+ */
+void sorted_list_add_tracks(struct list_head *head, struct rb_root *tree_root,
+		struct simple_track **tracks, size_t nr, const sort_key_t *keys);
 void sorted_list_remove_track(struct list_head *head, struct rb_root *tree_root, struct simple_track *track);
 void sorted_list_rebuild(struct list_head *head, struct rb_root *tree_root, const sort_key_t *keys);
 void rand_list_rebuild(struct list_head *head, struct rb_root *tree_root);
@@ -109,6 +126,8 @@ int simple_list_for_each(struct list_head *head, track_info_cb cb,
 		void *data, int reverse);
 
 void shuffle_list_add(struct shuffle_track *track, struct rb_root *tree_root);
+/* like sorted_list_add_tracks() for the shuffle tree */
+void shuffle_list_add_tracks(struct shuffle_track **tracks, size_t nr, struct rb_root *tree_root);
 void shuffle_list_reshuffle(struct rb_root *tree_root);
 void shuffle_insert(struct rb_root *root, struct shuffle_track *previous, struct shuffle_track *new);
 
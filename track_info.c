@@ -20,6 +20,8 @@
 #include "comment.h"
 #include "uchar.h"
 #include "u_collate.h"
+#include "intern.h"
+#include "ti_index.h"
 #include "misc.h"
 #include "xmalloc.h"
 #include "utils.h"
@@ -31,9 +33,29 @@
 #include <stdatomic.h>
 #include <math.h>
 
+static const sort_key_t collkeys[] = {
+	SORT_ARTIST, SORT_ALBUM, SORT_TITLE, SORT_GENRE, SORT_COMMENT, SORT_ALBUMARTIST
+};
+#define NR_COLLKEYS N_ELEMENTS(collkeys)
+
+/* comments and keys replaced by track_info_set_comments() */
+struct retired_comments {
+	struct retired_comments *next;
+	struct keyval *comments;
+	bool comments_mapped;
+	char *collkeys[NR_COLLKEYS];
+};
+
 struct track_info_priv {
 	struct track_info ti;
 	_Atomic uint32_t ref_count;
+
+	/* filename, codec and codec_profile are not owned */
+	bool strings_mapped;
+	/* only the comments array is owned, not the strings */
+	bool comments_mapped;
+	/* freed with the track_info */
+	struct retired_comments *retired;
 };
 
 static struct track_info_priv *track_info_to_priv(struct track_info *ti)
@@ -41,7 +63,7 @@ static struct track_info_priv *track_info_to_priv(struct track_info *ti)
 	return container_of(ti, struct track_info_priv, ti);
 }
 
-struct track_info *track_info_new(const char *filename)
+static struct track_info *do_track_info_new(char *filename, bool mapped)
 {
 	static _Atomic uint64_t cur_uid = ATOMIC_VAR_INIT(1);
 	uint64_t uid = atomic_fetch_add_explicit(&cur_uid, 1, memory_order_relaxed);
@@ -49,23 +71,139 @@ struct track_info *track_info_new(const char *filename)
 
 	struct track_info_priv *priv = xnew(struct track_info_priv, 1);
 	atomic_init(&priv->ref_count, 1);
+	priv->strings_mapped = mapped;
+	priv->comments_mapped = false;
+	priv->retired = NULL;
 
 	struct track_info *ti = &priv->ti;
 	ti->uid = uid;
-	ti->filename = xstrdup(filename);
+	ti->filename = filename;
 	ti->play_count = 0;
+	ti->index_id = 0;
 	ti->comments = NULL;
 	ti->bpm = -1;
 	ti->codec = NULL;
 	ti->codec_profile = NULL;
+	atomic_init(&ti->collkey_artist, NULL);
+	atomic_init(&ti->collkey_album, NULL);
+	atomic_init(&ti->collkey_title, NULL);
+	atomic_init(&ti->collkey_genre, NULL);
+	atomic_init(&ti->collkey_comment, NULL);
+	atomic_init(&ti->collkey_albumartist, NULL);
 
 	return ti;
 }
 
+struct track_info *track_info_new(const char *filename)
+{
+	return do_track_info_new(xstrdup(filename), false);
+}
+
+struct track_info *track_info_new_mapped(const char *filename)
+{
+	return do_track_info_new((char *)filename, true);
+}
+
+static void free_comments(struct track_info *ti)
+{
+	struct track_info_priv *priv = track_info_to_priv(ti);
+
+	if (!ti->comments)
+		return;
+	if (priv->comments_mapped)
+		free(ti->comments);
+	else
+		keyvals_free(ti->comments);
+	ti->comments = NULL;
+}
+
+static _Atomic(char *) *collkey_field(const struct track_info *ti, sort_key_t key)
+{
+	return (_Atomic(char *) *)((char *)ti + key);
+}
+
+/* values that repeat across many tracks share one key */
+static inline bool collkey_interned(sort_key_t key)
+{
+	return key != SORT_TITLE && key != SORT_COMMENT;
+}
+
+static void free_collkey(sort_key_t key, char *ckey)
+{
+	if (collkey_interned(key))
+		intern_collkey_put(ckey);
+	else
+		free(ckey);
+}
+
+static void free_collkeys(struct track_info *ti)
+{
+	int i;
+
+	for (i = 0; i < NR_COLLKEYS; i++)
+		free_collkey(collkeys[i], atomic_exchange(collkey_field(ti, collkeys[i]), NULL));
+}
+
+/*
+ * Other threads may be sorting or filtering @ti while its comments change,
+ * so the old comments and keys are kept until @ti is freed
+ */
+static void retire_comments(struct track_info *ti)
+{
+	struct track_info_priv *priv = track_info_to_priv(ti);
+	char *keys[NR_COLLKEYS];
+	bool any = ti->comments != NULL;
+	int i;
+
+	for (i = 0; i < NR_COLLKEYS; i++) {
+		keys[i] = atomic_exchange(collkey_field(ti, collkeys[i]), NULL);
+		if (keys[i])
+			any = true;
+	}
+
+	if (any) {
+		struct retired_comments *r = xnew(struct retired_comments, 1);
+
+		r->comments = ti->comments;
+		r->comments_mapped = priv->comments_mapped;
+		memcpy(r->collkeys, keys, sizeof(keys));
+		r->next = priv->retired;
+		priv->retired = r;
+		ti->comments = NULL;
+	}
+}
+
+static void free_retired(struct track_info_priv *priv)
+{
+	int i;
+
+	while (priv->retired) {
+		struct retired_comments *r = priv->retired;
+
+		priv->retired = r->next;
+		if (r->comments_mapped)
+			free(r->comments);
+		else if (r->comments)
+			keyvals_free(r->comments);
+		for (i = 0; i < NR_COLLKEYS; i++)
+			free_collkey(collkeys[i], r->collkeys[i]);
+		free(r);
+	}
+}
+
+void track_info_set_comments_mapped(struct track_info *ti, struct keyval *comments)
+{
+	track_info_set_comments(ti, comments);
+	track_info_to_priv(ti)->comments_mapped = true;
+}
+
 void track_info_set_comments(struct track_info *ti, struct keyval *comments) {
 	long int r128_track_gain;
 	long int r128_album_gain;
 
+	retire_comments(ti);
+	track_info_to_priv(ti)->comments_mapped = false;
+
 	ti->comments = comments;
 	ti->artist = keyvals_get_val(comments, "artist");
 	ti->album = keyvals_get_val(comments, "album");
@@ -87,12 +225,14 @@ void track_info_set_comments(struct track_info *ti, struct keyval *comments) {
 		ti->bpm = bpm;
 	}
 
-	if (ti->artist == NULL && ti->albumartist != NULL) {
+	ti->artist_guessed = ti->artist == NULL && ti->albumartist != NULL;
+	if (ti->artist_guessed) {
 		/* best guess */
 		ti->artist = ti->albumartist;
 	}
 
-	if (track_info_has_tag(ti) && ti->title == NULL) {
+	ti->title_guessed = track_info_has_tag(ti) && ti->title == NULL;
+	if (ti->title_guessed) {
 		/* best guess */
 		ti->title = path_basename(ti->filename);
 	}
@@ -109,13 +249,55 @@ void track_info_set_comments(struct track_info *ti, struct keyval *comments) {
 	if (comments_get_signed_int(comments, "r128_album_gain", &r128_album_gain) != -1) {
 		ti->rg_album_gain = (r128_album_gain / 256.0) + 5;
 	}
+}
+
+static const char *collkey_source(const struct track_info *ti, sort_key_t key)
+{
+	switch (key) {
+	case SORT_ARTIST:
+		return ti->artist;
+	case SORT_ALBUM:
+		return ti->album;
+	case SORT_TITLE:
+		return ti->title;
+	case SORT_GENRE:
+		return ti->genre;
+	case SORT_COMMENT:
+		return ti->comment;
+	case SORT_ALBUMARTIST:
+		return ti->albumartist;
+	}
+	BUG("invalid collkey %zu\n", key);
+}
 
-	ti->collkey_artist = u_strcasecoll_key0(ti->artist);
-	ti->collkey_album = u_strcasecoll_key0(ti->album);
-	ti->collkey_title = u_strcasecoll_key0(ti->title);
-	ti->collkey_genre = u_strcasecoll_key0(ti->genre);
-	ti->collkey_comment = u_strcasecoll_key0(ti->comment);
-	ti->collkey_albumartist = u_strcasecoll_key0(ti->albumartist);
+/*
+ * Most tracks are never sorted by most keys, so they are only computed
+ * when needed.  Sorting may happen on several threads at once, the first
+ * key stored wins.  Keys of interned fields are shared.
+ */
+const char *track_info_collkey(const struct track_info *ti, sort_key_t key)
+{
+	_Atomic(char *) *field = collkey_field(ti, key);
+	char *ckey = atomic_load_explicit(field, memory_order_acquire);
+	char *expected = NULL;
+	const char *src;
+
+	if (ckey)
+		return ckey;
+	src = collkey_source(ti, key);
+	if (!src)
+		return NULL;
+
+	if (collkey_interned(key))
+		ckey = (char *)intern_collkey(src);
+	else
+		ckey = u_strcasecoll_key(src);
+	if (!atomic_compare_exchange_strong_explicit(field, &expected, ckey,
+				memory_order_acq_rel, memory_order_acquire)) {
+		free_collkey(key, ckey);
+		ckey = expected;
+	}
+	return ckey;
 }
 
 void track_info_ref(struct track_info *ti)
@@ -130,16 +312,14 @@ void track_info_unref(struct track_info *ti)
 	uint32_t prev = atomic_fetch_sub_explicit(&priv->ref_count, 1,
 			memory_order_acq_rel);
 	if (prev == 1) {
-		keyvals_free(ti->comments);
-		free(ti->filename);
-		free(ti->codec);
-		free(ti->codec_profile);
-		free(ti->collkey_artist);
-		free(ti->collkey_album);
-		free(ti->collkey_title);
-		free(ti->collkey_genre);
-		free(ti->collkey_comment);
-		free(ti->collkey_albumartist);
+		free_comments(ti);
+		if (!priv->strings_mapped) {
+			free(ti->filename);
+			free(ti->codec);
+			free(ti->codec_profile);
+		}
+		free_collkeys(ti);
+		free_retired(priv);
 		free(priv);
 	}
 }
@@ -171,7 +351,7 @@ static inline int flags_set(const struct track_info *ti, unsigned int flags)
 	       ((flags & TI_MATCH_ALBUMARTIST) && ti->albumartist);
 }
 
-int track_info_matches_full(const struct track_info *ti, const char *text,
+int track_info_matches_unindexed(const struct track_info *ti, const char *text,
 		unsigned int flags, unsigned int exclude_flags, int match_all_words)
 {
 	char **words;
@@ -206,6 +386,14 @@ int track_info_matches_full(const struct track_info *ti, const char *text,
 	return matched;
 }
 
+int track_info_matches_full(const struct track_info *ti, const char *text,
+		unsigned int flags, unsigned int exclude_flags, int match_all_words)
+{
+	if (!ti_index_may_match(ti, text, match_all_words))
+		return 0;
+	return track_info_matches_unindexed(ti, text, flags, exclude_flags, match_all_words);
+}
+
 int track_info_matches(const struct track_info *ti, const char *text, unsigned int flags)
 {
 	return track_info_matches_full(ti, text, flags, 0, 1);
@@ -262,6 +450,14 @@ int track_info_cmp(const struct track_info *a, const struct track_info *b, const
 		case SORT_BITRATE:
 			res = getentry(a, key, long) - getentry(b, key, long);
 			break;
+		case SORT_ARTIST:
+		case SORT_ALBUM:
+		case SORT_TITLE:
+		case SORT_GENRE:
+		case SORT_COMMENT:
+		case SORT_ALBUMARTIST:
+			res = strcmp0(track_info_collkey(a, key), track_info_collkey(b, key));
+			break;
 		default:
 			av = getentry(a, key, const char *);
 			bv = getentry(b, key, const char *);
@@ -28,7 +28,7 @@ struct track_info {
 	uint64_t uid;
 	struct keyval *comments;
 
-	// next track_info in the hash table (cache.c)
+	// replacement of a stale track_info returned by cache_refresh()
 	struct track_info *next;
 
 	time_t mtime;
@@ -56,16 +56,23 @@ struct track_info {
 	const char *albumsort;
 	const char *media;
 
-	char *collkey_artist;
-	char *collkey_album;
-	char *collkey_title;
-	char *collkey_genre;
-	char *collkey_comment;
-	char *collkey_albumartist;
+	/* computed on first use, see track_info_collkey() */
+	_Atomic(char *) collkey_artist;
+	_Atomic(char *) collkey_album;
+	_Atomic(char *) collkey_title;
+	_Atomic(char *) collkey_genre;
+	_Atomic(char *) collkey_comment;
+	_Atomic(char *) collkey_albumartist;
 
 	unsigned int play_count;
 
+	/* see ti_index.h, 0 if not in the index */
+	unsigned int index_id;
+
 	int is_va_compilation : 1;
+	/* artist or title is a best guess, not tagged */
+	unsigned int artist_guessed : 1;
+	unsigned int title_guessed : 1;
 	int bpm;
 };
 
@@ -126,8 +133,27 @@ typedef size_t sort_key_t;
 
 /* initializes only filename and ref */
 struct track_info *track_info_new(const char *filename);
+
+/*
+ * Like track_info_new() but @filename is not copied. codec and
+ * codec_profile set by the caller are not freed either. Used for entries
+ * that point into the mmap'd cache file, which is never unmapped.
+ */
+struct track_info *track_info_new_mapped(const char *filename);
+
+/*
+ * Replaces the previous comments.  They are freed with @ti because other
+ * threads may still be using them.  Only the main thread may call this on
+ * a track_info that other threads can see
+ */
 void track_info_set_comments(struct track_info *ti, struct keyval *comments);
 
+/* like track_info_set_comments() but only the array is owned, not the strings */
+void track_info_set_comments_mapped(struct track_info *ti, struct keyval *comments);
+
+/* @key is one of the SORT_* keys of a collkey_* field */
+const char *track_info_collkey(const struct track_info *ti, sort_key_t key);
+
 void track_info_ref(struct track_info *ti);
 void track_info_unref(struct track_info *ti);
 bool track_info_unique_ref(struct track_info *ti);
@@ -157,6 +183,13 @@ int track_info_matches(const struct track_info *ti, const char *text, unsigned i
 int track_info_matches_full(const struct track_info *ti, const char *text, unsigned int flags,
 		unsigned int exclude_flags, int match_all_words);
 
+/*
+ * like track_info_matches_full() but without the ti_index shortcut, which
+ * is only available in the main thread
+ */
+int track_info_matches_unindexed(const struct track_info *ti, const char *text,
+		unsigned int flags, unsigned int exclude_flags, int match_all_words);
+
 int track_info_cmp(const struct track_info *a, const struct track_info *b, const sort_key_t *keys);
 
 sort_key_t *parse_sort_keys(const char *value);
@@ -23,7 +23,7 @@
 #include "debug.h"
 #include "mergesort.h"
 #include "options.h"
-#include "u_collate.h"
+#include "intern.h"
 #include "rbtree.h"
 
 #include <ctype.h>
@@ -487,9 +487,10 @@ static inline void tree_win_get_selected(struct artist **artist, struct album **
 	}
 }
 
-static char *auto_artist_sort_name(const char *name)
+static const char *auto_artist_sort_name(const char *name)
 {
 	const char *name_orig = name;
+	const char *ret;
 	char *buf;
 
 	if (strncasecmp(name, "the ", 4) != 0)
@@ -506,65 +507,88 @@ static char *auto_artist_sort_name(const char *name)
 	sprintf(buf, "%s, %c%c%c", name, name_orig[0],
 					 name_orig[1],
 					 name_orig[2]);
-	return buf;
+	ret = intern_str(buf);
+	free(buf);
+	return ret;
 }
 
-static struct artist *artist_new(const char *name, const char *sort_name, int is_compilation)
+/*
+ * All strings are interned so this allocates nothing new for known names.
+ * Used directly for lookups, the result is only copied to the heap if it
+ * gets inserted.  artist_release() drops the references
+ */
+static void artist_init(struct artist *a, const char *name, const char *sort_name,
+		int is_compilation)
 {
-	struct artist *a = xnew(struct artist, 1);
-
-	a->name = xstrdup(name);
-	a->sort_name = sort_name ? xstrdup(sort_name) : NULL;
+	a->name = intern_str(name);
+	a->sort_name = sort_name ? intern_str(sort_name) : NULL;
 	a->auto_sort_name = auto_artist_sort_name(name);
-	a->collkey_name = u_strcasecoll_key(a->name);
-	a->collkey_sort_name = u_strcasecoll_key0(a->sort_name);
-	a->collkey_auto_sort_name = u_strcasecoll_key0(a->auto_sort_name);
+	a->collkey_name = intern_str_collkey(a->name);
+	a->collkey_sort_name = intern_str_collkey(a->sort_name);
+	a->collkey_auto_sort_name = intern_str_collkey(a->auto_sort_name);
 	a->expanded = 0;
 	a->is_compilation = is_compilation;
 	rb_root_init(&a->album_root);
+}
 
-	return a;
+static void artist_release(struct artist *a)
+{
+	intern_put(a->name);
+	intern_put(a->sort_name);
+	intern_put(a->auto_sort_name);
 }
 
 static struct artist *artist_copy(const struct artist *artist)
 {
-	return artist_new(artist->name, artist->sort_name, artist->is_compilation);
+	struct artist *a = xnew(struct artist, 1);
+
+	*a = *artist;
+	intern_ref(a->name);
+	intern_ref(a->sort_name);
+	intern_ref(a->auto_sort_name);
+	a->expanded = 0;
+	rb_root_init(&a->album_root);
+	return a;
 }
 
 static void artist_free(struct artist *artist)
 {
-	free(artist->name);
-	free(artist->sort_name);
-	free(artist->auto_sort_name);
-	free(artist->collkey_name);
-	free(artist->collkey_sort_name);
-	free(artist->collkey_auto_sort_name);
+	artist_release(artist);
 	free(artist);
 }
 
-static struct album *album_new(struct artist *artist, const char *name,
+static void album_init(struct album *album, struct artist *artist, const char *name,
 		const char *sort_name, int date)
 {
-	struct album *album = xnew(struct album, 1);
-
-	album->name = xstrdup(name);
-	album->sort_name = sort_name ? xstrdup(sort_name) : NULL;
-	album->collkey_name = u_strcasecoll_key(name);
-	album->collkey_sort_name = u_strcasecoll_key0(sort_name);
+	album->name = intern_str(name);
+	album->sort_name = sort_name ? intern_str(sort_name) : NULL;
+	album->collkey_name = intern_str_collkey(album->name);
+	album->collkey_sort_name = intern_str_collkey(album->sort_name);
 	album->date = date;
 	album->min_date = date;
 	rb_root_init(&album->track_root);
 	album->artist = artist;
+}
+
+static void album_release(struct album *album)
+{
+	intern_put(album->name);
+	intern_put(album->sort_name);
+}
+
+static struct album *album_copy(const struct album *album)
+{
+	struct album *a = xnew(struct album, 1);
 
-	return album;
+	*a = *album;
+	intern_ref(a->name);
+	intern_ref(a->sort_name);
+	return a;
 }
 
 static void album_free(struct album *album)
 {
-	free(album->name);
-	free(album->sort_name);
-	free(album->collkey_name);
-	free(album->collkey_sort_name);
+	album_release(album);
 	free(album);
 }
 
@@ -919,8 +943,8 @@ void tree_add_track(struct tree_track *track)
 	const struct track_info *ti = tree_track_info(track);
 	const char *album_name, *artist_name, *artistsort_name = NULL;
 	const char *albumsort_name = NULL;
-	struct artist *artist, *new_artist;
-	struct album *album, *new_album;
+	struct artist *artist, *new_artist, artist_key;
+	struct album *album, *new_album, album_key = { .name = NULL, .sort_name = NULL };
 	int date;
 	int is_va_compilation = 0;
 
@@ -940,45 +964,39 @@ void tree_add_track(struct tree_track *track)
 		is_va_compilation = ti->is_va_compilation;
 	}
 
-	new_artist = artist_new(artist_name, artistsort_name, is_va_compilation);
+	artist_init(&artist_key, artist_name, artistsort_name, is_va_compilation);
 	album = NULL;
 
-	artist = find_artist(new_artist);
+	artist = find_artist(&artist_key);
 	if (artist) {
-		artist_free(new_artist);
-		new_album = album_new(artist, album_name, albumsort_name, date);
-		album = find_album(new_album);
-		if (album)
-			album_free(new_album);
-	} else
-		new_album = album_new(new_artist, album_name, albumsort_name, date);
+		album_init(&album_key, artist, album_name, albumsort_name, date);
+		album = find_album(&album_key);
+	}
 
 	if (artist) {
+		const char *old_name = NULL;
 		int changed = 0;
 		/* If it makes sense to update sort_name, do it */
-		if (!artist->sort_name && artistsort_name) {
-			artist->sort_name = xstrdup(artistsort_name);
-			artist->collkey_sort_name = u_strcasecoll_key(artistsort_name);
+		if (!artist->sort_name && artist_key.sort_name) {
+			artist->sort_name = intern_ref(artist_key.sort_name);
+			artist->collkey_sort_name = artist_key.collkey_sort_name;
 			changed = 1;
 		}
 		/* If names differ, update */
-		if (!artist->auto_sort_name) {
-			char *auto_sort_name = auto_artist_sort_name(artist_name);
-			if (auto_sort_name) {
-				free(artist->name);
-				free(artist->collkey_name);
-				artist->name = xstrdup(artist_name);
-				artist->collkey_name = u_strcasecoll_key(artist_name);
-				artist->auto_sort_name = auto_sort_name;
-				artist->collkey_auto_sort_name = u_strcasecoll_key(auto_sort_name);
-				changed = 1;
-			}
+		if (!artist->auto_sort_name && artist_key.auto_sort_name) {
+			old_name = artist->name;
+			artist->name = intern_ref(artist_key.name);
+			artist->collkey_name = artist_key.collkey_name;
+			artist->auto_sort_name = intern_ref(artist_key.auto_sort_name);
+			artist->collkey_auto_sort_name = artist_key.collkey_auto_sort_name;
+			changed = 1;
 		}
 		if (changed) {
 			remove_artist(artist);
 			add_artist(artist);
 			window_changed(lib_tree_win);
 		}
+		intern_put(old_name);
 	}
 
 	if (album) {
@@ -1004,12 +1022,16 @@ void tree_add_track(struct tree_track *track)
 		}
 
 	} else if (artist) {
+		new_album = album_copy(&album_key);
 		add_album(new_album);
 		album_add_track(new_album, track);
 
 		if (artist->expanded)
 			window_changed(lib_tree_win);
 	} else {
+		new_artist = artist_copy(&artist_key);
+		album_init(&album_key, new_artist, album_name, albumsort_name, date);
+		new_album = album_copy(&album_key);
 		add_artist(new_artist);
 		add_album(new_album);
 		album_add_track(new_album, track);
@@ -1019,6 +1041,9 @@ void tree_add_track(struct tree_track *track)
 
 	if (track_visible(track))
 		window_changed(lib_track_win);
+
+	artist_release(&artist_key);
+	album_release(&album_key);
 }
 
 static void remove_sel_artist(struct artist *artist)
@@ -655,8 +655,18 @@ static inline int do_u_strncase_equal(const char *a, const char *b, size_t len,
 	size_t i;
 
 	for (i = 0; i < len; i++) {
+		unsigned char ac = a[ai], bc = b[bi];
 		uchar au, bu;
 
+		if (ac < 0x80 && bc < 0x80) {
+			/* ASCII has no decomposition */
+			if (ac != bc && u_casefold_char(ac) != u_casefold_char(bc))
+				return 0;
+			ai++;
+			bi++;
+			continue;
+		}
+
 		au = u_get_char(a, &ai);
 		bu = u_get_char(b, &bi);
 
@@ -682,6 +692,24 @@ int u_strncase_equal_base(const char *a, const char *b, size_t len)
 	return do_u_strncase_equal(a, b, len, 1);
 }
 
+char *u_casefold_base(const char *str)
+{
+	GBUF(out);
+	int i = 0;
+
+	while (str[i]) {
+		char buf[4];
+		int buflen = 0;
+		uchar ch = u_get_char(str, &i);
+
+		ch = u_casefold_char(get_base_from_composed(ch));
+		u_set_char_raw(buf, &buflen, ch);
+		gbuf_add_bytes(&out, buf, buflen);
+	}
+
+	return gbuf_steal(&out);
+}
+
 static inline char *do_u_strcasestr(const char *haystack, const char *needle, int only_base_chars)
 {
 	/* strlen is faster and works here */
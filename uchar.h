@@ -256,6 +256,17 @@ char *u_strcasestr(const char *haystack, const char *needle);
  */
 char *u_strcasestr_base(const char *haystack, const char *needle);
 
+/*
+ * @str  valid null-terminated UTF-8 string
+ *
+ * Like u_casefold(), but also reduces characters to their base characters.
+ * @needle is found in @haystack by u_strcasestr_base() only if the result
+ * for @needle is a substring of the result for @haystack.
+ *
+ * Returns a newly allocated string
+ */
+char *u_casefold_base(const char *str);
+
 /*
  * @haystack  null-terminated string in local encoding
  * @needle    valid, normalized, null-terminated UTF-8 string
@@ -51,6 +51,8 @@
 #include "mixer.h"
 #include "mpris.h"
 #include "locking.h"
+#include "cache.h"
+#include "watch.h"
 #ifdef HAVE_CONFIG
 #include "config/curses.h"
 #include "config/iconv.h"
@@ -126,8 +128,8 @@ static char conv_buffer[512];
 /* one character can take up to 4 bytes in UTF-8 */
 #define print_buffer_max_width (sizeof(print_buffer) / 4 - 1)
 
-/* used for messages to the client */
-static int client_fd = -1;
+/* messages for the client whose command is running */
+static struct gbuf *client_out = NULL;
 
 static char tcap_buffer[64];
 static const char *t_ts;
@@ -1555,6 +1557,16 @@ void update_filterline(void)
 	}
 }
 
+/* some messages end with a newline, an empty line would end the answer */
+static void add_client_msg(const char *msg)
+{
+	size_t len = strlen(msg);
+
+	gbuf_add_bytes(client_out, msg, len);
+	if (!len || msg[len - 1] != '\n')
+		gbuf_add_ch(client_out, '\n');
+}
+
 void info_msg(const char *format, ...)
 {
 	va_list ap;
@@ -1563,10 +1575,8 @@ void info_msg(const char *format, ...)
 	vsnprintf(error_buf, sizeof(error_buf), format, ap);
 	va_end(ap);
 
-	if (client_fd != -1) {
-		write_all(client_fd, error_buf, strlen(error_buf));
-		write_all(client_fd, "\n", 1);
-	}
+	if (client_out)
+		add_client_msg(error_buf);
 
 	msg_is_error = 0;
 
@@ -1583,10 +1593,8 @@ void error_msg(const char *format, ...)
 	va_end(ap);
 
 	d_print("%s\n", error_buf);
-	if (client_fd != -1) {
-		write_all(client_fd, error_buf, strlen(error_buf));
-		write_all(client_fd, "\n", 1);
-	}
+	if (client_out)
+		add_client_msg(error_buf);
 
 	msg_is_error = 1;
 	error_count++;
@@ -1690,14 +1698,14 @@ void search_not_found(void)
 	info_msg("%s not found: %s", what, search_str ? search_str : "");
 }
 
-void set_client_fd(int fd)
+void set_client_output(struct gbuf *out)
 {
-	client_fd = fd;
+	client_out = out;
 }
 
-int get_client_fd(void)
+struct gbuf *get_client_output(void)
 {
-	return client_fd;
+	return client_out;
 }
 
 void set_view(int view)
@@ -1978,11 +1986,15 @@ static void update(void)
 		refresh();
 	}
 
-	if (player_info.status_changed)
+	if (player_info.status_changed) {
 		mpris_playback_status_changed();
+		server_status_changed();
+	}
 
-	if (player_info.file_changed || player_info.metadata_changed)
+	if (player_info.file_changed || player_info.metadata_changed) {
 		mpris_metadata_changed();
+		server_track_changed();
+	}
 
 	needs_spawn = player_info.status_changed || player_info.file_changed ||
 		player_info.metadata_changed;
@@ -2182,17 +2194,25 @@ static void main_loop(void)
 
 	fd_high = server_socket;
 	while (cmus_running) {
-		fd_set set;
+		fd_set set, wset;
 		struct timeval tv;
-		int poll_mixer = 0;
-		int i, nr_fds = 0;
+		int poll_mixer = 0, busy_clients = 0, filtering;
+		int i, nr_fds = 0, watch_timeout;
 		int fds[NR_MIXER_FDS];
 		struct list_head *item;
 		struct client *client;
 
 		player_info_snapshot();
+		if (player_info.nr_played) {
+			cache_lock();
+			for (i = 0; i < player_info.nr_played; i++)
+				cache_played(player_info.played[i]);
+			cache_unlock();
+		}
 
+		filtering = lib_filter_step();
 		update();
+		server_update();
 
 		/* Timeout must be so small that screen updates seem instant.
 		 * Only affects changes done in other threads (player).
@@ -2210,15 +2230,30 @@ static void main_loop(void)
 			tv.tv_usec = 100e3;
 		}
 
+		watch_timeout = watch_poll();
+		if (watch_timeout >= 0 && !tv.tv_usec)
+			tv.tv_sec = watch_timeout;
+
 		FD_ZERO(&set);
+		FD_ZERO(&wset);
 		SELECT_ADD_FD(0);
 		SELECT_ADD_FD(job_fd);
 		SELECT_ADD_FD(cmus_next_track_request_fd);
 		SELECT_ADD_FD(server_socket);
 		if (mpris_fd != -1)
 			SELECT_ADD_FD(mpris_fd);
+		if (watch_fd != -1)
+			SELECT_ADD_FD(watch_fd);
 		list_for_each_entry(client, &client_head, node) {
-			SELECT_ADD_FD(client->fd);
+			if (server_client_wants_input(client))
+				SELECT_ADD_FD(client->fd);
+			if (server_client_wants_output(client)) {
+				FD_SET(client->fd, &wset);
+				if (client->fd > fd_high)
+					fd_high = client->fd;
+			}
+			if (server_client_has_commands(client))
+				busy_clients = 1;
 		}
 		if (!soft_vol) {
 			nr_fds = mixer_get_fds(fds);
@@ -2233,7 +2268,15 @@ static void main_loop(void)
 			}
 		}
 
-		rc = select(fd_high + 1, &set, NULL, NULL, tv.tv_usec ? &tv : NULL);
+		/* pipelined commands or filter results are waiting, only poll */
+		if (busy_clients || filtering) {
+			tv.tv_sec = 0;
+			tv.tv_usec = 0;
+		}
+
+		rc = select(fd_high + 1, &set, &wset, NULL,
+				tv.tv_sec || tv.tv_usec || busy_clients || filtering ?
+				&tv : NULL);
 		if (poll_mixer) {
 			int ol = volume_l;
 			int or = volume_r;
@@ -2241,6 +2284,7 @@ static void main_loop(void)
 			mixer_read_volume();
 			if (ol != volume_l || or != volume_r) {
 				mpris_volume_changed();
+				server_volume_changed();
 				update_statusline();
 			}
 
@@ -2251,7 +2295,10 @@ static void main_loop(void)
 				ctrl_c_pressed = 0;
 			}
 
-			continue;
+			if (rc < 0)
+				continue;
+			FD_ZERO(&set);
+			FD_ZERO(&wset);
 		}
 
 		for (i = 0; i < nr_fds; i++) {
@@ -2259,6 +2306,7 @@ static void main_loop(void)
 				d_print("vol changed\n");
 				mixer_read_volume();
 				mpris_volume_changed();
+				server_volume_changed();
 				update_statusline();
 			}
 		}
@@ -2269,9 +2317,13 @@ static void main_loop(void)
 		item = client_head.next;
 		while (item != &client_head) {
 			struct list_head *next = item->next;
+			int readable, writable;
+
 			client = container_of(item, struct client, node);
-			if (FD_ISSET(client->fd, &set))
-				server_serve(client);
+			readable = FD_ISSET(client->fd, &set);
+			writable = FD_ISSET(client->fd, &wset);
+			if (readable || writable || server_client_has_commands(client))
+				server_serve(client, readable, writable);
 			item = next;
 		}
 
@@ -2284,6 +2336,9 @@ static void main_loop(void)
 		if (FD_ISSET(job_fd, &set))
 			job_handle();
 
+		if (watch_fd != -1 && FD_ISSET(watch_fd, &set))
+			watch_handle();
+
 		if (FD_ISSET(cmus_next_track_request_fd, &set))
 			cmus_provide_next_track();
 	}
@@ -2435,6 +2490,8 @@ static void init_all(void)
 
 	cmus_add(lib_add_track, lib_autosave_filename, FILE_TYPE_PL,
 			JOB_TYPE_LIB, 0, NULL);
+	watch_init();
+	cache_schedule_startup_compact();
 
 	worker_start();
 }
@@ -2448,6 +2505,7 @@ static void exit_all(void)
 	options_exit();
 
 	server_exit();
+	watch_exit();
 	cmus_exit();
 	if (resume_cmus)
 		cmus_save(play_queue_for_each, play_queue_autosave_filename,
@@ -64,8 +64,9 @@ void error_msg(const char *format, ...) CMUS_FORMAT(1, 2);
 enum ui_query_answer yes_no_query(const char *format, ...) CMUS_FORMAT(1, 2);
 void search_not_found(void);
 void set_view(int view);
-void set_client_fd(int fd);
-int get_client_fd(void);
+/* where info_msg(), error_msg() and "save -" write for a remote client */
+void set_client_output(struct gbuf *out);
+struct gbuf *get_client_output(void);
 void enter_command_mode(void);
 void enter_search_mode(void);
 void enter_search_backward_mode(void);
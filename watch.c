@@ -0,0 +1,572 @@
+/*
+ * Copyright 2008-2013 Various Authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "watch.h"
+#include "job.h"
+#include "worker.h"
+#include "lib.h"
+#include "cmus.h"
+#include "options.h"
+#include "misc.h"
+#include "file.h"
+#include "load_dir.h"
+#include "locking.h"
+#include "xmalloc.h"
+#include "xstrjoin.h"
+#include "debug.h"
+#ifdef HAVE_CONFIG
+#include "config/inotify.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+		IN_MOVED_TO | IN_ONLYDIR)
+#endif
+
+int watch_fd = -1;
+
+static int initialized;
+
+/* directories added to the library, none of them is below another */
+static char **roots;
+static int nr_roots;
+static char *roots_filename;
+
+/* protects watch_fd and wd_paths, watches are added by the worker */
+static pthread_mutex_t watch_mutex = CMUS_MUTEX_INITIALIZER;
+
+/* path of the directory for each watch descriptor */
+static char **wd_paths;
+static int wd_size;
+
+/* some directories are not watched, rescan periodically */
+static int watch_incomplete;
+static time_t next_rescan;
+
+static void watch_lock(void)
+{
+	cmus_mutex_lock(&watch_mutex);
+}
+
+static void watch_unlock(void)
+{
+	cmus_mutex_unlock(&watch_mutex);
+}
+
+/* @path is @dir or inside it */
+static int is_below(const char *path, const char *dir)
+{
+	int len = strlen(dir);
+
+	if (len == 1 && dir[0] == '/')
+		return 1;
+	return strncmp(path, dir, len) == 0 && (path[len] == '/' || path[len] == 0);
+}
+
+static void roots_add(const char *dir)
+{
+	roots = xrenew(char *, roots, nr_roots + 1);
+	roots[nr_roots++] = xstrdup(dir);
+}
+
+static int add_root_line(void *data, const char *line)
+{
+	if (line[0] == '/')
+		roots_add(line);
+	return 0;
+}
+
+static void roots_save(void)
+{
+	char *tmp = xstrjoin(roots_filename, ".tmp");
+	int fd, i;
+
+	fd = open(tmp, O_CREAT | O_WRONLY | O_TRUNC, 0666);
+	if (fd == -1) {
+		d_print("error: creating %s: %s\n", tmp, strerror(errno));
+		free(tmp);
+		return;
+	}
+	for (i = 0; i < nr_roots; i++) {
+		char *line = xstrjoin(roots[i], "\n");
+
+		write_all(fd, line, strlen(line));
+		free(line);
+	}
+	close(fd);
+	if (rename(tmp, roots_filename))
+		d_print("error: renaming %s: %s\n", tmp, strerror(errno));
+	free(tmp);
+}
+
+static void watch_root(const char *dir)
+{
+	struct watch_data *data;
+
+	if (watch_fd == -1)
+		return;
+
+	data = xnew(struct watch_data, 1);
+	data->dir = xstrdup(dir);
+	job_schedule_watch(data);
+}
+
+static void update_add(struct update_data *d, struct track_info *ti)
+{
+	if (d->size == d->used) {
+		d->size = d->size ? d->size * 2 : 16;
+		d->ti = xrenew(struct track_info *, d->ti, d->size);
+	}
+	track_info_ref(ti);
+	d->ti[d->used++] = ti;
+}
+
+struct below_data {
+	struct update_data *d;
+	char **dirs;
+	int nr_dirs;
+};
+
+static int below_dirs_cb(void *data, struct track_info *ti)
+{
+	struct below_data *bd = data;
+	int i;
+
+	for (i = 0; i < bd->nr_dirs; i++) {
+		if (is_below(ti->filename, bd->dirs[i])) {
+			update_add(bd->d, ti);
+			break;
+		}
+	}
+	return 0;
+}
+
+/* schedules the update job for the library tracks below @dirs */
+static void update_below(char **dirs, int nr_dirs)
+{
+	struct update_data *upd = xnew0(struct update_data, 1);
+	struct below_data bd = { upd, dirs, nr_dirs };
+
+	lib_for_each(below_dirs_cb, &bd, NULL);
+	if (upd->used) {
+		job_schedule_update(upd);
+	} else {
+		free(upd->ti);
+		free(upd);
+	}
+}
+
+/*
+ * the library is only complete after the queued add jobs, including the
+ * one for lib.pl at startup, so the library tracks below @dir are looked
+ * up in watch_rescan() when the worker gets to it
+ */
+static void rescan_root(const char *dir)
+{
+	struct watch_data *data = xnew(struct watch_data, 1);
+
+	data->dir = xstrdup(dir);
+	job_schedule_rescan(data);
+}
+
+void watch_rescan(const char *dir)
+{
+	char *dirs[] = { (char *)dir };
+
+	/* deleted and modified files */
+	update_below(dirs, 1);
+	/* new files */
+	cmus_add(lib_add_track, dir, FILE_TYPE_DIR, JOB_TYPE_LIB, 0, NULL);
+}
+
+static void watch_start(void)
+{
+	int i;
+
+	if (!watch_library)
+		return;
+
+#ifdef HAVE_SYS_INOTIFY_H
+	watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (watch_fd == -1)
+		d_print("error: inotify_init1: %s\n", strerror(errno));
+#endif
+	watch_incomplete = watch_fd == -1;
+	next_rescan = 0;
+
+	/* watch first so nothing is missed, then pick up what changed */
+	for (i = 0; i < nr_roots; i++)
+		watch_root(roots[i]);
+	for (i = 0; i < nr_roots; i++)
+		rescan_root(roots[i]);
+}
+
+static void watch_stop(void)
+{
+	int i;
+
+	worker_remove_jobs_by_type(JOB_TYPE_WATCH);
+
+	watch_lock();
+	if (watch_fd != -1)
+		close(watch_fd);
+	watch_fd = -1;
+	for (i = 0; i < wd_size; i++)
+		free(wd_paths[i]);
+	free(wd_paths);
+	wd_paths = NULL;
+	wd_size = 0;
+	watch_incomplete = 0;
+	watch_unlock();
+}
+
+void watch_init(void)
+{
+	roots_filename = xstrjoin(cmus_config_dir, "/lib-dirs");
+	file_for_each_line(roots_filename, add_root_line, NULL);
+	initialized = 1;
+	watch_start();
+}
+
+void watch_exit(void)
+{
+	int i;
+
+	watch_stop();
+	for (i = 0; i < nr_roots; i++)
+		free(roots[i]);
+	free(roots);
+	roots = NULL;
+	nr_roots = 0;
+	free(roots_filename);
+	roots_filename = NULL;
+	initialized = 0;
+}
+
+void watch_update(void)
+{
+	if (!initialized)
+		return;
+	watch_stop();
+	watch_start();
+}
+
+void watch_add_root(const char *dir)
+{
+	int i, j;
+
+	for (i = 0; i < nr_roots; i++) {
+		if (is_below(dir, roots[i]))
+			return;
+	}
+
+	/* replaced by @dir */
+	for (i = j = 0; i < nr_roots; i++) {
+		if (is_below(roots[i], dir))
+			free(roots[i]);
+		else
+			roots[j++] = roots[i];
+	}
+	nr_roots = j;
+	roots_add(dir);
+	roots_save();
+
+	watch_root(dir);
+}
+
+void watch_clear_roots(void)
+{
+	int i;
+
+	/* commands_exit() clears the library after watch_exit() */
+	if (!initialized)
+		return;
+
+	for (i = 0; i < nr_roots; i++)
+		free(roots[i]);
+	nr_roots = 0;
+	roots_save();
+	watch_update();
+}
+
+int watch_add_dir(const char *path)
+{
+	int rc = 0;
+#ifdef HAVE_SYS_INOTIFY_H
+	int wd;
+
+	watch_lock();
+	if (watch_fd == -1) {
+		rc = -1;
+		goto out;
+	}
+	wd = inotify_add_watch(watch_fd, path, WATCH_MASK);
+	if (wd == -1) {
+		d_print("error: watching %s: %s\n", path, strerror(errno));
+		if (errno == ENOSPC || errno == ENOMEM) {
+			/* out of watches, fall back to rescanning */
+			watch_incomplete = 1;
+			rc = -1;
+		}
+		goto out;
+	}
+	if (wd >= wd_size) {
+		int size = wd_size ? wd_size : 64;
+
+		while (size <= wd)
+			size *= 2;
+		wd_paths = xrenew(char *, wd_paths, size);
+		memset(wd_paths + wd_size, 0, (size - wd_size) * sizeof(char *));
+		wd_size = size;
+	}
+	free(wd_paths[wd]);
+	wd_paths[wd] = xstrdup(path);
+out:
+	watch_unlock();
+#else
+	rc = -1;
+#endif
+	return rc;
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+
+/* changes collected from one batch of events */
+struct changes {
+	/* new or modified files */
+	struct ptr_array files;
+	/* deleted files or directories */
+	struct ptr_array removed;
+	int rescan;
+};
+
+static void forget_dirs_below(const char *dir)
+{
+	int i;
+
+	watch_lock();
+	for (i = 0; i < wd_size; i++) {
+		if (wd_paths[i] && is_below(wd_paths[i], dir)) {
+			inotify_rm_watch(watch_fd, i);
+			free(wd_paths[i]);
+			wd_paths[i] = NULL;
+		}
+	}
+	watch_unlock();
+}
+
+/* drops @path from the new files, it was a temporary file */
+static void changes_drop_file(struct changes *ch, const char *path)
+{
+	char **files = ch->files.ptrs;
+	int i;
+
+	for (i = 0; i < ch->files.count; i++) {
+		if (strcmp(files[i], path) == 0) {
+			free(files[i]);
+			files[i] = files[--ch->files.count];
+			return;
+		}
+	}
+}
+
+static void handle_event(const struct inotify_event *ev, struct changes *ch)
+{
+	char *path = NULL;
+
+	if (ev->mask & IN_Q_OVERFLOW) {
+		d_print("inotify queue overflow\n");
+		ch->rescan = 1;
+		return;
+	}
+
+	watch_lock();
+	if (ev->wd >= 0 && ev->wd < wd_size && wd_paths[ev->wd]) {
+		if (ev->mask & IN_IGNORED) {
+			free(wd_paths[ev->wd]);
+			wd_paths[ev->wd] = NULL;
+		} else if (ev->len && ev->name[0] != '.') {
+			path = xstrjoin(wd_paths[ev->wd], "/", ev->name);
+		}
+	}
+	watch_unlock();
+
+	if (!path)
+		return;
+
+	if (ev->mask & IN_ISDIR) {
+		if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+			d_print("new directory %s\n", path);
+			watch_root(path);
+			rescan_root(path);
+		} else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+			forget_dirs_below(path);
+			ptr_array_add(&ch->removed, path);
+			return;
+		}
+	} else if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE)) {
+		struct stat st;
+
+		/*
+		 * files written in place are added on IN_CLOSE_WRITE, only
+		 * those created with their contents (link(2)) are added on
+		 * IN_CREATE
+		 */
+		if ((ev->mask & IN_CREATE) && (stat(path, &st) || st.st_size == 0)) {
+			free(path);
+			return;
+		}
+		if (cmus_is_playable(path)) {
+			changes_drop_file(ch, path);
+			ptr_array_add(&ch->files, path);
+			return;
+		}
+	} else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+		changes_drop_file(ch, path);
+		ptr_array_add(&ch->removed, path);
+		return;
+	}
+	free(path);
+}
+
+static void changes_flush(struct changes *ch)
+{
+	struct update_data *upd = xnew0(struct update_data, 1);
+	struct below_data bd = { upd, NULL, 0 };
+	struct add_files_data *add = xnew0(struct add_files_data, 1);
+	char **files = ch->files.ptrs;
+	char **removed = ch->removed.ptrs;
+	PTR_ARRAY(dirs);
+	int i;
+
+	add->add = lib_add_track;
+	add->names = xnew(char *, ch->files.count);
+	for (i = 0; i < ch->files.count; i++) {
+		char *path = files[i];
+		struct track_info *ti = lib_lookup(path);
+
+		if (ti) {
+			/* removed and added again if it has been modified */
+			update_add(upd, ti);
+			free(path);
+		} else {
+			add->names[add->nr++] = path;
+		}
+	}
+
+	for (i = 0; i < ch->removed.count; i++) {
+		char *path = removed[i];
+		struct track_info *ti = lib_lookup(path);
+
+		if (ti) {
+			update_add(upd, ti);
+			free(path);
+		} else {
+			/* maybe a directory */
+			ptr_array_add(&dirs, path);
+		}
+	}
+	if (dirs.count) {
+		bd.dirs = dirs.ptrs;
+		bd.nr_dirs = dirs.count;
+		lib_for_each(below_dirs_cb, &bd, NULL);
+		ptr_array_plug(&dirs);
+		free_str_array(dirs.ptrs);
+	}
+
+	if (upd->used) {
+		job_schedule_update(upd);
+	} else {
+		free(upd->ti);
+		free(upd);
+	}
+	if (add->nr) {
+		job_schedule_add_files(JOB_TYPE_LIB, add);
+	} else {
+		free(add->names);
+		free(add);
+	}
+
+	free(ch->files.ptrs);
+	free(ch->removed.ptrs);
+
+	if (ch->rescan) {
+		for (i = 0; i < nr_roots; i++)
+			rescan_root(roots[i]);
+	}
+}
+
+#endif
+
+void watch_handle(void)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+	char buf[16 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct changes ch = { { NULL, 0, 0 }, { NULL, 0, 0 }, 0 };
+	int i;
+
+	/* don't starve the UI during a burst, the rest is read next time */
+	for (i = 0; i < 16; i++) {
+		ssize_t rc = read(watch_fd, buf, sizeof(buf));
+		char *ptr = buf;
+
+		if (rc <= 0)
+			break;
+		while (ptr < buf + rc) {
+			const struct inotify_event *ev = (struct inotify_event *)ptr;
+
+			handle_event(ev, &ch);
+			ptr += sizeof(*ev) + ev->len;
+		}
+	}
+	changes_flush(&ch);
+#endif
+}
+
+int watch_poll(void)
+{
+	int incomplete, i;
+	time_t now;
+
+	if (!initialized || !watch_library || !watch_rescan_interval || !nr_roots)
+		return -1;
+
+	watch_lock();
+	incomplete = watch_incomplete;
+	watch_unlock();
+	if (!incomplete)
+		return -1;
+
+	now = time(NULL);
+	if (!next_rescan)
+		next_rescan = now + watch_rescan_interval * 60;
+	if (now >= next_rescan) {
+		for (i = 0; i < nr_roots; i++)
+			rescan_root(roots[i]);
+		next_rescan = now + watch_rescan_interval * 60;
+	}
+	return next_rescan - now;
+}
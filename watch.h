@@ -0,0 +1,64 @@
+/*
+ * Copyright 2008-2013 Various Authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CMUS_WATCH_H
+#define CMUS_WATCH_H
+
+/*
+ * Keeps the library in sync with the directories that were added to it.
+ * Changes are picked up with inotify where available, otherwise (or if
+ * the watch limit is reached) the directories are rescanned every
+ * watch_rescan_interval minutes.
+ */
+
+/* readable when there are events for watch_handle(), -1 if not watching */
+extern int watch_fd;
+
+void watch_init(void);
+void watch_exit(void);
+
+/* starts or stops watching after watch_library has been changed */
+void watch_update(void);
+
+/* @dir has been added to the library */
+void watch_add_root(const char *dir);
+
+/* the library has been cleared */
+void watch_clear_roots(void);
+
+/* reads events from watch_fd and schedules jobs for the changed files */
+void watch_handle(void);
+
+/*
+ * runs the fallback rescan if it is due.  returns the number of seconds
+ * until the next one or -1 if there is none
+ */
+int watch_poll(void);
+
+/*
+ * reloads the library tracks below @dir that were deleted or modified and
+ * adds new files.  called by job_handle() for a rescan job
+ */
+void watch_rescan(const char *dir);
+
+/*
+ * called by the worker thread for every directory below a root.
+ * returns -1 if no more directories can be watched
+ */
+int watch_add_dir(const char *path);
+
+#endif
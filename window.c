@@ -46,6 +46,8 @@ struct window *window_new(int (*get_prev)(struct iter *), int (*get_next)(struct
 	win->get_next = get_next;
 	win->get_prev = get_prev;
 	win->selectable = NULL;
+	win->get_pos = NULL;
+	win->get_at = NULL;
 	win->sel_changed = NULL;
 	win->nr_rows = 1;
 	win->changed = 1;
@@ -197,6 +199,50 @@ void window_down(struct window *win, int rows)
 		sel_changed(win);
 }
 
+/* row number of @iter, which must be a real row */
+static int row_nr(struct window *win, struct iter *iter)
+{
+	struct iter tmp;
+	int nr = 0;
+
+	if (win->get_pos)
+		return win->get_pos(iter);
+
+	tmp = win->head;
+	win->get_next(&tmp);
+	while (!iters_equal(&tmp, iter)) {
+		BUG_ON(!win->get_next(&tmp));
+		nr++;
+	}
+	return nr;
+}
+
+/* store row number @nr to @iter, returns 0 if there is no such row */
+static int row_at(struct window *win, int nr, struct iter *iter)
+{
+	*iter = win->head;
+	if (win->get_at)
+		return win->get_at(iter, nr);
+
+	if (nr < 0)
+		return 0;
+	do {
+		if (!win->get_next(iter))
+			return 0;
+	} while (nr--);
+	return 1;
+}
+
+/* row number of the last row, -1 if there are no rows */
+static int last_row_nr(struct window *win)
+{
+	struct iter iter = win->head;
+
+	if (!win->get_prev(&iter))
+		return -1;
+	return row_nr(win, &iter);
+}
+
 /*
  * minimize number of empty lines visible
  * make sure selection is visible
@@ -225,6 +271,28 @@ void window_changed(struct window *win)
 	/* make sure the selected row is visible */
 
 	/* get distance between top and sel */
+	if (win->get_pos && !iter_is_empty(&win->sel)) {
+		int sel_nr = win->get_pos(&win->sel);
+
+		delta = sel_nr - win->get_pos(&win->top);
+		if (delta < 0) {
+			/* sel < top */
+			win->top = win->sel;
+			goto minimize;
+		}
+		if (delta > win->nr_rows - 1) {
+			/* sel becomes the last visible row */
+			if (win->get_at) {
+				row_at(win, sel_nr - win->nr_rows + 1, &win->top);
+			} else {
+				win->top = win->sel;
+				for (delta = win->nr_rows - 1; delta > 0; delta--)
+					win->get_prev(&win->top);
+			}
+		}
+		goto minimize;
+	}
+
 	delta = 0;
 	iter = win->top;
 	while (!iters_equal(&iter, &win->sel)) {
@@ -355,21 +423,8 @@ void window_set_sel(struct window *win, struct iter *iter)
 		return;
 	win->sel = *iter;
 
-	tmp = win->head;
-	win->get_next(&tmp);
-	top_nr = 0;
-	while (!iters_equal(&tmp, &win->top)) {
-		win->get_next(&tmp);
-		top_nr++;
-	}
-
-	tmp = win->head;
-	win->get_next(&tmp);
-	sel_nr = 0;
-	while (!iters_equal(&tmp, &win->sel)) {
-		BUG_ON(!win->get_next(&tmp));
-		sel_nr++;
-	}
+	top_nr = row_nr(win, &win->top);
+	sel_nr = row_nr(win, &win->sel);
 
 	upper_bound = win->nr_rows / 2;
 	if (scroll_offset < upper_bound)
@@ -395,10 +450,8 @@ void window_set_sel(struct window *win, struct iter *iter)
 		tmp = win->sel;
 		bottom_nr = sel_nr;
 		if (sel_nr >= top_nr + win->nr_rows) { /* selected element not visible */
-			while (sel_nr >= top_nr + win->nr_rows) {
-				win->get_next(&win->top);
-				top_nr++;
-			}
+			top_nr = sel_nr - win->nr_rows + 1;
+			row_at(win, top_nr, &win->top);
 		} else { /* selected element visible */
 			while (bottom_nr + 1 < top_nr + win->nr_rows) {
 				if (!win->get_next(&tmp)) { /* no space below */
@@ -439,6 +492,17 @@ void window_goto_bottom(struct window *win)
 	int count;
 
 	old_sel = win->sel;
+	if (win->get_at && !win->selectable) {
+		count = last_row_nr(win);
+		if (count >= 0) {
+			row_at(win, count, &win->sel);
+			count -= win->nr_rows - 1;
+			row_at(win, count < 0 ? 0 : count, &win->top);
+			if (!iters_equal(&old_sel, &win->sel))
+				sel_changed(win);
+			return;
+		}
+	}
 	win->sel = win->head;
 	win->get_prev(&win->sel);
 	win->top = win->sel;
@@ -457,12 +521,54 @@ void window_goto_bottom(struct window *win)
 		sel_changed(win);
 }
 
+/*
+ * move sel and top by @n rows (up if negative) with indexed lookups, stopping
+ * at the first or last row like the walking loops do
+ *
+ * returns 0 if rows can't be looked up by number
+ */
+static int window_scroll_at(struct window *win, int n)
+{
+	int sel_nr, top_nr, last_nr, bot_nr;
+
+	if (!win->get_at || !win->get_pos || win->selectable ||
+			iter_is_empty(&win->sel) || iter_is_empty(&win->top))
+		return 0;
+
+	sel_nr = win->get_pos(&win->sel);
+	top_nr = win->get_pos(&win->top);
+	if (n < 0) {
+		if (n < -sel_nr)
+			n = -sel_nr;
+		if (n < -top_nr)
+			n = -top_nr;
+	} else {
+		last_nr = last_row_nr(win);
+		bot_nr = top_nr + win->nr_rows - 1;
+		if (bot_nr > last_nr)
+			bot_nr = last_nr;
+		if (n > last_nr - sel_nr)
+			n = last_nr - sel_nr;
+		if (n > last_nr - bot_nr)
+			n = last_nr - bot_nr;
+	}
+	if (n == 0)
+		return 1;
+	row_at(win, sel_nr + n, &win->sel);
+	row_at(win, top_nr + n, &win->top);
+	sel_changed(win);
+	return 1;
+}
+
 void window_page_up(struct window *win)
 {
 	struct iter sel = win->sel;
 	struct iter top = win->top;
 	int up;
 
+	if (window_scroll_at(win, -(win->nr_rows - 1)))
+		return;
+
 	for (up = 0; up < win->nr_rows - 1; up++) {
 		if (!win->get_prev(&sel) || !win->get_prev(&top))
 			break;
@@ -481,6 +587,9 @@ void window_half_page_up(struct window *win)
 	struct iter top = win->top;
 	int up;
 
+	if (window_scroll_at(win, -((win->nr_rows - 1) / 2)))
+		return;
+
 	for (up = 0; up < (win->nr_rows - 1) / 2; up++) {
 		if (!win->get_prev(&sel) || !win->get_prev(&top))
 			break;
@@ -515,6 +624,9 @@ void window_page_down(struct window *win)
 	struct iter top = win->top;
 	int down;
 
+	if (window_scroll_at(win, win->nr_rows - 1))
+		return;
+
 	for (down = 0; down < win->nr_rows - 1; down++) {
 		if (!win->get_next(&sel) || !win->get_next(&bot))
 			break;
@@ -535,6 +647,9 @@ void window_half_page_down(struct window *win)
 	struct iter top = win->top;
 	int down;
 
+	if (window_scroll_at(win, (win->nr_rows - 1) / 2))
+		return;
+
 	for (down = 0; down < (win-> nr_rows - 1) / 2; down++) {
 		if (!win->get_next(&sel) || !win->get_next(&bot))
 			break;
@@ -34,6 +34,10 @@
  * these return 1 if the new row is real row (not head), 0 otherwise
  *
  * sel_changed callback is called if not NULL and selection has changed
+ *
+ * get_pos and get_at are optional, with them positions are computed and rows
+ * are looked up without walking the rows in between, which matters for long
+ * lists
  */
 
 struct window {
@@ -56,6 +60,10 @@ struct window {
 	int (*get_next)(struct iter *iter);
 	/* NULL if all rows are selectable */
 	int (*selectable)(struct iter *iter);
+	/* row number of a real row, NULL if rows can only be counted by walking */
+	int (*get_pos)(struct iter *iter);
+	/* store row @pos to @iter which holds the head, return 0 if there is no such row */
+	int (*get_at)(struct iter *iter, int pos);
 	void (*sel_changed)(void);
 };
 
@@ -128,8 +128,8 @@ void worker_exit(void)
 	pthread_join(worker_thread, NULL);
 }
 
-void worker_add_job(uint32_t type, void (*job_cb)(void *data),
-		void (*free_cb)(void *data), void *data)
+static void add_job(uint32_t type, void (*job_cb)(void *data),
+		void (*free_cb)(void *data), void *data, int first)
 {
 	struct worker_job *job;
 
@@ -140,11 +140,26 @@ void worker_add_job(uint32_t type, void (*job_cb)(void *data),
 	job->data = data;
 
 	worker_lock();
-	list_add_tail(&job->node, &worker_job_head);
+	if (first)
+		list_add(&job->node, &worker_job_head);
+	else
+		list_add_tail(&job->node, &worker_job_head);
 	pthread_cond_signal(&worker_cond);
 	worker_unlock();
 }
 
+void worker_add_job(uint32_t type, void (*job_cb)(void *data),
+		void (*free_cb)(void *data), void *data)
+{
+	add_job(type, job_cb, free_cb, data, 0);
+}
+
+void worker_add_job_first(uint32_t type, void (*job_cb)(void *job_data),
+		void (*free_cb)(void *job_data), void *job_data)
+{
+	add_job(type, job_cb, free_cb, job_data, 1);
+}
+
 static int worker_matches_type(uint32_t type, void *job_data,
 		void *opaque)
 {
@@ -204,14 +219,15 @@ int worker_has_job_by_cb(worker_match_cb cb, void *opaque)
 			break;
 		}
 	}
-	if (cur_job && cb(job->type, job->data, opaque))
+	if (cur_job && cb(cur_job->type, cur_job->data, opaque))
 		has_job = 1;
 	worker_unlock();
 	return has_job;
 }
 
 /*
- * this is only called from the worker thread
+ * this is only called from the worker thread or the pool threads the
+ * current job runs on
  * cur_job is guaranteed to be non-NULL
  */
 int worker_cancelling(void)
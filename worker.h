@@ -32,6 +32,9 @@ void worker_exit(void);
 
 void worker_add_job(uint32_t type, void (*job_cb)(void *job_data),
 		void (*free_cb)(void *job_data), void *job_data);
+/* like worker_add_job() but runs the job before the queued ones */
+void worker_add_job_first(uint32_t type, void (*job_cb)(void *job_data),
+		void (*free_cb)(void *job_data), void *job_data);
 
 /* NOTE: The callbacks below run in parallel with the job_cb function. Access to
  * job_data must by synchronized.